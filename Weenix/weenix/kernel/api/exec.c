@@ -2,6 +2,7 @@
 
 #include "main/interrupt.h"
 #include "main/gdt.h"
+#include "main/smp.h"
 
 #include "api/exec.h"
 #include "api/binfmt.h"
@@ -17,6 +18,8 @@ void userland_entry(const regs_t *regs)
 {
         intr_disable();
         intr_setipl(IPL_LOW);
+        /* User code runs without the kernel lock */
+        smp_kernel_unlock();
         /* We "return from the interrupt" to get into userland */
         __asm__ __volatile__(
                 "movl %%eax, %%esp\n\t" /* Move stack pointer up to regs */
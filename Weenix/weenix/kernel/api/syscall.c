@@ -12,6 +12,7 @@
 #include "util/string.h"
 #include "util/debug.h"
 #include "util/list.h"
+#include "util/time.h"
 
 #include "mm/mman.h"
 #include "mm/mm.h"
@@ -192,6 +193,64 @@ static int sys_dup2(const dup2_args_t *arg)
         } else return err;
 }
 
+/* Longest sleep, in seconds, whose length in ticks still fits in a
+ * positive int32_t. Longer requests are cut down to this, some 248
+ * days, rather than wrapping around into a short sleep. */
+#define NANOSLEEP_MAX_SECS      (0x7fffffff / TIME_MSECS_TO_TICKS(1000) - 1)
+
+/*
+ * Sleeps for the requested time. The time is rounded up to a whole
+ * number of clock ticks. If the sleep is interrupted the time left is
+ * written to rem (when rem is not NULL) and EINTR is returned.
+ */
+static int sys_nanosleep(nanosleep_args_t *arg)
+{
+        nanosleep_args_t        kern_args;
+        struct timespec         req, rem;
+        ktqueue_t               q;
+        uint32_t                ticks, end, now;
+        int                     err;
+
+        if ((err = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        if ((err = copy_from_user(&req, kern_args.req, sizeof(req))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        if (req.tv_sec > NANOSLEEP_MAX_SECS)
+                req.tv_sec = NANOSLEEP_MAX_SECS;
+        ticks = req.tv_sec * TIME_MSECS_TO_TICKS(1000)
+                + TIME_MSECS_TO_TICKS((req.tv_nsec + 999999) / 1000000);
+        end = time_ticks() + ticks;
+
+        /* nobody else ever waits on this queue, only the timer or a
+         * cancellation can wake us */
+        sched_queue_init(&q);
+        if ((err = sched_sleep_on_timeout(&q, ticks)) == -ETIMEDOUT) {
+                return 0;
+        }
+
+        if (NULL != kern_args.rem) {
+                now = time_ticks();
+                ticks = ((int32_t)(end - now) > 0) ? end - now : 0;
+                rem.tv_sec = ticks / TIME_MSECS_TO_TICKS(1000);
+                rem.tv_nsec = (ticks % TIME_MSECS_TO_TICKS(1000)) * TICK_MSECS * 1000000;
+                if ((err = copy_to_user(kern_args.rem, &rem, sizeof(rem))) < 0) {
+                        curthr->kt_errno = -err;
+                        return -1;
+                }
+        }
+        curthr->kt_errno = EINTR;
+        return -1;
+}
+
 static int sys_mkdir(mkdir_args_t *arg)
 {
         mkdir_args_t            kern_args;
@@ -488,11 +547,29 @@ static void sys_sync(void)
         pframe_clean_all();
 }
 
+static int sys_fsync(int fd, int datasync)
+{
+        int err;
+
+        if ((err = do_fsync(fd, datasync)) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
 static void sys_halt(void)
 {
         proc_kill_all();
 }
 
+/*
+ * Returns the number of bytes of memory the page allocator has free.
+ */
+static size_t sys_get_free_mem(void)
+{
+        return page_free_count() << PAGE_SHIFT;
+}
+
 static int sys_stat(stat_args_t *arg)
 {
         stat_args_t kern_args;
@@ -572,6 +649,64 @@ static int sys_fork(regs_t *regs)
         return ret;
 }
 
+#ifdef __MTP__
+static int sys_thr_create(thr_create_args_t *args, regs_t *regs)
+{
+        thr_create_args_t kargs;
+        int ret;
+
+        if ((ret = copy_from_user(&kargs, args, sizeof(kargs))) < 0)
+                goto err;
+        if ((ret = do_thr_create(regs, (uint32_t) kargs.tca_entry,
+                                 (uint32_t) kargs.tca_stack)) < 0)
+                goto err;
+        return ret;
+err:
+        curthr->kt_errno = -ret;
+        return -1;
+}
+
+static int sys_thr_join(thr_join_args_t *args)
+{
+        thr_join_args_t kargs;
+        kthread_t *thr;
+        void *retval;
+        int ret;
+
+        if ((ret = copy_from_user(&kargs, args, sizeof(kargs))) < 0)
+                goto err;
+        if (NULL == (thr = kthread_lookup(curproc, kargs.tja_tid))) {
+                ret = -ESRCH;
+                goto err;
+        }
+        if ((ret = kthread_join(thr, &retval)) < 0)
+                goto err;
+        if (NULL != kargs.tja_retval
+            && (ret = copy_to_user(kargs.tja_retval, &retval, sizeof(retval))) < 0)
+                goto err;
+        return 0;
+err:
+        curthr->kt_errno = -ret;
+        return -1;
+}
+
+static int sys_thr_detach(int tid)
+{
+        kthread_t *thr;
+        int ret;
+
+        if (NULL == (thr = kthread_lookup(curproc, tid))) {
+                curthr->kt_errno = ESRCH;
+                return -1;
+        }
+        if ((ret = kthread_detach(thr)) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return 0;
+}
+#endif
+
 static void free_vector(char **vect)
 {
         char **temp;
@@ -697,6 +832,9 @@ static void syscall_handler(regs_t *regs)
         dbg(DBG_SYSCALL, "<< pid %d, sysnum: %d (%x), returned: %d (%#x)\n",
             curproc->p_pid, sysnum, sysnum, ret, ret);
         regs->r_eax = ret; /* Return value goes in eax */
+
+        /* give up the processor if our quantum expired during the call */
+        sched_preempt_check();
 }
 
 static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
@@ -715,6 +853,9 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                         panic("thr_exit failed!\n");
                         return 0;
 
+                case SYS_sleep:
+                        return sys_nanosleep((nanosleep_args_t *)args);
+
                 case SYS_thr_yield:
                         sched_make_runnable(curthr);
                         sched_switch();
@@ -726,10 +867,30 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_getpid:
                         return curproc->p_pid;
 
+                case SYS_gettid:
+                        return curthr->kt_tid;
+
+#ifdef __MTP__
+                case SYS_thr_create:
+                        return sys_thr_create((thr_create_args_t *)args, regs);
+
+                case SYS_thr_join:
+                        return sys_thr_join((thr_join_args_t *)args);
+
+                case SYS_thr_detach:
+                        return sys_thr_detach((int)args);
+#endif
+
                 case SYS_sync:
                         sys_sync();
                         return 0;
 
+                case SYS_fsync:
+                        return sys_fsync((int)args, 0);
+
+                case SYS_fdatasync:
+                        return sys_fsync((int)args, 1);
+
 #ifdef __MOUNTING__
                 case SYS_mount:
                         return sys_mount((mount_args_t *) args);
@@ -793,6 +954,9 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                         sys_halt();
                         return -1;
 
+                case SYS_get_free_mem:
+                        return (int) sys_get_free_mem();
+
                 case SYS_set_errno:
                         curthr->kt_errno = (int)args;
                         return 0;
@@ -1,14 +1,19 @@
 #include "kernel.h"
+#include "config.h"
 #include "types.h"
 #include "util/debug.h"
 #include "util/list.h"
+#include "util/string.h"
 
 #include "drivers/blockdev.h"
 #include "drivers/disk/ata.h"
 
+#include "mm/page.h"
 #include "mm/pframe.h"
 #include "mm/mmobj.h"
 
+#include "proc/kmutex.h"
+
 static void blockdev_ref(mmobj_t *o);
 static void blockdev_put(mmobj_t *o);
 static int blockdev_lookuppage(mmobj_t *o, uint32_t pagenum,
@@ -16,6 +21,7 @@ static int blockdev_lookuppage(mmobj_t *o, uint32_t pagenum,
 static int blockdev_fillpage(mmobj_t *o, pframe_t *pf);
 static int blockdev_dirtypage(mmobj_t *o, pframe_t *pf);
 static int blockdev_cleanpage(mmobj_t *o, pframe_t *pf);
+static int blockdev_cleanpages(mmobj_t *o, pframe_t **pfs, int npages);
 
 static mmobj_ops_t blockdev_mmobj_ops = {
         .ref = blockdev_ref,
@@ -23,15 +29,27 @@ static mmobj_ops_t blockdev_mmobj_ops = {
         .lookuppage = blockdev_lookuppage,
         .fillpage = blockdev_fillpage,
         .dirtypage = blockdev_dirtypage,
-        .cleanpage = blockdev_cleanpage
+        .cleanpage = blockdev_cleanpage,
+        .cleanpages = blockdev_cleanpages
 };
 
 static list_t blockdevs;
 
+/* The disk transfers from one contiguous buffer, so blockdev_cleanpages
+ * gathers a cluster of pages into this one before writing it. It is
+ * allocated once here rather than during pageout, when memory is short,
+ * and blockdev_bounce_mutex serializes its users. */
+static char *blockdev_bounce;
+static kmutex_t blockdev_bounce_mutex;
+static kmutex_class_t blockdev_bounce_class = KMUTEX_CLASS_INITIALIZER("blockdev_bounce");
+
 void
 blockdev_init()
 {
         list_init(&blockdevs);
+        blockdev_bounce = page_alloc_n(PF_CLUSTER_MAX);
+        KASSERT(NULL != blockdev_bounce && "Ran out of memory while booting.");
+        kmutex_init_class(&blockdev_bounce_mutex, &blockdev_bounce_class);
         /* Initialize all subsystems */
         ata_init();
 }
@@ -74,23 +92,14 @@ blockdev_lookup(devid_t id)
 /*
  * Clean and then free all resident pages belonging to this
  * particular block device.
- * As with pframe_clean_all, this is not guaranteed to terminate.
  */
 void
 blockdev_flush_all(blockdev_t *dev)
 {
         pframe_t *pf;
 
-        /* Clean all pages - see pframe_clean_all for
-         * explanation of this loop */
-clean:
-        list_iterate_begin(&dev->bd_mmobj.mmo_respages, pf,
-                           pframe_t, pf_olink) {
-                if (pframe_is_dirty(pf)) {
-                        pframe_clean(pf);
-                        goto clean;
-                }
-        } list_iterate_end();
+        /* Clean all dirty pages, in block order */
+        pframe_clean_obj(&dev->bd_mmobj);
 
         /* Free all pages */
         list_iterate_begin(&dev->bd_mmobj.mmo_respages, pf,
@@ -141,3 +150,21 @@ blockdev_cleanpage(mmobj_t *o, pframe_t *pf)
         /* Clean the corresponding page by writing it back */
         return bd->bd_ops->write_block(bd, pf->pf_addr, pf->pf_pagenum, 1);
 }
+
+static int
+blockdev_cleanpages(mmobj_t *o, pframe_t **pfs, int npages)
+{
+        blockdev_t *bd = CONTAINER_OF(o, blockdev_t, bd_mmobj);
+        int i, ret;
+
+        KASSERT(0 < npages && npages <= PF_CLUSTER_MAX);
+
+        kmutex_lock(&blockdev_bounce_mutex);
+        for (i = 0; i < npages; ++i) {
+                KASSERT(pfs[i]->pf_pagenum == pfs[0]->pf_pagenum + i);
+                memcpy(blockdev_bounce + i * BLOCK_SIZE, pfs[i]->pf_addr, BLOCK_SIZE);
+        }
+        ret = bd->bd_ops->write_block(bd, blockdev_bounce, pfs[0]->pf_pagenum, npages);
+        kmutex_unlock(&blockdev_bounce_mutex);
+        return ret;
+}
@@ -89,6 +89,9 @@ static struct ata_channel {
 
 #define ATA_NUM_CHANNELS 2
 
+/* statistics of every disk's ata_mutex */
+static kmutex_class_t ata_mutex_class = KMUTEX_CLASS_INITIALIZER("ata_mutex");
+
 #define ATA_SECTOR_SIZE 512 /* Pretty much always true */
 
 /* Port address offsets for registers */
@@ -298,7 +301,7 @@ ata_init()
                 adisk->ata_sectors_per_block = BLOCK_SIZE / ATA_SECTOR_SIZE;
 
                 sched_queue_init(&adisk->ata_waitq);
-                kmutex_init(&adisk->ata_mutex);
+                kmutex_init_class(&adisk->ata_mutex, &ata_mutex_class);
 
                 dbg(DBG_DISK, "Initialized ATA device %d, channel %s, drive %s, size %d\n",
                     ii, (adisk->ata_channel ? "SECONDARY" : "PRIMARY"),
@@ -164,11 +164,10 @@ ramfs_alloc_inode(fs_t *fs, int type, devid_t devid)
                                 inode->rf_mem = (char *) devid;
                         } else {
                                 /* We allocate space for the file's contents immediately */
-                                if (NULL == (inode->rf_mem = page_alloc())) {
+                                if (NULL == (inode->rf_mem = page_alloc_zeroed())) {
                                         kfree(inode);
                                         return -ENOSPC;
                                 }
-                                memset(inode->rf_mem, 0, PAGE_SIZE);
                         }
                         inode->rf_size = 0;
                         inode->rf_ino = i;
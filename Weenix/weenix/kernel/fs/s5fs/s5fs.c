@@ -61,6 +61,10 @@ static int  s5fs_stat(vnode_t *vnode, struct stat *ss);
 static int  s5fs_fillpage(vnode_t *vnode, off_t offset, void *pagebuf);
 static int  s5fs_dirtypage(vnode_t *vnode, off_t offset);
 static int  s5fs_cleanpage(vnode_t *vnode, off_t offset, void *pagebuf);
+static int  s5fs_fsync(vnode_t *vnode, int datasync);
+
+/* statistics of every file system's s5f_mutex */
+static kmutex_class_t s5fs_mutex_class = KMUTEX_CLASS_INITIALIZER("s5f_mutex");
 
 fs_ops_t s5fs_fsops = {
         s5fs_read_vnode,
@@ -85,7 +89,8 @@ static vnode_ops_t s5fs_dir_vops = {
         .stat = s5fs_stat,
         .fillpage = s5fs_fillpage,
         .dirtypage = s5fs_dirtypage,
-        .cleanpage = s5fs_cleanpage
+        .cleanpage = s5fs_cleanpage,
+        .fsync = s5fs_fsync
 };
 
 /* vnode operations table for regular files: */
@@ -104,7 +109,8 @@ static vnode_ops_t s5fs_file_vops = {
         .stat = s5fs_stat,
         .fillpage = s5fs_fillpage,
         .dirtypage = s5fs_dirtypage,
-        .cleanpage = s5fs_cleanpage
+        .cleanpage = s5fs_cleanpage,
+        .fsync = s5fs_fsync
 };
 
 /*
@@ -159,7 +165,7 @@ s5fs_mount(struct fs *fs)
         pframe_pin(vp);
 
         /*     init s5f_mutex: */
-        kmutex_init(&s5->s5f_mutex);
+        kmutex_init_class(&s5->s5f_mutex, &s5fs_mutex_class);
 
         /*     init s5f_fs: */
         s5->s5f_fs = fs;
@@ -537,6 +543,44 @@ s5fs_cleanpage(vnode_t *vnode, off_t offset, void *pagebuf)
         return -1;
 }
 
+/* Writes back one block of the file system if it is cached and dirty. */
+static int
+s5fs_sync_block(s5fs_t *s5, uint32_t blockno)
+{
+        pframe_t *pf;
+        int ret;
+
+        if (NULL == (pf = pframe_get_resident(S5FS_TO_VMOBJ(s5), blockno)))
+                return 0;
+        pframe_pin(pf);
+        ret = pframe_sync(pf);
+        pframe_unpin(pf);
+        return ret;
+}
+
+/*
+ * Writes back the file's indirect block, if it has one, and then the
+ * block holding its inode, so that the inode never points at block
+ * numbers which are not on disk yet. An s5fs inode keeps no times,
+ * only the size and block numbers needed to read the data back, so
+ * datasync makes no difference here.
+ */
+static int
+s5fs_fsync(vnode_t *vnode, int datasync)
+{
+        s5fs_t *s5 = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        int ret = 0;
+
+        kmutex_lock(&vnode->vn_mutex);
+        if (inode->s5_indirect_block)
+                ret = s5fs_sync_block(s5, inode->s5_indirect_block);
+        if (0 == ret)
+                ret = s5fs_sync_block(s5, S5_INODE_BLOCK(vnode->vn_vno));
+        kmutex_unlock(&vnode->vn_mutex);
+        return ret;
+}
+
 /* Diagnostic/Utility: */
 
 /*
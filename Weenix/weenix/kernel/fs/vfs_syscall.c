@@ -17,6 +17,7 @@
 #include "fs/fcntl.h"
 #include "fs/lseek.h"
 #include "mm/kmalloc.h"
+#include "mm/pframe.h"
 #include "util/string.h"
 #include "util/printf.h"
 #include "fs/stat.h"
@@ -1012,6 +1013,37 @@ do_stat(const char *path, struct stat *buf)
         return 0;
 }
 
+/*
+ * Write back the dirty pages of the file open on fd, and then let the
+ * file system write back what else it keeps about the file with the
+ * optional fsync() vnode operation. Unlike sync(2), no other file's
+ * pages are written. If datasync is set, metadata which is not needed to
+ * read the data back may be left dirty.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor.
+ */
+int
+do_fsync(int fd, int datasync)
+{
+        file_t *file;
+        vnode_t *vn;
+        int ret;
+
+        /* fget(-1) would make a new file */
+        if (fd < 0 || NULL == (file = fget(fd)))
+                return -EBADF;
+
+        vn = file->f_vnode;
+        ret = pframe_clean_obj(&vn->vn_mmobj);
+        if (0 == ret && NULL != vn->vn_ops->fsync)
+                ret = vn->vn_ops->fsync(vn, datasync);
+
+        fput(file);
+        return ret;
+}
+
 #ifdef __MOUNTING__
 /*
  * Implementing this function is not required and strongly discouraged unless
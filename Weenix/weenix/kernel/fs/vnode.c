@@ -90,11 +90,29 @@ static vnode_ops_t blockdev_spec_vops = {
 /*
  * Initialization:
  */
+
+/* Free vnodes are kept with their mutex, mmobj and wait queue
+ * initialized; vput returns them in that state. */
+/* statistics of every vnode's vn_mutex */
+static kmutex_class_t vnode_mutex_class = KMUTEX_CLASS_INITIALIZER("vn_mutex");
+
+static void
+vnode_ctor(void *obj)
+{
+        vnode_t *vn = obj;
+
+        memset(vn, 0, sizeof(vnode_t));
+        kmutex_init_class(&vn->vn_mutex, &vnode_mutex_class);
+        mmobj_init(&vn->vn_mmobj, &vnode_mmobj_ops);
+        sched_queue_init(&vn->vn_waitq);
+}
+
 static __attribute__((unused)) void
 vnode_init(void)
 {
         list_init(&vnode_inuse_list);
-        vnode_allocator = slab_allocator_create("vnode", sizeof(vnode_t));
+        vnode_allocator = slab_allocator_create_ctor("vnode", sizeof(vnode_t),
+                                                     vnode_ctor, NULL);
 }
 init_func(vnode_init);
 
@@ -162,14 +180,21 @@ find:
                 sched_switch();
                 goto find;
         }
-        memset(vn, 0, sizeof(vnode_t));
-        /*   initialize its contents: */
+        KASSERT(0 == vn->vn_refcount && 0 == vn->vn_nrespages);
+        KASSERT(sched_queue_empty(&vn->vn_waitq));
+        /*   initialize its contents (the mutex, mmobj and wait queue
+         *   were set up by vnode_ctor): */
         /*     members that can be initialized here: */
+        vn->vn_ops = NULL;
         vn->vn_fs = fs;
         vn->vn_vno = vno;
-        kmutex_init(&vn->vn_mutex);
-        mmobj_init(&vn->vn_mmobj, &vnode_mmobj_ops);
-        sched_queue_init(&vn->vn_waitq);
+        vn->vn_mode = 0;
+        vn->vn_len = 0;
+        vn->vn_i = NULL;
+        vn->vn_devid = 0;
+        vn->vn_cdev = NULL;
+        vn->vn_bdev = NULL;
+        vn->vn_flags = 0;
 
 #ifdef __MOUNTING__
         vn->vn_mount = vn;
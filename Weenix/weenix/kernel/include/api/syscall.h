@@ -25,7 +25,7 @@
 #define SYS_unlink              9
 #define SYS_execve              10
 #define SYS_chdir               11
-#define SYS_sleep               12 /* NYI */
+#define SYS_sleep               12
 #define SYS_lseek               14
 #define SYS_sync                15
 #define SYS_nuke                16 /* NYI */
@@ -40,22 +40,25 @@
 #define SYS_munmap              26
 #define SYS_rename              27 /* NYI */
 #define SYS_uname               28
-#define SYS_thr_create          29 /* NYI */
+#define SYS_thr_create          29
 #define SYS_thr_cancel          30
 #define SYS_thr_exit            31
 #define SYS_thr_yield           32
-#define SYS_thr_join            33 /* NYI */
-#define SYS_gettid              34 /* NYI */
+#define SYS_thr_join            33
+#define SYS_gettid              34
 #define SYS_getpid              35
+#define SYS_thr_detach          36
 #define SYS_errno               39
 #define SYS_halt                40
-#define SYS_get_free_mem        41 /* NYI */
+#define SYS_get_free_mem        41
 #define SYS_set_errno           42
 #define SYS_dup2                43
 #define SYS_brk                 44
 #define SYS_mount               45
 #define SYS_umount              46
 #define SYS_stat                47
+#define SYS_fsync               48
+#define SYS_fdatasync           49
 
 /*
  * ... what does the scouter say about his syscall?
@@ -149,6 +152,21 @@ typedef struct lseek_args {
         int whence;
 } lseek_args_t;
 
+typedef struct nanosleep_args {
+        const struct timespec *req;
+        struct timespec       *rem;
+} nanosleep_args_t;
+
+typedef struct thr_create_args {
+        void   *tca_entry;      /* where the new thread starts running */
+        void   *tca_stack;      /* initial stack pointer of the new thread */
+} thr_create_args_t;
+
+typedef struct thr_join_args {
+        int     tja_tid;
+        void  **tja_retval;
+} thr_join_args_t;
+
 typedef struct dup2_args {
         int ofd;
         int nfd;
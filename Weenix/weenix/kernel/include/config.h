@@ -12,8 +12,24 @@
  * kernel configuration parameters
  */
 #define DEFAULT_STACK_SIZE      (56*1024) /* size of stacks */
+#define IDLE_STACK_SIZE         (16*1024) /* size of each processor's idle loop stack */
+#define KSTACK_CACHE_MAX        16        /* max free kernel stacks kept for reuse */
+#define KSTACK_GUARD            1         /* check a guard area at the bottom of kernel stacks */
 #define TICK_MSECS              10        /* msecs between clock interrupts */
 
+/*
+ * Scheduler-related:
+ */
+#define SCHED_NLEVELS           8         /* number of MLFQ run queue levels (<= 32) */
+#define SCHED_QUANTUM           2         /* clock ticks in a level 0 quantum, doubled per level */
+#define SCHED_BOOST_TICKS       100       /* clock ticks between moving every thread back to level 0 */
+
+/*
+ * Multiprocessor-related:
+ */
+#define SMP_MAX_CPUS            16        /* most processors used, any others stay halted */
+#define SMP_TRAMPOLINE          0x8000    /* page below 1mb where application processors start */
+
 /*
  * Memory-management-related:
  */
@@ -23,12 +39,34 @@
  *     the rest are given to the vm system
  */
 #define KMEM_FRAC(x)               (((x)>>2)+((x)>>3)) /* 37.5%-ish */
+#define PAGE_ZERO_MAX                 64 /* max free pages zeroed ahead of time */
 
 /*     pframe/mmobj-system-related: */
-#define PF_HASH_SIZE                  17 /* Number of buckets in pn/mmobj->pframe hash */
+#define PF_HASH_MIN_SIZE              32 /* Initial buckets in pn/mmobj->pframe hash (power of 2) */
+#define PF_HASH_MAX_SIZE           65536 /* The hash never grows past this many buckets */
+#define PF_HASH_LOAD                   2 /* Pages per bucket at which the hash doubles */
+#define PF_POLICY           PF_POLICY_2Q /* Page replacement: PF_POLICY_LRU, _CLOCK or _2Q */
+#define PF_2Q_IN_SHARE                 4 /* 2Q keeps at most 1/4 of the pages on probation */
+#define PF_2Q_GHOSTS                 512 /* Evicted probation pages 2Q remembers (power of 2) */
+#define PF_CLUSTER_MAX                 8 /* Dirty neighbors written back together, victim included */
 /*         Pageout-related: */
 #define PAGEOUTD_FREE_TARGET_SHIFT     5 /* 3.125% */
 #define PAGEOUTD_FREE_MIN_SHIFT        4 /* 6.25% */
+#define PAGEOUTD_FRAG_ORDER            4 /* block order pageoutd tries to keep free (a kernel stack) */
+#define PAGEOUTD_FRAG_MAX            900 /* fragmentation index, in tenths of a percent, */
+                                         /* above which pageoutd runs anyway */
+#define PAGEOUTD_FRAG_BATCH           64 /* pages pageoutd frees when it runs for fragmentation */
+/*         Flushd-related: */
+#define FLUSHD_PERIOD_MSECS          500 /* msecs between writebacks of old dirty pages */
+#define FLUSHD_DIRTY_AGE_MSECS      5000 /* pages dirty for this long are written back */
+#define FLUSHD_BUDGET                 64 /* most pages written back per period */
+/*         Fault-around and read-ahead: */
+#define PF_FAULT_AROUND               16 /* Resident pages mapped per fault, aligned block (power of 2) */
+#define PF_READAHEAD_MIN               4 /* Pages read ahead on the first sequential fault */
+#define PF_READAHEAD_MAX              32 /* The read-ahead window never grows past this */
+#define PF_READAHEAD_QUEUE            16 /* Requests readaheadd keeps queued, others are dropped */
+/*         Shadowd-related: */
+#define SHADOWD_PERIOD_MSECS        1000 /* msecs between shadow tree collapses */
 
 
 /*
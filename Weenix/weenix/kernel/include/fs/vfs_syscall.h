@@ -22,6 +22,7 @@ int do_chdir(const char *path);
 int do_getdent(int fd, struct dirent *dirp);
 int do_lseek(int fd, int offset, int whence);
 int do_stat(const char *path, struct stat *uf);
+int do_fsync(int fd, int datasync);
 
 #ifdef __MOUNTING__
 /* for mounting implementations only, not required */
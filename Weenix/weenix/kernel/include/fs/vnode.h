@@ -142,6 +142,15 @@ typedef struct vnode_ops {
          * containing 'offset'.
          */
         int (*cleanpage)(struct vnode *vnode, off_t offset, void *pagebuf);
+
+        /*
+         * Optional. Called by fsync(2) after the vnode's own pages have been
+         * cleaned, to write back whatever else the file system keeps about
+         * the file, such as its inode. If datasync is set, only what is needed
+         * to read the file's data back has to be written.
+         * Returns 0 on success and -errno on failure.
+         */
+        int (*fsync)(struct vnode *vnode, int datasync);
 } vnode_ops_t;
 
 
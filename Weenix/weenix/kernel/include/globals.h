@@ -3,5 +3,8 @@
 #include "proc/kthread.h"
 #include "proc/proc.h"
 
-extern kthread_t *curthr;
-extern proc_t *curproc;
+#include "main/smp.h"
+
+/* the thread and process running on this processor */
+#define curthr (curcpu()->cpu_thr)
+#define curproc (curcpu()->cpu_proc)
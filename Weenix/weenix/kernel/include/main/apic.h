@@ -7,6 +7,30 @@
  * function. */
 void apic_init();
 
+/* Enables the local APIC of the application processor which
+ * calls this, and sets its spurious interrupt to 'spur'. The
+ * boot processor must already have called apic_init. */
+void apic_init_ap(uint8_t spur);
+
+/* Returns the number of enabled processors listed in the
+ * ACPI MADT, including the boot processor, but at most
+ * SMP_MAX_CPUS. */
+int apic_cpucount();
+
+/* Returns the local APIC id of the given processor, where
+ * processor 0 is the boot processor. */
+uint8_t apic_cpuid(int cpu);
+
+/* Wakes up the halted processor with the given local APIC id
+ * with an INIT and STARTUP inter-processor interrupts. The
+ * processor starts executing in real mode at the start of the
+ * page at physical address 'paddr', which must be below 1mb. */
+void apic_startap(uint8_t apicid, uintptr_t paddr);
+
+/* Raises interrupt 'intr' on the processor with the given
+ * local APIC id. */
+void apic_sendipi(uint8_t apicid, uint8_t intr);
+
 /* Maps the given IRQ to the given interrupt number. */
 void apic_setredir(uint32_t irq, uint8_t intr);
 
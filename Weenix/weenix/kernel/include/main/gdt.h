@@ -2,17 +2,26 @@
 
 #include "types.h"
 
-#define GDT_COUNT 16
+#define GDT_COUNT 32
 
 #define GDT_ZERO        0x00
 #define GDT_KERNEL_TEXT 0x08
 #define GDT_KERNEL_DATA 0x10
 #define GDT_USER_TEXT   0x18
 #define GDT_USER_DATA   0x20
-#define GDT_TSS         0x28
+#define GDT_TSS         0x28 /* processor n's TSS is at GDT_TSS + 8 * n */
 
+/* Sets up the GDT, with a TSS for every processor, and loads
+ * it and the boot processor's TSS. */
 void gdt_init(void);
 
+/* Loads the GDT and the TSS of application processor 'cpu'
+ * on the processor calling this. */
+void gdt_init_ap(int cpu);
+
+/* Sets the stack the processor calling this switches to when
+ * it enters the kernel from user mode. */
+
 void gdt_set_kernel_stack(void *addr);
 
 void gdt_set_entry(uint32_t segment, uint32_t base, uint32_t limit,
@@ -10,6 +10,8 @@
 #define INTR_GPF 0x0d
 #define INTR_PAGE_FAULT 0x0e
 
+#define INTR_SMP_TLB 0xf3
+#define INTR_SMP_RESCHED 0xf2
 #define INTR_PIT 0xf1
 #define INTR_APICTIMER 0xf0
 #define INTR_KEYBOARD 0xe0
@@ -31,6 +33,11 @@ typedef struct regs {
 
 void intr_init();
 
+/* Loads the interrupt table set up by intr_init on the
+ * application processor calling this, and enables its local
+ * APIC. */
+void intr_init_ap();
+
 /* The function pointer which should be implemented by functions
  * which will handle interrupts. These handlers should be registered
  * with the interrupt subsystem via the intr_register function.
@@ -46,6 +53,13 @@ typedef void (*intr_handler_t)(regs_t *regs);
 intr_handler_t intr_register(uint8_t intr, intr_handler_t handler);
 int32_t intr_map(uint16_t irq, uint8_t intr);
 
+/* Marks the given interrupt as one raised by the local APIC of
+ * the processor it arrives on, such as its timer or an
+ * inter-processor interrupt. Like an interrupt mapped from an
+ * IRQ it is acknowledged once it has been handled, and it may
+ * preempt the user thread it interrupts. */
+void intr_map_local(uint8_t intr);
+
 static inline void intr_enable()
 {
         __asm__ volatile("sti");
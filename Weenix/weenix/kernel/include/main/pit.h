@@ -2,7 +2,9 @@
 
 #include "types.h"
 
+#define PIT_HZ 1000
+
 /* Starts the Programmable Interval Timer (PIT)
- * delivering periodic interrupts at 1000 Hz
+ * delivering periodic interrupts at PIT_HZ Hz
  * (i.e., one every millisecond) to the given interrupt. */
 void pit_starttimer(uint8_t intr);
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "kernel.h"
+#include "types.h"
+#include "config.h"
+
+#include "main/gdt.h"
+
+#include "mm/pagetable.h"
+
+struct kthread;
+struct proc;
+
+/*
+ * Per-processor state. Processor 0 is the boot processor, the others
+ * are the application processors started by smp_start().
+ *
+ * All kernel code runs under a single kernel lock. A processor holds
+ * it whenever it runs kernel code on a thread's stack, and gives it up
+ * when it returns to user mode or halts in its idle loop, so threads
+ * only run kernel code on one processor at a time and IPL masking
+ * keeps working as the protection against interrupt handlers. Context
+ * switches happen with the lock held, so the lock passes from thread
+ * to thread with the processor. Only user code runs on several
+ * processors at once; kernel work, including system calls and page
+ * faults, is serialized by the lock.
+ */
+typedef struct cpu {
+        int               cpu_id;         /* index in smp_cpus */
+        uint8_t           cpu_apicid;     /* local APIC id */
+        volatile int      cpu_started;    /* set once the processor is running */
+
+        struct kthread   *cpu_thr;        /* running thread, NULL in the idle loop */
+        struct proc      *cpu_proc;       /* process of cpu_thr */
+        pagedir_t        *cpu_pagedir;    /* the page directory in cr3 */
+
+        int               cpu_locked;     /* 1 while holding the kernel lock */
+        volatile int      cpu_idle;       /* 1 while halted waiting for work */
+        volatile int      cpu_tlbflush;   /* 1 until a requested TLB flush is done */
+} cpu_t;
+
+extern cpu_t smp_cpus[SMP_MAX_CPUS];
+extern int smp_ncpus;
+
+/**
+ * Returns the processor executing this code. Each processor has its
+ * own TSS, GDT_TSS + 8 * n being processor n's, so the task register
+ * tells them apart. Before gdt_init() loads the first TSS only the
+ * boot processor is running.
+ *
+ * Note: A thread can move to another processor whenever it blocks, so
+ * the result is only good until the next context switch.
+ */
+static inline cpu_t *curcpu(void)
+{
+        uint32_t tr;
+        __asm__ volatile("str %0" : "=r"(tr));
+        return &smp_cpus[GDT_TSS >= tr ? 0 : (tr - GDT_TSS) / 8];
+}
+
+/**
+ * Records the processors listed by the APIC and takes the kernel lock
+ * for the boot processor. Called from kmain once the APIC is set up.
+ */
+void smp_init(void);
+
+/**
+ * Starts the application processors, which then run their idle loops
+ * looking for threads to run. Called from the idle process once
+ * interrupts are enabled. Does nothing unless Weenix is built with
+ * SMP=1.
+ */
+void smp_start(void);
+
+/**
+ * Takes the kernel lock for this processor, waiting for the processor
+ * holding it to let go. This processor must not already hold it.
+ */
+void smp_kernel_lock(void);
+
+/**
+ * Releases the kernel lock held by this processor.
+ */
+void smp_kernel_unlock(void);
+
+/**
+ * Returns 1 if this processor holds the kernel lock.
+ */
+int smp_kernel_locked(void);
+
+/**
+ * Interrupts the given processor so that it stops halting, or stops
+ * running user code, and looks at its run queue. Does nothing if the
+ * processor is this one.
+ *
+ * @param cpu the index of the processor in smp_cpus
+ */
+void smp_resched(int cpu);
+
+/**
+ * Flushes the TLB of every other processor running with the given page
+ * directory, and waits until they are done. Must be called after
+ * removing or changing a present mapping in a page directory which
+ * other threads of the same process may be using.
+ *
+ * @param pd the page directory whose mappings changed
+ */
+void smp_tlb_shootdown(pagedir_t *pd);
@@ -4,3 +4,9 @@
 
 void *kmalloc(size_t size);
 void  kfree(void *addr);
+
+/* Prints, for each kmalloc size class, how many objects were
+ * allocated and how much of their space went unused. For
+ * comparison it also shows how much would have gone unused
+ * with power of two classes and a header in every object. */
+size_t kmalloc_info(const void *arg, char *buf, size_t size);
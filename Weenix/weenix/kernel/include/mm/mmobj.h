@@ -15,6 +15,10 @@ typedef struct mmobj {
          */
         int                 mmo_nrespages;
         list_t              mmo_respages;
+        int                 mmo_ndirty;
+        list_t              mmo_dirtypages; /* resident pages which are dirty */
+        list_link_t         mmo_dlink;      /* on the pframe module's list of
+                                             * objects with dirty pages */
         /*
          * For shadow objects, the mmo_bottom_obj member of the union should point
          * to the bottommost object in the shadow chain. For non-shadow objects, the
@@ -86,6 +90,17 @@ struct mmobj_ops {
          * Return 0 on success and -errno otherwise.
          */
         int (*cleanpage)(mmobj_t *o, struct pframe *pf);
+
+        /*
+         * Optional. Write back the npages page frames in pfs, which have
+         * consecutive page numbers in ascending order, with as few
+         * operations as possible. The pages are already busy and marked
+         * clean. Objects without this entry point are cleaned one page at
+         * a time with cleanpage.
+         * This may block.
+         * Return 0 on success and -errno otherwise.
+         */
+        int (*cleanpages)(mmobj_t *o, struct pframe **pfs, int npages);
 };
 
 
@@ -99,6 +114,9 @@ static inline void mmobj_init(mmobj_t *o, mmobj_ops_t *ops)
         (o)->mmo_refcount = 0;
         (o)->mmo_nrespages = 0;
         list_init(&(o)->mmo_respages);
+        (o)->mmo_ndirty = 0;
+        list_init(&(o)->mmo_dirtypages);
+        list_link_init(&(o)->mmo_dlink);
         list_init(&(o)->mmo_un.mmo_vmas);
         (o)->mmo_shadowed = NULL;
 }
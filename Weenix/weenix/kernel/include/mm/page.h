@@ -39,6 +39,23 @@ void page_add_range(uintptr_t start, uintptr_t end);
 void *page_alloc(void);
 void  page_free(void *addr);
 
+/* Allocates one page filled with zeros, to be freed with
+ * page_free. Pages zeroed ahead of time by the idle loop
+ * are used when there are any, otherwise the page is
+ * cleared by this call. */
+void *page_alloc_zeroed(void);
+
+/* Zeroing a free page ahead of time for page_alloc_zeroed
+ * is done in two steps, so that the idle loop can do the
+ * zeroing without holding the kernel lock. page_zero_take
+ * takes a free page to zero, unless PAGE_ZERO_MAX pages
+ * are already waiting or free memory is short, in which
+ * case it returns NULL. page_zero_give puts the page back
+ * once it is zeroed. Both are called with the IPL high and
+ * never block. */
+void *page_zero_take(void);
+void  page_zero_give(void *addr);
+
 /* These functions allocate and free a page-aligned
  * block of memory which are npages pages in length.
  * A call to page_alloc_n will allocate a block, to free
@@ -48,7 +65,21 @@ void  page_free(void *addr);
 void *page_alloc_n(uint32_t npages);
 void  page_free_n(void *start, uint32_t npages);
 
+/* Remembers an owner for each page of a block allocated
+ * with page_alloc_n, so that the owner of any address in
+ * the block can be found with page_owner. The slab
+ * allocator uses this to find the cache an object came
+ * from. The owner should be reset to NULL before the
+ * block is freed. */
+void  page_set_owner(void *addr, uint32_t npages, void *owner);
+void *page_owner(const void *addr);
+
 /* Returns the number of free pages remaining in the
  * system. Note that calls to page_alloc_n(npages) may
  * fail even if page_free_count() >= npages. */
 uint32_t page_free_count();
+
+uint32_t page_free_blocks(int order);
+uint32_t page_fragmentation(int order);
+
+size_t page_info(const void *arg, char *buf, size_t size);
@@ -46,16 +46,25 @@ uintptr_t pt_virt_to_phys(uintptr_t vaddr);
  * given page directory. Creates a new page table if necessary and
  * places an entry in it in the page directory. vaddr must be in the
  * user address space. Both vaddr and paddr must be page aligned.
- * Note that the TLB is not flushed by this function. */
+ * Note that the TLB is not flushed by this function, except on other
+ * processors using the page directory when a present mapping changes. */
 int pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32_t ptflags);
 
 /* Unmaps the page for the given virtual page from the given page
  * directory. vaddr must be in the user address space. vaddr must
- * be page aligned. Note that the TLB is not flushed by this function. */
+ * be page aligned. Note that the TLB is not flushed by this function,
+ * except on other processors using the page directory. */
 void pt_unmap(pagedir_t *pd, uintptr_t vaddr);
 
+/* Returns 1 if the given virtual page is mapped in the given page
+ * directory, 0 otherwise. vaddr must be page aligned in the user
+ * address space. */
+int pt_is_mapped(pagedir_t *pd, uintptr_t vaddr);
+
 /* Unmaps the given range of addresses [low, high). As with pt_unmap,
- * the addresses must be page aligned in the user address space */
+ * the addresses must be page aligned in the user address space, and
+ * only other processors using the page directory have their TLB
+ * flushed */
 void pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh);
 
 /* Creates a new page directory which is initialized to contain
@@ -68,6 +77,18 @@ void pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh);
 pagedir_t *pt_create_pagedir();
 void pt_destroy_pagedir(pagedir_t *pdir);
 
+/* Returns the template page directory which pt_create_pagedir copies.
+ * It maps only kernel memory and is never destroyed, so processors can
+ * use it while they are not running any thread. */
+pagedir_t *pt_template(void);
+
+/* Identity maps (map = 1) or unmaps (map = 0) the physical page at
+ * paddr, which must be in the first 4mb of memory, in every page
+ * directory. Only used while starting application processors, which
+ * turn on paging while running from low memory. Only the TLB of the
+ * calling processor is flushed. */
+void pt_lowmem_map(uintptr_t paddr, int map);
+
 /* Sets the page table in cr3 and performs other updates required by
  * the page table subsystem. The address should be a virtual address,
  * it will be translated by the current page table before being
@@ -11,6 +11,14 @@ struct mmobj;
 
 #define PF_BUSY                 0x01
 #define PF_DIRTY                0x02
+#define PF_REFERENCED           0x04
+#define PF_HOT                  0x08
+
+/* Page replacement policies, see PF_POLICY in config.h */
+#define PF_POLICY_LRU           0
+#define PF_POLICY_CLOCK         1
+#define PF_POLICY_2Q            2
+#define PF_NPOLICIES            3
 
 #define pframe_is_busy(pf)          ((pf)->pf_flags & PF_BUSY)
 #define pframe_set_busy(pf)         do { (pf)->pf_flags |= PF_BUSY; } while (0)
@@ -20,6 +28,14 @@ struct mmobj;
 #define pframe_set_dirty(pf)        do { (pf)->pf_flags |= PF_DIRTY; } while (0)
 #define pframe_clear_dirty(pf)      do { (pf)->pf_flags &= ~PF_DIRTY; } while (0)
 
+#define pframe_is_referenced(pf)    ((pf)->pf_flags & PF_REFERENCED)
+#define pframe_set_referenced(pf)   do { (pf)->pf_flags |= PF_REFERENCED; } while (0)
+#define pframe_clear_referenced(pf) do { (pf)->pf_flags &= ~PF_REFERENCED; } while (0)
+
+#define pframe_is_hot(pf)           ((pf)->pf_flags & PF_HOT)
+#define pframe_set_hot(pf)          do { (pf)->pf_flags |= PF_HOT; } while (0)
+#define pframe_clear_hot(pf)        do { (pf)->pf_flags &= ~PF_HOT; } while (0)
+
 #define pframe_is_pinned(pf)        ((pf)->pf_pincount)
 #define pframe_is_free(pf)          (!(pf)->pf_obj)
 
@@ -38,12 +54,15 @@ typedef struct pframe {
         void               *pf_addr;
 
         /* Private: */
-        uint8_t             pf_flags;    /* PF_DIRTY, PF_BUSY */
+        uint8_t             pf_flags;    /* PF_DIRTY, PF_BUSY, PF_REFERENCED, PF_HOT */
         ktqueue_t           pf_waitq;    /* wait on this if page is busy */
         int                 pf_pincount;
         list_link_t         pf_link;     /* link on {free,allocated,pinned}_list */
         list_link_t         pf_hlink;    /* link on hash chain of resident page hash */
         list_link_t         pf_olink;    /* link on object's list of resident pages */
+        list_link_t         pf_dlink;    /* link on dirty_list while dirty */
+        list_link_t         pf_odlink;   /* link on object's list of dirty pages */
+        uint32_t            pf_dirtied;  /* tick at which the page became dirty */
 } pframe_t;
 
 void pframe_init(void);
@@ -53,6 +72,7 @@ void pframe_pageoutd_init(void);
 void pframe_shutdown(void);
 
 pframe_t *pframe_get_resident(struct mmobj *o, uint32_t pagenum);
+pframe_t *pframe_peek_resident(struct mmobj *o, uint32_t pagenum);
 
 int pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result);
 int pframe_lookup(struct mmobj *o, uint32_t pagenum, int forwrite, pframe_t **result);
@@ -63,8 +83,18 @@ void pframe_unpin(pframe_t *pf);
 
 int  pframe_dirty(pframe_t *pf);
 int  pframe_clean(pframe_t *pf);
+int  pframe_clean_cluster(pframe_t *pf);
+int  pframe_sync(pframe_t *pf);
 void pframe_free(pframe_t *pf);
 
+int  pframe_clean_obj(struct mmobj *o);
+void pframe_readahead(struct mmobj *o, uint32_t pagenum, uint32_t npages);
+void pframe_readahead_shutdown(void);
 void pframe_clean_all(void);
 
+size_t pframe_info(const void *arg, char *buf, size_t size);
+size_t pframe_hash_info(const void *arg, char *buf, size_t size);
+int pframe_replay(int policy, const uint32_t *trace, int ntrace, int nframes);
+const char *pframe_fsync_test(void);
+
 void pframe_remove_from_pts(pframe_t *pf);
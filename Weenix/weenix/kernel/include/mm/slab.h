@@ -9,18 +9,30 @@
  * are no double frees. */
 #define SLAB_CHECK_FREE
 
+/* Number of recently freed objects each allocator keeps in its magazine. */
+#define SLAB_MAGAZINE_SIZE      16
+
 /*
  * The slab allocator. A "cache" is a store of objects; you create one by
  * specifying a constructor, destructor, and the size of an object. The
  * "alloc" function allocates one object, and the "free" function returns
  * it to the free list *without calling the destructor*. This lets you save
  * on destruction/construction calls; the idea is that every free object in
- * the cache is in a known state.
+ * the cache is in a known state. The constructor is run when the memory for
+ * an object is first obtained and the destructor just before it is given back
+ * to the page allocator, so an object must be returned to the cache in its
+ * constructed state.
  */
 typedef struct slab_allocator slab_allocator_t;
 
+typedef void (*slab_ctor_t)(void *obj);
+typedef void (*slab_dtor_t)(void *obj);
+
 slab_allocator_t *slab_allocator_create(const char *name, size_t size);
+slab_allocator_t *slab_allocator_create_ctor(const char *name, size_t size,
+                                             slab_ctor_t ctor, slab_dtor_t dtor);
 int slab_allocators_reclaim(int target);
+size_t slab_allocators_info(const void *arg, char *buf, size_t size);
 
 void *slab_obj_alloc(slab_allocator_t *allocator);
 void slab_obj_free(slab_allocator_t *allocator, void *obj);
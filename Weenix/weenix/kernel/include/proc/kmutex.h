@@ -1,19 +1,52 @@
 #pragma once
 
+#include "types.h"
+
+#include "util/list.h"
+
 #include "proc/sched.h"
+#include "proc/krwlock.h"
+
+/*
+ * Mutexes come and go with the objects they protect, such as vnodes,
+ * so their contention statistics are kept per class of mutex rather
+ * than per mutex. A class is declared statically with
+ * KMUTEX_CLASS_INITIALIZER and is added to the list of classes the
+ * first time a mutex of the class is initialized.
+ */
+typedef struct kmutex_class {
+        const char     *kmc_name;       /* name, for statistics */
+        krwlock_stats_t kmc_stats;      /* contention statistics of all its mutexes */
+        list_link_t     kmc_link;       /* link on the list of all classes */
+} kmutex_class_t;
+
+#define KMUTEX_CLASS_INITIALIZER(name) { (name), { 0, 0, 0, 0 }, { NULL, NULL } }
 
 typedef struct kmutex {
         ktqueue_t       km_waitq;       /* wait queue */
         struct kthread *km_holder;      /* current holder */
+        uint64_t        km_holdstart;   /* when the current holder took it */
+        kmutex_class_t *km_class;       /* where its statistics are counted */
 } kmutex_t;
 
 /**
- * Initializes the fields of the specified kmutex_t.
+ * Initializes the fields of the specified kmutex_t. Its statistics
+ * are counted in the class of mutexes which have no class of their
+ * own.
  *
  * @param mtx the mutex to initialize
  */
 void kmutex_init(kmutex_t *mtx);
 
+/**
+ * Initializes the fields of the specified kmutex_t, counting its
+ * statistics in the given class.
+ *
+ * @param mtx the mutex to initialize
+ * @param cls the class of the mutex
+ */
+void kmutex_init_class(kmutex_t *mtx, kmutex_class_t *cls);
+
 /**
  * Locks the specified mutex.
  *
@@ -45,3 +78,10 @@ int  kmutex_lock_cancellable(kmutex_t *mtx);
  * @mtx the mutex to unlock
  */
 void kmutex_unlock(kmutex_t *mtx);
+
+/**
+ * Returns the list of all classes of mutexes which have been used.
+ *
+ * @return the list of classes, linked by kmc_link
+ */
+list_t *kmutex_class_list(void);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "types.h"
+
+#include "util/list.h"
+
+#include "proc/sched.h"
+
+typedef struct krwlock_stats {
+        uint32_t        krs_acquired;   /* number of times the lock was taken */
+        uint32_t        krs_contended;  /* number of those which had to sleep */
+        uint64_t        krs_wait;       /* total cycles spent sleeping on the lock */
+        uint64_t        krs_maxhold;    /* longest time the lock was held, in cycles */
+} krwlock_stats_t;
+
+typedef struct krwlock {
+        ktqueue_t       krw_rwaitq;     /* readers waiting for the lock */
+        ktqueue_t       krw_wwaitq;     /* writers waiting for the lock */
+        int             krw_readers;    /* number of readers holding the lock */
+        struct kthread *krw_writer;     /* writer holding the lock */
+        uint64_t        krw_holdstart;  /* when the lock was last taken while free */
+
+        const char     *krw_name;       /* name, for statistics */
+        krwlock_stats_t krw_stats;      /* contention statistics */
+        list_link_t     krw_link;       /* link on the list of all locks */
+} krwlock_t;
+
+/**
+ * Initializes the fields of the specified krwlock_t and adds it to the
+ * list of all locks.
+ *
+ * @param lock the lock to initialize
+ * @param name a name for the lock, which must outlive the lock
+ */
+void krwlock_init(krwlock_t *lock, const char *name);
+
+/**
+ * Removes the lock from the list of all locks. This must be called
+ * before the memory holding the lock is freed. The lock must not be
+ * held.
+ *
+ * @param lock the lock to destroy
+ */
+void krwlock_destroy(krwlock_t *lock);
+
+/**
+ * Locks the specified lock in shared mode. Any number of threads may
+ * hold the lock in shared mode at once. A thread asking for the lock
+ * in shared mode will wait behind a thread waiting for exclusive mode.
+ *
+ * Note: This function may block.
+ *
+ * Note: These locks are not re-entrant.
+ *
+ * @param lock the lock to take
+ */
+void krwlock_rdlock(krwlock_t *lock);
+
+/**
+ * Locks the specified lock in exclusive mode.
+ *
+ * Note: This function may block.
+ *
+ * Note: These locks are not re-entrant.
+ *
+ * @param lock the lock to take
+ */
+void krwlock_wrlock(krwlock_t *lock);
+
+/**
+ * Unlocks the specified lock, which the current thread holds in
+ * either mode.
+ *
+ * @param lock the lock to unlock
+ */
+void krwlock_unlock(krwlock_t *lock);
+
+/**
+ * Returns the list of all initialized locks.
+ *
+ * @return the list of locks, linked by krw_link
+ */
+list_t *krwlock_list(void);
@@ -19,10 +19,16 @@ typedef struct kthread {
         void           *kt_retval;      /* this thread's return value */
         int             kt_errno;       /* error no. of most recent syscall */
         struct proc    *kt_proc;        /* the thread's process */
+        int             kt_tid;         /* thread id, unique among live threads */
 
         int             kt_cancelled;   /* 1 if this thread has been cancelled */
         ktqueue_t      *kt_wchan;       /* The queue that this thread is blocked on */
         int             kt_state;       /* this thread's state */
+        int             kt_prio;        /* run queue level, 0 is the highest */
+        int             kt_ticks;       /* clock ticks used of the current quantum */
+        int             kt_need_resched; /* 1 if the thread should yield on return to user mode */
+        int             kt_wexcl;       /* 1 if sleeping as an exclusive waiter */
+        int             kt_cpu;         /* processor whose run queue the thread goes on */
         list_link_t     kt_qlink;       /* link on ktqueue */
         list_link_t     kt_plink;       /* link on proc thread list */
 #ifdef __MTP__
@@ -48,10 +54,21 @@ void kthread_init(void);
  * thread starts executing
  * @param arg1 the first argument to func
  * @param arg2 the second argument to func
- * @return the newly created thread
+ * @return the newly created thread, or NULL if there is not enough
+ * memory available
  */
 kthread_t *kthread_create(struct proc *p, kthread_func_t func, long arg1, void *arg2);
 
+/**
+ * Frees kernel stacks held in the stack cache back to the page
+ * allocator.
+ *
+ * @param target the number of pages to try to free, if 0 or
+ * negative free every cached stack
+ * @return the number of pages freed
+ */
+int kthread_stacks_reclaim(int target);
+
 /**
  * Free resources associated with a thread.
  *
@@ -105,4 +122,13 @@ int kthread_detach(kthread_t *kthr);
  * @return 0 on sucess and <0 on error
  */
 int kthread_join(kthread_t *kthr, void **retval);
+
+/**
+ * Finds a thread of a process by its thread id.
+ *
+ * @param p the process to search
+ * @param tid the thread id to look for
+ * @return the thread, or NULL if p has no thread with that id
+ */
+kthread_t *kthread_lookup(struct proc *p, int tid);
 #endif
@@ -30,6 +30,7 @@ typedef struct proc {
         pagedir_t      *p_pagedir;
 
         list_link_t     p_list_link;     /* link on the list of all processes */
+        list_link_t     p_hash_link;     /* link on the PID hash chain */
         list_link_t     p_child_link;    /* link on proc list of children */
 
         /* VFS-related: */
@@ -59,7 +60,8 @@ void proc_init(void);
  * This function allocates and initializes a new process.
  *
  * @param name the name to give the newly created process
- * @return the newly created process
+ * @return the newly created process, or NULL if there is no memory
+ * or no free PID for it
  */
 proc_t *proc_create(char *name);
 
@@ -127,6 +129,20 @@ pid_t do_waitpid(pid_t pid, int options, int *status);
  */
 int do_fork(struct regs *regs);
 
+#ifdef __MTP__
+/**
+ * Creates a new thread in the current process. The new thread returns
+ * to userland with the same registers as the calling thread, except
+ * for its instruction and stack pointers.
+ *
+ * @param regs the register state at the time of the system call
+ * @param entry the address at which the new thread starts running
+ * @param stack the initial user stack pointer of the new thread
+ * @return the thread id of the new thread, or -errno on failure
+ */
+int do_thr_create(struct regs *regs, uint32_t entry, uint32_t stack);
+#endif
+
 /**
  * Provides detailed debug information about a given process.
  *
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "types.h"
+
 #include "util/list.h"
 
 struct kthread;
@@ -14,7 +16,58 @@ typedef struct ktqueue {
 void sched_switch(void);
 
 /**
- * Marks the given thread as runnable, and adds it to the run queue.
+ * Charges a clock tick to the thread running on each processor. Once a
+ * thread has used up its quantum and there is another thread waiting
+ * in its processor's run queue, it is preempted with sched_preempt().
+ * Every SCHED_BOOST_TICKS ticks all threads go back to the highest
+ * priority level. Called from the clock interrupt handler.
+ */
+void sched_tick(void);
+
+/**
+ * Runs the idle loop of the application processor calling it, which
+ * looks for threads to run. The processor keeps running the loop on
+ * the stack it is already using, when it has nothing else to run.
+ * Must be called with the kernel lock held. Never returns.
+ *
+ * @param kstack the bottom of the stack the processor is running on
+ * @param kstacksz the size of the stack
+ */
+void sched_idle(void *kstack, size_t kstacksz);
+
+/**
+ * If the current thread has been marked as needing to be rescheduled,
+ * puts it back on the run queue and switches to another thread. This
+ * is called just before returning to user mode.
+ */
+void sched_preempt_check(void);
+
+/**
+ * Marks the given thread as needing to be rescheduled, so that it
+ * gives up its processor the next time it is about to return to user
+ * mode. If it is running user code on another processor right now,
+ * that processor is interrupted so that this happens straight away.
+ *
+ * @param thr the thread to preempt
+ */
+void sched_preempt(struct kthread *thr);
+
+/**
+ * Prints each processor's run queue length and scheduling statistics,
+ * and what it is running.
+ *
+ * @param arg must be NULL
+ * @param buf buffer to write to
+ * @param osize size of the buffer
+ * @return the remaining size of the buffer
+ */
+size_t sched_cpu_info(const void *arg, char *buf, size_t osize);
+
+/**
+ * Marks the given thread as runnable, and adds it to the run queue of
+ * the processor it last ran on. If the thread is the current thread
+ * and it has used up its quantum, it is demoted one priority level
+ * first.
  *
  * @param thr the thread to make runnable
  */
@@ -52,9 +105,41 @@ void sched_sleep_on(ktqueue_t *q);
  */
 int sched_cancellable_sleep_on(ktqueue_t *q);
 
+/**
+ * Causes the current thread to enter a non-cancellable sleep on the
+ * given queue as an exclusive waiter. Exclusive waiters are used when
+ * only one waiter can make progress per wakeup, such as threads
+ * waiting for memory.
+ *
+ * @param q the queue to sleep on
+ */
+void sched_sleep_on_exclusive(ktqueue_t *q);
+
+/**
+ * Causes the current thread to enter a cancellable sleep on the given
+ * queue which lasts at most the given number of clock ticks.
+ *
+ * @param q the queue to sleep on
+ * @param ticks the maximum number of clock ticks to sleep for
+ * @return 0 if the thread was woken up, -ETIMEDOUT if the time ran
+ * out, and -EINTR if the thread was cancelled
+ */
+int sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks);
+
+/**
+ * Wakes every non-exclusive waiter on the queue, and the nexcl
+ * longest-waiting exclusive waiters. The remaining exclusive waiters
+ * keep sleeping.
+ *
+ * @param q the queue to wake up threads from
+ * @param nexcl the maximum number of exclusive waiters to wake
+ * @return the number of threads woken
+ */
+int sched_wakeup_excl_on(ktqueue_t *q, int nexcl);
+
 /**
  * Wakes a single thread from sleep if there are any waiting on the
- * queue.
+ * queue. The woken thread is placed at the highest priority level.
  *
  * @param q the q to wakeup a thread from
  * @return NULL if q is empty and a thread waiting on the q otherwise
@@ -62,7 +147,8 @@ int sched_cancellable_sleep_on(ktqueue_t *q);
 struct kthread *sched_wakeup_on(ktqueue_t *q);
 
 /**
- * Wake up all threads running on the queue.
+ * Wake up all threads running on the queue. The woken threads are
+ * placed at the highest priority level.
  *
  * @param q the queue to wake up threads from
  */
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "kernel.h"
+
+/*
+ * A spinlock protects data shared between processors. A processor
+ * waiting for a spinlock busy waits instead of sleeping, so spinlocks
+ * must only be held for short stretches of code which do not block.
+ * Holding a spinlock does not mask interrupts on the holder.
+ */
+typedef struct spinlock {
+        volatile int    s_locked;       /* 1 while some processor holds the lock */
+} spinlock_t;
+
+#define SPINLOCK_INITIALIZER { 0 }
+
+/**
+ * Initializes the specified spinlock, unlocked.
+ *
+ * @param lock the spinlock to initialize
+ */
+static inline void spinlock_init(spinlock_t *lock)
+{
+        lock->s_locked = 0;
+}
+
+/**
+ * Takes the specified spinlock if it is free, without waiting.
+ *
+ * @param lock the spinlock to take
+ * @return 1 if the lock was taken and 0 if another processor holds it
+ */
+static inline int spinlock_trylock(spinlock_t *lock)
+{
+        int old = 1;
+        __asm__ volatile("xchgl %0, %1"
+                         : "+r"(old), "+m"(lock->s_locked)
+                         :: "memory");
+        return 0 == old;
+}
+
+/**
+ * Takes the specified spinlock, waiting for another processor to
+ * release it first if necessary.
+ *
+ * Note: These locks are not re-entrant.
+ *
+ * @param lock the spinlock to take
+ */
+static inline void spinlock_lock(spinlock_t *lock)
+{
+        while (!spinlock_trylock(lock)) {
+                /* only read the lock while it is held, so that the
+                 * waiters do not keep stealing its cache line */
+                while (lock->s_locked)
+                        __asm__ volatile("pause");
+        }
+}
+
+/**
+ * Releases the specified spinlock.
+ *
+ * @param lock the spinlock to release
+ */
+static inline void spinlock_unlock(spinlock_t *lock)
+{
+        __asm__ volatile("" ::: "memory");
+        lock->s_locked = 0;
+}
@@ -39,6 +39,7 @@ ksyscall(lseek, (int fd, int offset, int whence), (fd, offset, whence))
 ksyscall(getdent, (int fd, struct dirent *dirp), (fd, dirp))
 ksyscall(stat, (const char *path, struct stat *uf), (path, uf))
 ksyscall(open, (const char *filename, int flags), (filename, flags))
+ksyscall(fsync, (int fd, int datasync), (fd, datasync))
 #define ksys_exit do_exit
 
 /* Kill me now */
@@ -89,6 +90,8 @@ int ksys_getdents(int fd, struct dirent *dirp, unsigned int count)
 #define lseek           ksys_lseek
 #define dup             ksys_dup
 #define dup2            ksys_dup2
+#define fsync(a)        ksys_fsync(a, 0)
+#define fdatasync(a)    ksys_fsync(a, 1)
 #define chdir           ksys_chdir
 #define stat(a,b)       ksys_stat(a,b)
 #define getdents(a,b,c) ksys_getdents(a,b,c)
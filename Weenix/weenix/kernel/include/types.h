@@ -31,3 +31,9 @@ typedef uint16_t           mode_t;
 typedef uint32_t           blocknum_t;
 typedef uint32_t           ino_t;
 typedef uint32_t           devid_t;
+typedef int32_t            time_t;
+
+struct timespec {
+        time_t  tv_sec;         /* seconds */
+        long    tv_nsec;        /* nanoseconds */
+};
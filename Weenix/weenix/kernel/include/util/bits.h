@@ -19,3 +19,10 @@ bit_check(const void *addr, uintptr_t bit)
         return (*map & (1 << (bit & 0x1f)));
 }
 
+/* Returns one plus the index of the least significant set bit
+ * in word, or 0 if no bit in word is set. */
+static inline int
+bit_ffs(uint32_t word)
+{
+        return __builtin_ffs(word);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "types.h"
+#include "config.h"
+
+#include "util/list.h"
+
+/* Converts a number of milliseconds to clock ticks, rounding up. */
+#define TIME_MSECS_TO_TICKS(ms) (((ms) + TICK_MSECS - 1) / TICK_MSECS)
+
+/* Returns the processor's time stamp counter, which counts CPU cycles
+ * since reset. Useful for measuring short intervals. */
+static inline uint64_t
+time_cycles(void)
+{
+        uint32_t lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * Returns the number of clock ticks, each TICK_MSECS milliseconds
+ * long, since the clock was started.
+ */
+uint32_t time_ticks(void);
+
+typedef void (*ktimer_func_t)(void *arg);
+
+typedef struct ktimer {
+        uint32_t        tm_expires;     /* tick at which the timer fires */
+        ktimer_func_t   tm_func;        /* function to call when it fires */
+        void           *tm_arg;         /* argument to tm_func */
+        list_link_t     tm_link;        /* link on a timer wheel slot */
+} ktimer_t;
+
+/**
+ * Initializes a timer. The timer is not pending until it is added
+ * with timer_add.
+ *
+ * @param timer the timer to initialize
+ * @param func the function to call when the timer fires. It is called
+ * from the clock interrupt handler, so it must not block
+ * @param arg the argument to pass to func
+ */
+void timer_init(ktimer_t *timer, ktimer_func_t func, void *arg);
+
+/**
+ * Starts a timer which is not already pending.
+ *
+ * @param timer the timer to start
+ * @param ticks the number of clock ticks from now after which the
+ * timer fires
+ */
+void timer_add(ktimer_t *timer, uint32_t ticks);
+
+/**
+ * Stops a timer if it is pending.
+ *
+ * @param timer the timer to stop
+ * @return 1 if the timer was pending, 0 if it already fired or was
+ * never started
+ */
+int timer_del(ktimer_t *timer);
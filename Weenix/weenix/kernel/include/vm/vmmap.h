@@ -12,8 +12,10 @@ struct proc;
 struct vnode;
 
 typedef struct vmmap {
-        list_t       vmm_list;
-        struct proc *vmm_proc;
+        list_t         vmm_list;     /* areas in ascending address order */
+        struct vmarea *vmm_root;     /* the same areas, in an AVL tree */
+        struct vmarea *vmm_cache;    /* area vmmap_lookup last found */
+        struct proc   *vmm_proc;
 } vmmap_t;
 
 /* make sure you understand why mapping boundaries are in terms of frame
@@ -32,13 +34,35 @@ typedef struct vmarea {
         list_link_t    vma_olink;    /* link on the list of all vm_areas
                                       * having the same vm_object at the
                                       * bottom of their chain */
+
+        /* Tree fields, maintained by vmmap_insert; the rest describe the
+         * subtree rooted at this area. Never change vma_start or vma_end
+         * of an area while it is in a vmmap: vmmap_unlink it, change
+         * them, and vmmap_insert it again. */
+        struct vmarea *vma_left;
+        struct vmarea *vma_right;
+        uint32_t       vma_height;
+        uint32_t       vma_treelo;   /* lowest vfn mapped in subtree */
+        uint32_t       vma_treehi;   /* end of highest area in subtree */
+        uint32_t       vma_maxgap;   /* largest hole between areas of subtree */
+
+        /* Read-ahead state, used by handle_pagefault */
+        uint32_t       vma_ralast;   /* vfn of the last fault */
+        uint32_t       vma_ranext;   /* first vfn not read ahead yet */
+        uint32_t       vma_rawindow; /* pages read ahead on the last fault */
 } vmarea_t;
 
 void vmmap_init(void);
 
+vmarea_t *vmarea_alloc(void);
+void vmarea_free(vmarea_t *vma);
+
 vmmap_t *vmmap_create(void);
 void vmmap_destroy(vmmap_t *map);
 
+void vmmap_insert(vmmap_t *map, vmarea_t *newvma);
+void vmmap_unlink(vmmap_t *map, vmarea_t *vma);
+
 vmarea_t *vmmap_lookup(vmmap_t *map, uint32_t vfn);
 int vmmap_map(vmmap_t *map, struct vnode *file, uint32_t lopage, uint32_t npages, int prot, int flags, off_t off, int dir, vmarea_t **new);
 int vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages);
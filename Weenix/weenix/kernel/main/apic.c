@@ -1,4 +1,5 @@
 #include "types.h"
+#include "config.h"
 
 #include "main/io.h"
 #include "main/acpi.h"
@@ -7,6 +8,7 @@
 #include "mm/pagetable.h"
 
 #include "util/debug.h"
+#include "util/delay.h"
 
 #define APIC_SIGNATURE (*(uint32_t*)"APIC")
 
@@ -30,12 +32,22 @@
 #define LAPICSPUR (*(volatile uint32_t*)(apic->at_addr + 0xf0))
 #define LAPICTPR (*(volatile uint32_t*)(apic->at_addr + 0x80))
 #define LAPICERR (*(volatile uint32_t*)(apic->at_addr + 0x280))
+#define LAPICICRLO (*(volatile uint32_t*)(apic->at_addr + 0x300))
+#define LAPICICRHI (*(volatile uint32_t*)(apic->at_addr + 0x310))
 
 #define LAPICTIMER (*(volatile uint32_t*)(apic->at_addr + 0x320))
 #define LAPICINITCNT (*(volatile uint32_t*)(apic->at_addr + 0x380))
 #define LAPICCURCNT (*(volatile uint32_t*)(apic->at_addr + 0x390))
 #define LAPICDIVCONF (*(volatile uint32_t*)(apic->at_addr + 0x3e0))
 
+/* interrupt command register delivery modes and flags */
+#define ICR_FIXED (0x0 << 8)
+#define ICR_INIT (0x5 << 8)
+#define ICR_STARTUP (0x6 << 8)
+#define ICR_PENDING (0x1 << 12)
+#define ICR_ASSERT (0x1 << 14)
+#define ICR_LEVEL (0x1 << 15)
+
 #define BIT_SET(data,bit) do { (data) = ((data)|(0x1<<(bit))); } while(0);
 #define BIT_UNSET(data,bit) do { (data) = ((data)&~(0x1<<(bit))); } while(0);
 
@@ -66,17 +78,21 @@ static struct apic_table *apic = NULL;
 static struct lapic_table *lapic = NULL;
 static struct ioapic_table *ioapic = NULL;
 
+/* local APIC ids of all enabled processors, the boot processor first */
+static uint8_t apic_cpus[SMP_MAX_CPUS];
+static int apic_ncpus = 0;
+
 static uint32_t __ioapic_getid(void)
 {
         IOREGSEL(ioapic) = IOAPICID(ioapic);
         uint32_t id = IOWIN(ioapic);
-        return (id >> 24) & 0x0f;
+        return (id >> 24) & 0xff;
 }
 
 static uint32_t __lapic_getid(void)
 {
         uint32_t id = LAPICID;
-        return (id >> 24) & 0x0f;
+        return (id >> 24) & 0xff;
 }
 
 static uint32_t __lapic_getver(void)
@@ -92,6 +108,17 @@ static void __lapic_setspur(uint8_t intr)
         LAPICSPUR = data;
 }
 
+/* Sends an inter-processor interrupt described by the low word of the
+ * interrupt command register to the processor with the given local APIC
+ * id, and waits for our local APIC to deliver it. */
+static void __lapic_sendipi(uint8_t apicid, uint32_t cmd)
+{
+        LAPICICRHI = ((uint32_t)apicid) << 24;
+        LAPICICRLO = cmd;
+        while (LAPICICRLO & ICR_PENDING)
+                __asm__ volatile("pause");
+}
+
 static uint32_t __ioapic_getver()
 {
         IOREGSEL(ioapic) = IOAPICVER(ioapic);
@@ -160,23 +187,35 @@ void apic_init()
         KASSERT(PAGE_ALIGNED(apic->at_addr));
         apic->at_addr = pt_phys_perm_map(apic->at_addr, 1);
 
-        /* Get the tables for the local APIC and IO APICS,
-         * Weenix currently only supports one of each, in order
-         * to enforce this a KASSERT will fail this if more than one
-         * of each type is found */
+        /* Get the tables for the local APICs and IO APICS.
+         * There is one local APIC per processor. We keep the boot
+         * processor's table and record the ids of the others, which
+         * smp_start() wakes up later on. Weenix currently only supports one IO APIC, in order
+         * to enforce this a KASSERT will fail if more than one
+         * is found */
+        apic_cpus[apic_ncpus++] = __lapic_getid();
         uint8_t off = sizeof(*apic);
         while (off < apic->at_header.ah_size) {
                 uint8_t type = *(ptr + off);
                 uint8_t size = *(ptr + off + 1);
                 if (TYPE_LAPIC == type) {
                         KASSERT(sizeof(struct lapic_table) == size);
-                        KASSERT(NULL == lapic && "Weenix only supports a single local APIC");
-                        lapic = (struct lapic_table *)(ptr + off);
+                        struct lapic_table *entry = (struct lapic_table *)(ptr + off);
                         dbgq(DBG_CORE, "LAPIC:\n");
-                        dbgq(DBG_CORE, "   id:         0x%.2x\n", (uint32_t)lapic->at_apicid);
-                        dbgq(DBG_CORE, "   processor:  0x%.3x\n", (uint32_t)lapic->at_procid);
-                        dbgq(DBG_CORE, "   enabled:    %i\n", lapic->at_flags & 0x1);
-                        KASSERT(lapic->at_flags & 0x1 && "The local APIC is disabled");
+                        dbgq(DBG_CORE, "   id:         0x%.2x\n", (uint32_t)entry->at_apicid);
+                        dbgq(DBG_CORE, "   processor:  0x%.3x\n", (uint32_t)entry->at_procid);
+                        dbgq(DBG_CORE, "   enabled:    %i\n", entry->at_flags & 0x1);
+                        if (entry->at_apicid == __lapic_getid()) {
+                                KASSERT(NULL == lapic && "Duplicate boot processor local APIC");
+                                KASSERT(entry->at_flags & 0x1 && "The local APIC is disabled");
+                                lapic = entry;
+                        } else if (entry->at_flags & 0x1) {
+                                if (SMP_MAX_CPUS > apic_ncpus) {
+                                        apic_cpus[apic_ncpus++] = entry->at_apicid;
+                                } else {
+                                        dbgq(DBG_CORE, "   ignored, too many processors\n");
+                                }
+                        }
                 } else if (TYPE_IOAPIC == type) {
                         KASSERT(sizeof(struct ioapic_table) == size);
                         KASSERT(NULL == ioapic && "Weenix only supports a single IO APIC");
@@ -192,13 +231,14 @@ void apic_init()
                 }
                 off += size;
         }
-        KASSERT(NULL != lapic && "Could not find a local APIC device");
+        KASSERT(NULL != lapic && "Could not find the boot processor's local APIC");
         KASSERT(NULL != ioapic && "Could not find an IO APIC");
 
         LAPICSPUR = LAPICSPUR | 0x100;
         dbgq(DBG_CORE, "Local APIC 0x%.2x Configuration:\n", __lapic_getid());
         dbgq(DBG_CORE, "    APIC Version:         0x%.2x\n", __lapic_getver());
         dbgq(DBG_CORE, "    Spurious Vector:      0x%.8x\n", LAPICSPUR);
+        dbgq(DBG_CORE, "    Processors:           %d\n", apic_ncpus);
 
         dbgq(DBG_CORE, "IO APIC 0x%.2x Configuration:\n", __ioapic_getid());
         dbgq(DBG_CORE, "    APIC Version:         0x%.2x\n", __ioapic_getver());
@@ -216,6 +256,32 @@ void apic_init()
         outb(PORT_PIC1 + 1, 0xff); /* mask all IRQS on the PIC */
 }
 
+void apic_init_ap(uint8_t spur)
+{
+        __lapic_setspur(spur);
+        LAPICSPUR = LAPICSPUR | 0x100;
+}
+
+void apic_startap(uint8_t apicid, uintptr_t paddr)
+{
+        KASSERT(PAGE_ALIGNED(paddr) && 0x100000 > paddr);
+
+        /* the universal startup algorithm from the Intel MultiProcessor
+         * Specification, an INIT followed by two STARTUPs whose vector
+         * is the page the processor starts executing in real mode */
+        __lapic_sendipi(apicid, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+        udelay(10000);
+        __lapic_sendipi(apicid, ICR_STARTUP | (paddr >> PAGE_SHIFT));
+        udelay(200);
+        __lapic_sendipi(apicid, ICR_STARTUP | (paddr >> PAGE_SHIFT));
+        udelay(200);
+}
+
+void apic_sendipi(uint8_t apicid, uint8_t intr)
+{
+        __lapic_sendipi(apicid, ICR_FIXED | ICR_ASSERT | intr);
+}
+
 int apic_starttimer(uint32_t count, unsigned int div, uint8_t intr, int periodic)
 {
         switch (div) {
@@ -241,6 +307,17 @@ int apic_starttimer(uint32_t count, unsigned int div, uint8_t intr, int periodic
         return 0;
 }
 
+int apic_cpucount()
+{
+        return apic_ncpus;
+}
+
+uint8_t apic_cpuid(int cpu)
+{
+        KASSERT(0 <= cpu && apic_ncpus > cpu);
+        return apic_cpus[cpu];
+}
+
 uint32_t apic_gettimer()
 {
         return LAPICCURCNT;
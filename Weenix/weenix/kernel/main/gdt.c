@@ -1,4 +1,7 @@
+#include "config.h"
+
 #include "main/gdt.h"
+#include "main/smp.h"
 
 #include "util/printf.h"
 #include "util/debug.h"
@@ -48,7 +51,7 @@ struct gdt_location {
 } __attribute__((packed));
 
 static struct gdt_entry gdt[GDT_COUNT];
-static struct tss_entry tss;
+static struct tss_entry tss[SMP_MAX_CPUS];
 static struct gdt_location gdtl = {
         .gl_size = GDT_COUNT * 8,
         .gl_offset = (uint32_t) &gdt
@@ -67,22 +70,38 @@ void gdt_init(void)
 
         __asm__ volatile("lgdt (%0)" :: "p"(data));
 
-        gdt_set_entry(GDT_TSS, (uint32_t)&tss, sizeof(tss), 0, 1, 0, 0);
-        gdt[GDT_TSS / 8].ge_access &= ~(0b10000);
-        gdt[GDT_TSS / 8].ge_access |= 0b1;
-        gdt[GDT_TSS / 8].ge_flags &= ~(0b10000000);
+        KASSERT(GDT_TSS + 8 * SMP_MAX_CPUS <= GDT_COUNT * 8);
+        int cpu;
+        for (cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+                int segment = GDT_TSS + 8 * cpu;
+                gdt_set_entry(segment, (uint32_t)&tss[cpu], sizeof(tss[cpu]), 0, 1, 0, 0);
+                gdt[segment / 8].ge_access &= ~(0b10000);
+                gdt[segment / 8].ge_access |= 0b1;
+                gdt[segment / 8].ge_flags &= ~(0b10000000);
 
-        memset(&tss, 0, sizeof(tss));
-        tss.ts_ss0 = GDT_KERNEL_DATA;
-        tss.ts_iopb = sizeof(tss);
+                memset(&tss[cpu], 0, sizeof(tss[cpu]));
+                tss[cpu].ts_ss0 = GDT_KERNEL_DATA;
+                tss[cpu].ts_iopb = sizeof(tss[cpu]);
+        }
 
         int segment = GDT_TSS;
         __asm__ volatile("ltr %0" :: "m"(segment));
 }
 
+void gdt_init_ap(int cpu)
+{
+        struct gdt_location *data = &gdtl;
+
+        KASSERT(0 < cpu && SMP_MAX_CPUS > cpu);
+        __asm__ volatile("lgdt (%0)" :: "p"(data));
+
+        int segment = GDT_TSS + 8 * cpu;
+        __asm__ volatile("ltr %0" :: "m"(segment));
+}
+
 void gdt_set_kernel_stack(void *addr)
 {
-        tss.ts_esp0 = (uint32_t)addr;
+        tss[curcpu()->cpu_id].ts_esp0 = (uint32_t)addr;
 }
 
 void gdt_set_entry(uint32_t segment, uint32_t base, uint32_t limit,
@@ -123,7 +142,7 @@ size_t gdt_tss_info(const void *arg, char *buf, size_t osize)
         KASSERT(NULL == arg);
 
         iprintf(&buf, &size, "TSS:\n");
-        iprintf(&buf, &size, "kstack: %#.8x\n", tss.ts_esp0);
+        iprintf(&buf, &size, "kstack: %#.8x\n", tss[curcpu()->cpu_id].ts_esp0);
 
         return size;
 }
@@ -7,9 +7,16 @@
 #include "main/apic.h"
 #include "main/interrupt.h"
 #include "main/gdt.h"
+#include "main/smp.h"
+
+#include "proc/sched.h"
 
 #define MAX_INTERRUPTS          256
 
+/* the "irq" of interrupts raised by the local APIC itself, which have
+ * no IO APIC pin but must be acknowledged all the same */
+#define INTR_IRQ_LOCAL          0xffff
+
 #define INTR_SPURIOUS      0xef
 
 /* Convenient definitions for intr_desc.attr */
@@ -362,6 +369,7 @@ intr_handler_t intr_register(uint8_t intr, intr_handler_t handler)
 int32_t intr_map(uint16_t irq, uint8_t intr)
 {
         KASSERT(INTR_SPURIOUS != intr);
+        KASSERT(INTR_IRQ_LOCAL != irq);
 
         int32_t oldirq = intr_mappings[intr];
         intr_mappings[intr] = irq;
@@ -369,9 +377,28 @@ int32_t intr_map(uint16_t irq, uint8_t intr)
         return oldirq;
 }
 
+void intr_map_local(uint8_t intr)
+{
+        KASSERT(INTR_SPURIOUS != intr);
+        KASSERT(0 > intr_mappings[intr]);
+
+        intr_mappings[intr] = INTR_IRQ_LOCAL;
+}
+
 static __attribute__((used)) void __intr_handler(regs_t regs)
 {
         intr_handler_t handler = intr_handlers[regs.r_intr];
+
+        /* Interrupts from user mode, or from a processor halted in its
+         * idle loop, have to take the kernel lock. TLB shootdowns are
+         * the exception, the processor asking for one holds the lock
+         * while it waits for us. */
+        int unlock = 0;
+        if (INTR_SMP_TLB != regs.r_intr && !smp_kernel_locked()) {
+                smp_kernel_lock();
+                unlock = 1;
+        }
+
         _intr_regs = &regs;
         if (NULL != handler) {
                 handler(&regs);
@@ -384,6 +411,19 @@ static __attribute__((used)) void __intr_handler(regs_t regs)
         }
 
         _intr_regs = NULL;
+
+        /* Only user threads are preempted, and only once the device
+         * interrupt has been acknowledged. Kernel code is never
+         * preempted, and neither is anything without the kernel lock. */
+        if (0 <= intr_mappings[regs.r_intr] && 3 == (regs.r_cs & 3) && unlock) {
+                sched_preempt_check();
+        }
+
+        /* we may be on another processor by now, but that one holds
+         * the lock too and is about to leave the kernel */
+        if (unlock) {
+                smp_kernel_unlock();
+        }
 }
 
 static void __intr_divide_by_zero_handler(regs_t *regs)
@@ -396,11 +436,6 @@ static void __intr_gpf_handler(regs_t *regs)
         panic("\nGeneral Protection Fault:\nError: 0x%.8x\n", regs->r_err);
 }
 
-static void __intr_timer_handler(regs_t *regs)
-{
-        panic("\nTimer Interrupt:\nError: 0x%.8x\n", regs->r_err);
-}
-
 static void __intr_inval_opcode_handler(regs_t *regs)
 {
         panic("\nInvalid opcode error at eip=0x%08x\n", regs->r_eip);
@@ -703,3 +738,11 @@ void intr_init()
         intr_register(INTR_GPF, __intr_gpf_handler);
         intr_register(INTR_INVALID_OPCODE, __intr_inval_opcode_handler);
 }
+
+void intr_init_ap()
+{
+        intr_info_t *data = &intr_data;
+
+        __asm__("lidt (%0)" :: "p"(data));
+        apic_init_ap(INTR_SPURIOUS);
+}
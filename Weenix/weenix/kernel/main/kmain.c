@@ -22,6 +22,7 @@
 #include "main/interrupt.h"
 #include "main/cpuid.h"
 #include "main/gdt.h"
+#include "main/smp.h"
 
 #include "proc/sched.h"
 #include "proc/proc.h"
@@ -84,6 +85,7 @@ kmain()
         intr_init();
 
         gdt_init();
+        smp_init();
 
         /* initialize slab allocators */
 #ifdef __VM__
@@ -204,6 +206,10 @@ idleproc_run(int arg1, void *arg2)
          * are enabled AFTER all drivers are initialized) */
         intr_enable();
 
+        /* Now that the boot processor takes interrupts, the others
+         * can be started */
+        smp_start();
+
         /* Run initproc */
         sched_make_runnable(initthr);
         /* Now wait for it */
@@ -217,6 +223,9 @@ idleproc_run(int arg1, void *arg2)
 
 
 #ifdef __VFS__
+        /* Queued read-ahead requests hold vnodes, drop them first */
+        pframe_readahead_shutdown();
+
         /* Shutdown the vfs: */
         dbg_print("weenix: vfs shutdown...\n");
         vput(curproc->p_cwd);
@@ -1,5 +1,6 @@
 #include "main/io.h"
 #include "main/interrupt.h"
+#include "main/pit.h"
 #include "util/delay.h"
 
 /* IRQ */
@@ -12,10 +13,8 @@
 #define PIT_CMD   0x43
 
 #define CLOCK_TICK_RATE 1193182
-#undef HZ
-#define HZ 1000
 
-#define LATCH (CLOCK_TICK_RATE / HZ)
+#define LATCH (CLOCK_TICK_RATE / PIT_HZ)
 
 void pit_starttimer(uint8_t intr)
 {
@@ -0,0 +1,250 @@
+#include "types.h"
+#include "config.h"
+#include "globals.h"
+#include "kernel.h"
+
+#include "main/apic.h"
+#include "main/gdt.h"
+#include "main/interrupt.h"
+#include "main/smp.h"
+
+#include "mm/page.h"
+#include "mm/pagetable.h"
+#include "mm/tlb.h"
+
+#include "proc/sched.h"
+#include "proc/spinlock.h"
+
+#include "util/debug.h"
+#include "util/delay.h"
+#include "util/string.h"
+
+/* how long to wait for an application processor to start, in msecs */
+#define SMP_START_TIMEOUT 1000
+
+cpu_t smp_cpus[SMP_MAX_CPUS];
+int smp_ncpus = 1;
+
+/* the stacks of the application processors' idle loops */
+static void *smp_stacks[SMP_MAX_CPUS];
+
+/* the kernel lock, see main/smp.h */
+static spinlock_t smp_kernel_lk = SPINLOCK_INITIALIZER;
+
+/* the trampoline code in main/trampoline.S, and the arguments at its
+ * end which smp_start() fills in for each processor */
+extern char smp_trampoline_start[];
+extern char smp_trampoline_end[];
+extern char smp_trampoline_args[];
+
+typedef struct smp_trampoline_args {
+        uint32_t        ta_cr3;         /* physical address of the page directory */
+        uint32_t        ta_stack;       /* top of the processor's stack */
+        uint32_t        ta_entry;       /* function to call, smp_ap_main */
+        uint32_t        ta_cpu;         /* argument to the function */
+} smp_trampoline_args_t;
+
+static void smp_ap_main(int id);
+
+void
+smp_kernel_lock(void)
+{
+        cpu_t *cpu = curcpu();
+
+        KASSERT(!cpu->cpu_locked);
+        while (!spinlock_trylock(&smp_kernel_lk)) {
+                /* we usually spin with interrupts disabled, so do
+                 * the TLB flushes the lock holder may be waiting for
+                 * here */
+                while (smp_kernel_lk.s_locked) {
+                        if (cpu->cpu_tlbflush) {
+                                tlb_flush_all();
+                                cpu->cpu_tlbflush = 0;
+                        }
+                        __asm__ volatile("pause");
+                }
+        }
+        cpu->cpu_locked = 1;
+}
+
+void
+smp_kernel_unlock(void)
+{
+        cpu_t *cpu = curcpu();
+
+        KASSERT(cpu->cpu_locked);
+        cpu->cpu_locked = 0;
+        spinlock_unlock(&smp_kernel_lk);
+}
+
+int
+smp_kernel_locked(void)
+{
+        return curcpu()->cpu_locked;
+}
+
+void
+smp_resched(int cpu)
+{
+        KASSERT(0 <= cpu && smp_ncpus > cpu);
+
+        if (cpu != curcpu()->cpu_id && smp_cpus[cpu].cpu_started)
+                apic_sendipi(smp_cpus[cpu].cpu_apicid, INTR_SMP_RESCHED);
+}
+
+void
+smp_tlb_shootdown(pagedir_t *pd)
+{
+        cpu_t *self = curcpu();
+        int i, waiting;
+
+        if (1 == smp_ncpus)
+                return;
+
+        for (i = 0; i < smp_ncpus; i++) {
+                cpu_t *cpu = &smp_cpus[i];
+                if (cpu != self && cpu->cpu_started && pd == cpu->cpu_pagedir) {
+                        cpu->cpu_tlbflush = 1;
+                        apic_sendipi(cpu->cpu_apicid, INTR_SMP_TLB);
+                }
+        }
+
+        do {
+                waiting = 0;
+                for (i = 0; i < smp_ncpus; i++)
+                        waiting |= smp_cpus[i].cpu_tlbflush;
+        } while (waiting);
+}
+
+/*
+ * The handler for INTR_SMP_RESCHED has nothing to do, the interrupt
+ * only wakes the processor up from its idle loop or brings it into the
+ * kernel so that __intr_handler() checks whether its thread needs to
+ * be preempted.
+ */
+static void
+smp_resched_handler(regs_t *regs)
+{
+}
+
+/*
+ * Handles INTR_SMP_TLB, which __intr_handler() runs without the kernel
+ * lock because the processor asking for the flush holds it.
+ */
+static void
+smp_tlb_handler(regs_t *regs)
+{
+        cpu_t *cpu = curcpu();
+
+        tlb_flush_all();
+        cpu->cpu_tlbflush = 0;
+}
+
+void
+smp_init(void)
+{
+        int i;
+
+#ifdef __SMP__
+        smp_ncpus = MIN(apic_cpucount(), SMP_MAX_CPUS);
+#else
+        smp_ncpus = 1;
+#endif
+        KASSERT(0 < smp_ncpus);
+
+        for (i = 0; i < smp_ncpus; i++) {
+                smp_cpus[i].cpu_id = i;
+                smp_cpus[i].cpu_apicid = apic_cpuid(i);
+        }
+        dbg(DBG_CORE, "using %d of %d processors\n", smp_ncpus, apic_cpucount());
+
+        intr_register(INTR_SMP_RESCHED, smp_resched_handler);
+        intr_map_local(INTR_SMP_RESCHED);
+        intr_register(INTR_SMP_TLB, smp_tlb_handler);
+        intr_map_local(INTR_SMP_TLB);
+
+        /* the boot processor runs kmain with the kernel lock held */
+        smp_cpus[0].cpu_started = 1;
+        smp_kernel_lock();
+}
+
+void
+smp_start(void)
+{
+#ifdef __SMP__
+        smp_trampoline_args_t *args;
+        uintptr_t cr3;
+        int i, ms;
+
+        if (1 == smp_ncpus)
+                return;
+
+        KASSERT(PAGE_SIZE >= (uint32_t)(smp_trampoline_end - smp_trampoline_start));
+        KASSERT(PAGE_ALIGNED(SMP_TRAMPOLINE) && 0x100000 > SMP_TRAMPOLINE);
+
+        /* the processors start in real mode and turn on paging while
+         * still running in the trampoline page, so it has to be
+         * identity mapped while they start */
+        pt_lowmem_map(SMP_TRAMPOLINE, 1);
+        memcpy((void *)SMP_TRAMPOLINE, smp_trampoline_start,
+               smp_trampoline_end - smp_trampoline_start);
+        args = (smp_trampoline_args_t *)(SMP_TRAMPOLINE
+                                         + (smp_trampoline_args - smp_trampoline_start));
+
+        /* every page directory shares the page table of the trampoline,
+         * so any of them would do, but the template outlives them all */
+        cr3 = pt_virt_to_phys((uintptr_t)pt_template());
+
+        for (i = 1; i < smp_ncpus; i++) {
+                smp_stacks[i] = page_alloc_n(IDLE_STACK_SIZE >> PAGE_SHIFT);
+                if (NULL == smp_stacks[i])
+                        panic("no memory for the stack of processor %d\n", i);
+
+                args->ta_cr3 = cr3;
+                args->ta_stack = (uint32_t)smp_stacks[i] + IDLE_STACK_SIZE;
+                args->ta_entry = (uint32_t)smp_ap_main;
+                args->ta_cpu = i;
+
+                apic_startap(smp_cpus[i].cpu_apicid, SMP_TRAMPOLINE);
+                for (ms = 0; !smp_cpus[i].cpu_started; ms++) {
+                        if (SMP_START_TIMEOUT == ms)
+                                panic("processor %d (apic id 0x%02x) did not start\n",
+                                      i, (uint32_t)smp_cpus[i].cpu_apicid);
+                        udelay(1000);
+                }
+        }
+
+        pt_lowmem_map(SMP_TRAMPOLINE, 0);
+        dbg(DBG_CORE, "started %d application processors\n", smp_ncpus - 1);
+#endif
+}
+
+/*
+ * The C entry point of application processor 'id', called by the
+ * trampoline with interrupts disabled and on the stack smp_start()
+ * allocated for the processor. The processor never leaves its idle
+ * loop, which runs on that stack.
+ */
+static void
+smp_ap_main(int id)
+{
+        cpu_t *cpu = &smp_cpus[id];
+
+        /* curcpu() only works once our TSS is loaded */
+        gdt_init_ap(id);
+        KASSERT(cpu == curcpu());
+
+        cpu->cpu_pagedir = pt_template();
+        intr_init_ap();
+        apic_setipl(IPL_HIGH);
+
+        /* the boot processor holds the kernel lock until it sees this */
+        cpu->cpu_started = 1;
+        smp_kernel_lock();
+
+        dbg(DBG_CORE, "processor %d (apic id 0x%02x) started\n",
+            id, (uint32_t)cpu->cpu_apicid);
+        sched_idle(smp_stacks[id], IDLE_STACK_SIZE);
+
+        panic("returned to smp_ap_main()\n");
+}
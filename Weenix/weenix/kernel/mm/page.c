@@ -1,5 +1,6 @@
 #include "types.h"
 #include "kernel.h"
+#include "config.h"
 
 #include "mm/mm.h"
 #include "mm/page.h"
@@ -10,10 +11,12 @@
 #include "util/list.h"
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/printf.h"
 
 #include "vm/shadowd.h"
 
 #include "proc/sched.h"
+#include "proc/kthread.h"
 
 GDB_DEFINE_HOOK(page_alloc, void *addr, int npages)
 GDB_DEFINE_HOOK(page_free, void *addr, int npages)
@@ -21,9 +24,36 @@ GDB_DEFINE_HOOK(page_free, void *addr, int npages)
 static list_t pagegroup_list;
 static uintptr_t page_freecount;
 
+/* Free pages which have already been zeroed for page_alloc_zeroed.
+ * They are taken out of the buddy system, but are still counted in
+ * page_freecount. */
+static list_t page_zeroed_list;
+static uint32_t page_zeroed_count;
+
+/* Statistics for page_info */
+static uint32_t page_totalcount;                /* pages in all groups */
+static uint32_t page_nallocs[PAGE_NSIZES];      /* blocks allocated, by order */
+static uint32_t page_nfrees[PAGE_NSIZES];       /* blocks freed, by order */
+
+/* Number of free blocks of each order in the buddy system, over all
+ * groups. Kept up to date by _freelist_insert and _freelist_remove. */
+static uint32_t page_nfree[PAGE_NSIZES];
+
+/* The group which manages each PAGEGROUP_TABLE_SHIFT sized piece of
+ * the address space, so that the group an address belongs to can be
+ * found without walking pagegroup_list. A piece shared by several
+ * groups is marked PAGEGROUP_MANY, and those are looked up the slow
+ * way. */
+#define PAGEGROUP_TABLE_SHIFT   22
+#define PAGEGROUP_TABLE_SIZE    (1 << (32 - PAGEGROUP_TABLE_SHIFT))
+#define PAGEGROUP_MANY          ((struct pagegroup *)1)
+
+static struct pagegroup *pagegroup_table[PAGEGROUP_TABLE_SIZE];
+
 struct pagegroup {
         list_t       pg_freelist[PAGE_NSIZES];
         void        *pg_map[PAGE_NSIZES];
+        void       **pg_owner;          /* owner of each page, see page_set_owner */
         uintptr_t    pg_baseaddr;
         uintptr_t    pg_endaddr;
         list_link_t  pg_link;
@@ -33,6 +63,22 @@ struct freepage {
         list_link_t fp_link;
 };
 
+static void _page_free_order(void *addr, int order);
+
+static inline void
+_freelist_insert(struct pagegroup *group, int order, uintptr_t addr)
+{
+        list_insert_head(&group->pg_freelist[order], &((struct freepage *)addr)->fp_link);
+        page_nfree[order]++;
+}
+
+static inline void
+_freelist_remove(int order, uintptr_t addr)
+{
+        list_remove(&((struct freepage *)addr)->fp_link);
+        page_nfree[order]--;
+}
+
 static struct pagegroup *
 _pagegroup_create(uintptr_t start, uintptr_t end)
 {
@@ -51,10 +97,11 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
         /* allocate some of the space for the buddy bit maps,
          * we allocate enough bits to track all pages even
          * though some pages will be unavailable since they
-         * are being used as bitmaps */
+         * are being used as bitmaps (including the last pair
+         * at each order, which may only be partly there) */
         int order;
         for (order = 1; order < PAGE_NSIZES; ++order) {
-                uintptr_t count = npages >> order;
+                uintptr_t count = (npages + (1 << order) - 1) >> order;
                 count = ((count - 1) & ~((uintptr_t)0x7)) + 8;
                 count = count >> 3;
                 end -= count;
@@ -62,6 +109,12 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
                 memset(group->pg_map[order], 0, count);
         }
 
+        /* and one owner pointer per page */
+        end -= npages * sizeof(void *);
+        end &= ~(sizeof(void *) - 1);
+        group->pg_owner = (void **)end;
+        memset(group->pg_owner, 0, npages * sizeof(void *));
+
         /* discard the remainder of the page being used for
          * mappings and read just npages */
         end = (uintptr_t)PAGE_ALIGN_DOWN(end);
@@ -69,12 +122,17 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
         group->pg_endaddr = end;
 
         /* put pages which do not fit nicely into the largest
-         * order and add them to smaller buckets */
+         * order and add them to smaller buckets. Each of these blocks
+         * is the lower half of a pair whose upper half runs past the
+         * end of the group, so its buddy bit is set to keep it from
+         * ever being joined with that half. */
         for (order = 0; order < PAGE_NSIZES - 1; ++order) {
                 list_init(&group->pg_freelist[order]);
                 if (npages & (1 << order)) {
                         end -= (1 << order) << PAGE_SHIFT;
-                        list_insert_head(&group->pg_freelist[order], &((struct freepage *)end)->fp_link);
+                        _freelist_insert(group, order, end);
+                        bit_flip(group->pg_map[order + 1],
+                                 ((end - start) >> PAGE_SHIFT) >> (order + 1));
                 }
         }
 
@@ -83,7 +141,7 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
         list_init(&group->pg_freelist[order]);
         uintptr_t current = start;
         while (current < end) {
-                list_insert_head(&group->pg_freelist[order], &((struct freepage *)current)->fp_link);
+                _freelist_insert(group, order, current);
                 current += (1 << order) << PAGE_SHIFT;
         }
 
@@ -93,7 +151,13 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
 static struct pagegroup *
 _pagegroup_from_address(uintptr_t addr)
 {
-        struct pagegroup *group;
+        struct pagegroup *group = pagegroup_table[addr >> PAGEGROUP_TABLE_SHIFT];
+
+        if (PAGEGROUP_MANY != group) {
+                if (NULL != group && addr >= group->pg_baseaddr && addr < group->pg_endaddr)
+                        return group;
+                return NULL;
+        }
         list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
                 if (addr >= group->pg_baseaddr && addr < group->pg_endaddr)
                         return group;
@@ -105,7 +169,12 @@ void
 page_init()
 {
         list_init(&pagegroup_list);
+        memset(pagegroup_table, 0, sizeof(pagegroup_table));
+        memset(page_nfree, 0, sizeof(page_nfree));
         page_freecount = 0;
+        list_init(&page_zeroed_list);
+        page_zeroed_count = 0;
+        page_totalcount = 0;
 }
 
 void
@@ -119,8 +188,13 @@ page_add_range(uintptr_t start, uintptr_t end)
 
         struct pagegroup *group = _pagegroup_create(start, end);
         if (group->pg_baseaddr < group->pg_endaddr) {
+                uintptr_t i;
+                for (i = group->pg_baseaddr >> PAGEGROUP_TABLE_SHIFT;
+                     i <= (group->pg_endaddr - 1) >> PAGEGROUP_TABLE_SHIFT; i++)
+                        pagegroup_table[i] = (NULL == pagegroup_table[i]) ? group : PAGEGROUP_MANY;
                 list_insert_tail(&pagegroup_list, &group->pg_link);
                 page_freecount += ADDR_TO_PN(group->pg_endaddr - group->pg_baseaddr);
+                page_totalcount += ADDR_TO_PN(group->pg_endaddr - group->pg_baseaddr);
         }
 }
 
@@ -158,7 +232,7 @@ __page_split(struct pagegroup *group, uint32_t order)
         KASSERT(PAGE_SIZE >= sizeof(uintptr_t));
 
         uintptr_t target = (uintptr_t)list_head(&group->pg_freelist[order], struct freepage, fp_link);
-        list_remove_head(&group->pg_freelist[order]);
+        _freelist_remove(order, target);
 
         /* splitting the page requires marking it as allocated */
         if (likely(order < PAGE_NSIZES - 1)) {
@@ -169,11 +243,33 @@ __page_split(struct pagegroup *group, uint32_t order)
         KASSERT(!bit_check(group->pg_map[order], _pagegroup_calculate_index(group, order, target)));
 
         uintptr_t buddy = (target + ((1 << (order - 1)) << PAGE_SHIFT));
-        list_insert_head(&group->pg_freelist[order - 1], &((struct freepage *)target)->fp_link);
-        list_insert_head(&group->pg_freelist[order - 1], &((struct freepage *)buddy)->fp_link);
+        _freelist_insert(group, order - 1, target);
+        _freelist_insert(group, order - 1, buddy);
         dbg(DBG_PAGEALLOC, "split 0x%.8x (%u) into 0x%.8x and 0x%.8x\n", target, order, target, buddy);
 }
 
+/**
+ * Gives the pre-zeroed pages back to the buddy system so that they can
+ * be joined into larger blocks.
+ *
+ * @return the number of pages given back
+ */
+static int
+_page_zeroed_reclaim(void)
+{
+        int nfreed = page_zeroed_count;
+        struct freepage *fp;
+
+        while (!list_empty(&page_zeroed_list)) {
+                fp = list_head(&page_zeroed_list, struct freepage, fp_link);
+                list_remove(&fp->fp_link);
+                page_zeroed_count--;
+                page_freecount--;
+                _page_free_order(fp, 0);
+        }
+        return nfreed;
+}
+
 /**
  * Finds a block of pages strictly bigger than a block of the given order and
  * splits it into blocks of the given order. Used, for example, when the user
@@ -197,6 +293,8 @@ _page_split(int order)
                 /* Find the first free block of greater size than requested. */
                 for (norder = order + 1; norder < PAGE_NSIZES; norder++) {
                         struct pagegroup *group;
+                        if (0 == page_nfree[norder])
+                                continue;
                         list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
                                 if (!list_empty(&group->pg_freelist[norder])) {
                                         while (norder > order) {
@@ -217,14 +315,40 @@ _page_split(int order)
                 shadowd_wakeup();
                 shadowd_alloc_sleep();
 #endif
-                int num_freed = slab_allocators_reclaim(0);
+                int num_freed = _page_zeroed_reclaim();
+                dbg(DBG_MM, "returned %d pre-zeroed pages to the free lists.\n", num_freed);
+                num_freed = slab_allocators_reclaim(0);
                 dbg(DBG_MM, "reclaimed %d pages from slab allocator.\n", num_freed);
+                num_freed = kthread_stacks_reclaim(0);
+                dbg(DBG_MM, "reclaimed %d pages from kernel stack cache.\n", num_freed);
         } while (num_retrys-- > 0);
 
         /* We are out of memory, and not even the shadow deamon could free some */
         return NULL;
 }
 
+/**
+ * Takes the first free block of the given order from a group and marks
+ * it as allocated.
+ *
+ * @param group a group with a free block of the given order
+ * @param order the order of the block
+ * @return the address of the block
+ */
+static uintptr_t
+_pagegroup_alloc(struct pagegroup *group, uint32_t order)
+{
+        uintptr_t addr;
+
+        KASSERT(!list_empty(&group->pg_freelist[order]));
+
+        addr = (uintptr_t)list_head(&group->pg_freelist[order], struct freepage, fp_link);
+        _freelist_remove(order, addr);
+        if (PAGE_NSIZES - 1 > order)
+                bit_flip(group->pg_map[order + 1], _pagegroup_calculate_index(group, order + 1, addr));
+        return addr;
+}
+
 /**
  * Allocate a block of at least 2^order pages. Fills the block with the
  * MM_POISON_ALLOC pattern.
@@ -238,10 +362,22 @@ _page_alloc_order(uint32_t order)
         uintptr_t addr;
         struct pagegroup *group;
 
-        list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
-                if (!list_empty(&group->pg_freelist[order]))
-                        goto found;
-        } list_iterate_end();
+        if (0 != page_nfree[order]) {
+                list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
+                        if (!list_empty(&group->pg_freelist[order]))
+                                goto found;
+                } list_iterate_end();
+                panic("page_nfree[%u] is %u, but no group has a free block\n",
+                      order, page_nfree[order]);
+        }
+
+        /* a pre-zeroed page will do before splitting anything */
+        if (0 == order && !list_empty(&page_zeroed_list)) {
+                addr = (uintptr_t)list_head(&page_zeroed_list, struct freepage, fp_link);
+                list_remove_head(&page_zeroed_list);
+                page_zeroed_count--;
+                goto taken;
+        }
 
         if (NULL != (group = _page_split(order))) {
                 KASSERT(!list_empty(&group->pg_freelist[order]));
@@ -250,10 +386,8 @@ _page_alloc_order(uint32_t order)
         return NULL;
 
 found:
-        addr = (uintptr_t)list_head(&group->pg_freelist[order], struct freepage, fp_link);
-        list_remove_head(&group->pg_freelist[order]);
-        if (PAGE_NSIZES - 1 > order)
-                bit_flip(group->pg_map[order + 1], _pagegroup_calculate_index(group, order + 1, addr));
+        addr = _pagegroup_alloc(group, order);
+taken:
 
         dbg(DBG_MM, "allocating %d pages (addr 0x%x)\n", (1 << order), addr);
 
@@ -266,6 +400,7 @@ found:
 #endif /* MM_POISON */
 
         page_freecount -= (1 << order);
+        page_nallocs[order]++;
         return (void *) addr;
 }
 
@@ -282,11 +417,11 @@ __page_join(struct pagegroup *group, int order, uintptr_t addr)
 
                 dbg(DBG_PAGEALLOC, "joining 0x%.8x and 0x%.8x (%u) into 0x%.8x\n", addr, buddy, order, MIN(offset, buddy));
 
-                list_remove(&((struct freepage *)addr)->fp_link);
-                list_remove(&((struct freepage *)buddy)->fp_link);
+                _freelist_remove(order, addr);
+                _freelist_remove(order, buddy);
                 addr = MIN(addr, buddy);
                 ++order;
-                list_insert_head(&group->pg_freelist[order], &((struct freepage *)addr)->fp_link);
+                _freelist_insert(group, order, addr);
 
                 if (PAGE_NSIZES - 1 > order)
                         bit_flip(group->pg_map[order + 1], _pagegroup_calculate_index(group, order + 1, (uintptr_t)addr));
@@ -315,8 +450,9 @@ _page_free_order(void *addr, int order)
         if (NULL == group)
                 return;
 
-        list_insert_head(&group->pg_freelist[order], &((struct freepage *)addr)->fp_link);
+        _freelist_insert(group, order, (uintptr_t)addr);
         page_freecount += (1 << order);
+        page_nfrees[order]++;
 
         if (PAGE_NSIZES - 1 > order) {
                 uintptr_t index = _pagegroup_calculate_index(group, order + 1, (uintptr_t)addr);
@@ -340,6 +476,84 @@ page_alloc(void)
         return addr;
 }
 
+/*
+ * Allocate one page of memory filled with zeros, using a page zeroed
+ * by the idle loop if one is ready.
+ * @return the address of the page
+ */
+void *
+page_alloc_zeroed(void)
+{
+        void *addr;
+
+        if (!list_empty(&page_zeroed_list)) {
+                addr = list_head(&page_zeroed_list, struct freepage, fp_link);
+                list_remove_head(&page_zeroed_list);
+                page_zeroed_count--;
+                page_freecount--;
+                page_nallocs[0]++;
+                /* the list link was the only thing written to the
+                 * page, and list_remove cleared it */
+        } else if (NULL != (addr = _page_alloc_order(0))) {
+                memset(addr, 0, PAGE_SIZE);
+        }
+
+        GDB_CALL_HOOK(page_alloc, addr, 1);
+        return addr;
+}
+
+/*
+ * Take one free page for the idle loop to zero for page_alloc_zeroed.
+ * Only pages which are free in the buddy system are used, and some are
+ * always left there so that background zeroing never causes an
+ * allocation to fail. The page does not count as free until it is
+ * handed back with page_zero_give.
+ * @return the page to zero, or NULL if there is nothing to do
+ */
+void *
+page_zero_take(void)
+{
+        struct pagegroup *group;
+        uint32_t order;
+
+        if (page_zeroed_count >= PAGE_ZERO_MAX
+            || page_freecount - page_zeroed_count <= PAGE_ZERO_MAX)
+                return NULL;
+
+        /* split the smallest free block there is */
+        for (order = 0; order < PAGE_NSIZES; order++) {
+                if (0 == page_nfree[order])
+                        continue;
+                list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
+                        if (!list_empty(&group->pg_freelist[order]))
+                                goto found;
+                } list_iterate_end();
+        }
+        return NULL;
+
+found:
+        for (; order > 0; order--)
+                __page_split(group, order);
+        page_freecount--;
+        return (void *)_pagegroup_alloc(group, 0);
+}
+
+/*
+ * Put a page from page_zero_take, which the caller has zeroed, on the
+ * list of pre-zeroed free pages.
+ * @param addr the zeroed page
+ */
+void
+page_zero_give(void *addr)
+{
+        struct freepage *fp = addr;
+
+        KASSERT(PAGE_ALIGNED(addr));
+        list_insert_head(&page_zeroed_list, &fp->fp_link);
+        page_zeroed_count++;
+        page_freecount++;
+}
+
 /*
  * Free one page of memory (which was allocated with page_alloc())
  * @param addr the address of the page to be freed
@@ -352,7 +566,31 @@ page_free(void *addr)
 }
 
 /*
- * Allocates a block of at least npages pages.
+ * Frees pages first up to (but not including) last of the block at
+ * base, which must be aligned to a power of two at least as big as
+ * last. The pages are freed as the biggest aligned blocks which fit,
+ * so that they coalesce with each other and with their buddies.
+ */
+static void
+_page_free_range(uintptr_t base, uint32_t first, uint32_t last)
+{
+        int order;
+
+        while (first < last) {
+                for (order = PAGE_NSIZES - 1; order > 0; order--) {
+                        if (0 == (first & ((1 << order) - 1))
+                            && first + (1 << order) <= last)
+                                break;
+                }
+                _page_free_order((void *)(base + (first << PAGE_SHIFT)), order);
+                first += 1 << order;
+        }
+}
+
+/*
+ * Allocates a block of exactly npages pages. The smallest buddy block
+ * which holds them is allocated and the pages past the end of the
+ * request are given back right away.
  * @param npages the number of pages to allocate
  * @return the address of the block
  */
@@ -361,6 +599,8 @@ page_alloc_n(uint32_t npages)
 {
         int order;
 
+        KASSERT(0 < npages);
+
         for (order = 0; order < PAGE_NSIZES; order++)
                 if ((1 << order) >= (int)npages)
                         break;
@@ -368,6 +608,8 @@ page_alloc_n(uint32_t npages)
                 panic("Implementation does not permit allocating %u pages!\n", npages);
 
         void *addr = _page_alloc_order(order);
+        if (NULL != addr)
+                _page_free_range((uintptr_t)addr, npages, 1 << order);
         GDB_CALL_HOOK(page_alloc, addr, npages);
         return addr;
 }
@@ -379,17 +621,106 @@ page_alloc_n(uint32_t npages)
 void
 page_free_n(void *start, uint32_t npages)
 {
-        int order;
-        dbg(DBG_THR,"INSIDE PAGE FREE N\n");
-        for (order = 0; order < PAGE_NSIZES; order++)
-                if ((1 << order) >= (int)npages)
-                        break;
-        if (order == PAGE_NSIZES)
-                panic("Implementation does not permit allocating %u pages!\n", npages);
+        KASSERT(0 < npages && npages <= (1U << (PAGE_NSIZES - 1)));
 
         GDB_CALL_HOOK(page_free, start, npages);
-        dbg(DBG_THR,"FREEING PAGE ORDER NOW\n");
-        _page_free_order(start, order);
+        _page_free_range((uintptr_t)start, 0, npages);
+}
+
+/*
+ * Records the owner of each page of an allocated block.
+ * @param addr the start of the block
+ * @param npages the number of pages in the block
+ * @param owner the new owner, or NULL to forget the owner
+ */
+void
+page_set_owner(void *addr, uint32_t npages, void *owner)
+{
+        struct pagegroup *group = _pagegroup_from_address((uintptr_t)addr);
+        uintptr_t index;
+
+        KASSERT(NULL != group && PAGE_ALIGNED(addr));
+        KASSERT((uintptr_t)addr + (npages << PAGE_SHIFT) <= group->pg_endaddr);
+
+        index = ((uintptr_t)addr - group->pg_baseaddr) >> PAGE_SHIFT;
+        while (npages-- > 0)
+                group->pg_owner[index++] = owner;
+}
+
+/*
+ * @param addr any address in a page from the page allocator
+ * @return the owner last recorded for the page with page_set_owner,
+ * or NULL if there is none
+ */
+void *
+page_owner(const void *addr)
+{
+        struct pagegroup *group = _pagegroup_from_address((uintptr_t)addr);
+
+        if (NULL == group)
+                return NULL;
+        return group->pg_owner[((uintptr_t)addr - group->pg_baseaddr) >> PAGE_SHIFT];
+}
+
+/*
+ * Returns the fraction of the free pages in the buddy system which are
+ * in blocks too small for an allocation of the given order, in tenths
+ * of a percent. 0 means any free page could be used for such an
+ * allocation, 1000 that none could (or that nothing is free).
+ */
+uint32_t
+page_fragmentation(int order)
+{
+        uint32_t nfree = 0, nusable = 0;
+        int i;
+
+        KASSERT(0 <= order && order < PAGE_NSIZES);
+
+        for (i = 0; i < PAGE_NSIZES; i++) {
+                nfree += page_nfree[i] << i;
+                if (i >= order)
+                        nusable += page_nfree[i] << i;
+        }
+        if (0 == nfree)
+                return 1000;
+        return (nfree - nusable) * 1000 / nfree;
+}
+
+/*
+ * @return the number of free blocks of the given order in the buddy
+ * system
+ */
+uint32_t
+page_free_blocks(int order)
+{
+        KASSERT(0 <= order && order < PAGE_NSIZES);
+        return page_nfree[order];
+}
+
+/*
+ * Prints the number of free pages, then for each block size the
+ * number of free blocks in the buddy system, the fragmentation index
+ * for that size and how many blocks of that size have been allocated
+ * and freed.
+ */
+size_t
+page_info(const void *arg, char *buf, size_t size)
+{
+        uint32_t frag;
+        int order;
+
+        iprintf(&buf, &size, "pages: %u total, %u free, %u zeroed\n",
+                page_totalcount, page_freecount, page_zeroed_count);
+        iprintf(&buf, &size, "%5s %6s %8s %7s %10s %10s\n",
+                "order", "size", "free", "frag", "allocs", "frees");
+        for (order = 0; order < PAGE_NSIZES; order++) {
+                frag = page_fragmentation(order);
+                iprintf(&buf, &size, "%5d %5uK %8u %4u.%u%% %10u %10u\n", order,
+                        (PAGE_SIZE << order) >> 10, page_nfree[order],
+                        frag / 10, frag % 10,
+                        page_nallocs[order], page_nfrees[order]);
+        }
+        return size;
 }
 
 /*
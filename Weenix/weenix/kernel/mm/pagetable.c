@@ -6,6 +6,7 @@
 #include "globals.h"
 
 #include "main/interrupt.h"
+#include "main/smp.h"
 
 #include "mm/mm.h"
 #include "mm/page.h"
@@ -41,8 +42,8 @@ struct pagedir {
 #define vaddr_to_offset(vaddr) \
         (((uint32_t)(vaddr)) & (~PAGE_MASK))
 
-/* the virtual address of the page directory in cr3 */
-static pagedir_t *current_pagedir = NULL;
+/* the virtual address of the page directory in this processor's cr3 */
+#define current_pagedir (curcpu()->cpu_pagedir)
 static pagedir_t *template_pagedir = NULL;
 
 static uint32_t phys_map_count = 1;
@@ -114,11 +115,10 @@ pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32
 
         pte_t *pt;
         if (!(PT_PRESENT & pd->pd_physical[index])) {
-                if (NULL == (pt = page_alloc())) {
+                if (NULL == (pt = page_alloc_zeroed())) {
                         return -ENOMEM;
                 } else {
                         KASSERT((pdflags & ~PAGE_MASK) == pdflags);
-                        memset(pt, 0, PAGE_SIZE);
                         pd->pd_physical[index] = pt_virt_to_phys((uintptr_t)pt) | pdflags;
                         pd->pd_virtual[index] = pt;
                 }
@@ -131,8 +131,14 @@ pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32
         index = vaddr_to_ptindex(vaddr);
 
         KASSERT((ptflags & ~PAGE_MASK) == ptflags);
+        pte_t old = pt[index];
         pt[index] = paddr | ptflags;
 
+        /* other processors may have cached the mapping being replaced */
+        if ((PT_PRESENT & old) && old != pt[index]) {
+                smp_tlb_shootdown(pd);
+        }
+
         return 0;
 }
 
@@ -148,8 +154,26 @@ pt_unmap(pagedir_t *pd, uintptr_t vaddr)
                 pte_t *pt = (pte_t *)pd->pd_virtual[index];
 
                 index = vaddr_to_ptindex(vaddr);
-                pt[index] = 0;
+                if (PT_PRESENT & pt[index]) {
+                        pt[index] = 0;
+                        smp_tlb_shootdown(pd);
+                }
+        }
+}
+
+int
+pt_is_mapped(pagedir_t *pd, uintptr_t vaddr)
+{
+        KASSERT(PAGE_ALIGNED(vaddr));
+        KASSERT(USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr);
+
+        int index = vaddr_to_pdindex(vaddr);
+
+        if (PT_PRESENT & pd->pd_physical[index]) {
+                pte_t *pt = (pte_t *)pd->pd_virtual[index];
+                return !!(PT_PRESENT & pt[vaddr_to_ptindex(vaddr)]);
         }
+        return 0;
 }
 
 void
@@ -185,6 +209,8 @@ pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh)
                         pd->pd_physical[i] = 0;
                 }
         }
+
+        smp_tlb_shootdown(pd);
 }
 
 
@@ -220,6 +246,24 @@ pt_destroy_pagedir(pagedir_t *pdir)
         page_free_n(pdir, 2);
 }
 
+pagedir_t *
+pt_template(void)
+{
+        return template_pagedir;
+}
+
+void
+pt_lowmem_map(uintptr_t paddr, int map)
+{
+        KASSERT(PAGE_ALIGNED(paddr) && USER_MEM_LOW > paddr);
+
+        /* every page directory shares the page table for the first
+         * 4mb with the template, which pt_template_init emptied */
+        pte_t *pt = (pte_t *)template_pagedir->pd_virtual[0];
+        pt[vaddr_to_ptindex(paddr)] = map ? paddr | PT_PRESENT | PT_WRITE : 0;
+        tlb_flush(paddr);
+}
+
 static void
 _pt_fault_handler(regs_t *regs)
 {
@@ -6,6 +6,8 @@
 
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/printf.h"
+#include "util/time.h"
 
 #include "mm/mmobj.h"
 #include "mm/page.h"
@@ -29,10 +31,10 @@
  *     - (3) pinned
  *
  * (1) Free pages do not contain identifiable data and are readily
- *     available for use. They are not pre-zeroed (at the moment, at least
- *     (but often times, OSs will have their equivalent of Weenix's
- *     idleproc (or another thread/process dedicated to this purpose) zero
- *     unzeroed pages on the free list when the system is otherwise idle)).
+ *     available for use. When the system is otherwise idle, sched_switch
+ *     zeroes some free pages ahead of time, and page_alloc_zeroed hands
+ *     these out so that filling a page with zeros costs nothing on the
+ *     fault path.
  *
  * (2) Allocated pages contain identifiable data.
  *
@@ -50,8 +52,8 @@
  *
  *
  * When a page is allocated or pinned:
- *     - pf_link links the page into allocated_list or pinned_list,
- *       respectively
+ *     - pf_link links the page into a list of the allocated queue or
+ *       pinned_list, respectively
  *     - pf_hlink links the page into the appropriate hash chain of the
  *       resident page hashtable
  *     - pf_olink links the page into the appropriate mmobj's list of
@@ -74,22 +76,101 @@
 static int npinned;
 static list_t pinned_list;
 
-/*     The ALLOCATED list: */
-/*       Pages on this list contain useful/actual/real data. This list is
- *       maintained in least-recently-requested (via pframe_get or
- *       pframe_get_resident) (and thus, *roughly/approximately* LRU) order.
+/*     The ALLOCATED queue: */
+/*       Pages on this queue contain useful/actual/real data. The order in
+ *       which pageoutd reclaims them depends on PF_POLICY:
+ *
+ *       PF_POLICY_LRU keeps one list in least-recently-requested (via
+ *       pframe_get or pframe_get_resident) (and thus, *roughly/approximately*
+ *       LRU) order by moving a page to the back on every request.
+ *
+ *       PF_POLICY_CLOCK keeps one list too, but a request only sets the
+ *       page's referenced bit. pageoutd gives a referenced page at the front
+ *       a second chance by clearing the bit and moving it to the back.
+ *
+ *       PF_POLICY_2Q puts a page requested for the first time on the cold
+ *       (probation) list, which is reclaimed in FIFO order whenever it holds
+ *       more than 1/PF_2Q_IN_SHARE of the pages. The identity of a page
+ *       reclaimed from it is remembered for a while, and if the page is
+ *       requested again it goes straight onto the hot list, which is
+ *       managed like CLOCK. A sequential scan then only cycles pages
+ *       through the cold list instead of flushing the whole hot list.
  */
 static int nallocated;
-static list_t alloc_list;
+
+/* An identity which 2Q remembers after reclaiming its page from the
+ * cold list. Ghosts are reused in a ring, oldest first. */
+typedef struct pframe_ghost {
+        struct mmobj       *pg_obj;
+        uint32_t            pg_pagenum;
+        list_link_t         pg_link;     /* link on hash chain of ghosts */
+} pframe_ghost_t;
+
+typedef struct pframe_queue {
+        int                 pq_policy;   /* one of PF_POLICY_* */
+        int                 pq_nhot;
+        int                 pq_ncold;
+        list_t              pq_hot;      /* the only list under LRU and CLOCK */
+        list_t              pq_cold;     /* pages on probation under 2Q */
+        uint32_t            pq_ghosthand;
+        pframe_ghost_t      pq_ghosts[PF_2Q_GHOSTS];
+        list_t              pq_ghosthash[PF_2Q_GHOSTS];
+} pframe_queue_t;
+
+static pframe_queue_t alloc_queue;
 
 static slab_allocator_t *pframe_allocator;
 
 /* Used to quickly look up pframes. ALL pages "owned by" some
  * mmobj should be in this hash
- * (object, pagenum) --> list of pframes */
-#define hash_page(obj, pagenum)  ((((uint32_t)(obj)) + (pagenum)) \
-                                  % PF_HASH_SIZE)
-static list_t pframe_hash[PF_HASH_SIZE];
+ * (object, pagenum) --> list of pframes
+ * The table doubles when it holds more than PF_HASH_LOAD pages per
+ * bucket and halves when it holds fewer than one page for every two
+ * buckets, so chains stay short however many pages are cached. Its
+ * smallest size is the static pframe_hash_min. */
+#define hash_identity(obj, pagenum) ((((uint32_t)(obj)) >> 4) \
+                                     ^ ((uint32_t)(pagenum) * 0x9e3779b1))
+#define hash_page(obj, pagenum)  (hash_identity(obj, pagenum) & (pframe_hash_size - 1))
+#define hash_ghost(obj, pagenum) (hash_identity(obj, pagenum) & (PF_2Q_GHOSTS - 1))
+static list_t pframe_hash_min[PF_HASH_MIN_SIZE];
+static list_t *pframe_hash = pframe_hash_min;
+static uint32_t pframe_hash_size = PF_HASH_MIN_SIZE;
+static uint32_t pframe_hash_count = 0;
+
+/*     The DIRTY lists: */
+/*       Every dirty page is also on dirty_list, in the order in which the
+ *       pages became dirty, so flushd finds the pages which have been
+ *       dirty for longest at its head. It is also on its object's
+ *       mmo_dirtypages, and every object with dirty pages is on
+ *       dirty_objs, so that sync(2) and the cleaning of a single object
+ *       only ever look at dirty pages.
+ */
+static int ndirty;
+static list_t dirty_list;
+static list_t dirty_objs;
+
+/* Writeback statistics: the number of cleanpage and cleanpages calls
+ * and the number of pages they wrote, whose ratio is the average
+ * cluster size. */
+static uint32_t pframe_nwrites = 0;
+static uint32_t pframe_nwritten = 0;
+
+/* Read-ahead requests waiting for readaheadd, in a ring. Each holds a
+ * reference on its object until readaheadd is done with it. */
+typedef struct pframe_ra {
+        mmobj_t            *ra_obj;
+        uint32_t            ra_pagenum;
+        uint32_t            ra_npages;
+} pframe_ra_t;
+
+static pframe_ra_t ra_queue[PF_READAHEAD_QUEUE];
+static int ra_head = 0;
+static int ra_count = 0;
+
+/* Read-ahead statistics: pages read ahead, and requests dropped because
+ * the queue was full */
+static uint32_t pframe_nreadahead = 0;
+static uint32_t pframe_nradropped = 0;
 
 /* Related to the Pageout daemon: */
 
@@ -101,17 +182,296 @@ static proc_t *pageoutd = NULL;
 static kthread_t *pageoutd_thr = NULL;
 static ktqueue_t pageoutd_waitq;
 
-/* threads waiting for pageoutd to run sleep on this queue */
+/* pframe_get sleeps on this queue with sched_sleep_on_exclusive when
+ * no page can be allocated. Each freed page satisfies one waiter, so
+ * pageoutd wakes one per page it freed, or all of them if it freed
+ * none so that they can give up. (pframe_get is not written yet in
+ * this tree, so nothing sleeps here until it is.) Threads waiting for a
+ * busy page sleep on its pf_waitq as shared waiters, since each of them
+ * only re-checks the page, and are woken with sched_broadcast_on. */
 static ktqueue_t alloc_waitq;
 
+static int _pframe_clean(pframe_t *pf);
+
 /* Pageout daemon functions */
 static void *pageoutd_run(int arg1, void *arg2);
 static void pageoutd_exit(void);
+/* Flush daemon functions */
+static proc_t *flushd = NULL;
+static kthread_t *flushd_thr = NULL;
+static ktqueue_t flushd_waitq;
+static void *flushd_run(int arg1, void *arg2);
+static void flushd_exit(void);
+/* Read-ahead daemon functions */
+static proc_t *readaheadd = NULL;
+static kthread_t *readaheadd_thr = NULL;
+static ktqueue_t readaheadd_waitq;
+static void *readaheadd_run(int arg1, void *arg2);
+static void readaheadd_exit(void);
 #define pageoutd_wakeup()        (sched_broadcast_on(&pageoutd_waitq))
+/* free memory is fragmented if almost none of it is in blocks big
+ * enough for an allocation of PAGEOUTD_FRAG_ORDER. Freeing more pages
+ * gives their buddies a chance to coalesce, so pageoutd then runs even
+ * with plenty of pages free. Its usual target may already be met, so
+ * it frees PAGEOUTD_FRAG_BATCH pages past what was free when it woke. */
+#define pageoutd_fragmented()    \
+	(page_fragmentation(PAGEOUTD_FRAG_ORDER) >= PAGEOUTD_FRAG_MAX)
 #define pageoutd_needed()        \
-	((page_free_count() <= nfreepages_min) && (!list_empty(&alloc_list)))
-#define pageoutd_target_met()    (page_free_count() >= nfreepages_target)
+	((page_free_count() <= nfreepages_min || pageoutd_fragmented()) \
+	 && (nallocated > 0))
+#define pageoutd_target()        \
+	(pageoutd_fragmented() \
+	 ? MAX(nfreepages_target, page_free_count() + PAGEOUTD_FRAG_BATCH) \
+	 : nfreepages_target)
+
+
+static void
+pframe_queue_init(pframe_queue_t *pq, int policy)
+{
+        uint32_t i;
+
+        pq->pq_policy = policy;
+        pq->pq_nhot = 0;
+        pq->pq_ncold = 0;
+        list_init(&pq->pq_hot);
+        list_init(&pq->pq_cold);
+        pq->pq_ghosthand = 0;
+        for (i = 0; i < PF_2Q_GHOSTS; ++i) {
+                pq->pq_ghosts[i].pg_obj = NULL;
+                list_link_init(&pq->pq_ghosts[i].pg_link);
+                list_init(&pq->pq_ghosthash[i]);
+        }
+}
+
+/* Forgets the ghost of the given page if there is one. Returns 1 if the
+ * page was reclaimed from the cold list recently, 0 otherwise. */
+static int
+pframe_ghost_find(pframe_queue_t *pq, mmobj_t *o, uint32_t pagenum)
+{
+        pframe_ghost_t *pg;
+
+        list_iterate_begin(&pq->pq_ghosthash[hash_ghost(o, pagenum)], pg, pframe_ghost_t, pg_link) {
+                if ((o == pg->pg_obj) && (pagenum == pg->pg_pagenum)) {
+                        list_remove(&pg->pg_link);
+                        pg->pg_obj = NULL;
+                        return 1;
+                }
+        } list_iterate_end();
+        return 0;
+}
+
+static void
+pframe_ghost_add(pframe_queue_t *pq, pframe_t *pf)
+{
+        pframe_ghost_t *pg = &pq->pq_ghosts[pq->pq_ghosthand];
+
+        pq->pq_ghosthand = (pq->pq_ghosthand + 1) & (PF_2Q_GHOSTS - 1);
+        if (list_link_is_linked(&pg->pg_link))
+                list_remove(&pg->pg_link);
+        pg->pg_obj = pf->pf_obj;
+        pg->pg_pagenum = pf->pf_pagenum;
+        list_insert_head(&pq->pq_ghosthash[hash_ghost(pf->pf_obj, pf->pf_pagenum)], &pg->pg_link);
+}
+
+/* Queues a page which was just given its identity. */
+static void
+pframe_queue_insert(pframe_queue_t *pq, pframe_t *pf)
+{
+        if ((PF_POLICY_2Q == pq->pq_policy)
+            && !pframe_ghost_find(pq, pf->pf_obj, pf->pf_pagenum)) {
+                pframe_clear_hot(pf);
+                pq->pq_ncold++;
+                list_insert_tail(&pq->pq_cold, &pf->pf_link);
+        } else {
+                pframe_set_hot(pf);
+                pq->pq_nhot++;
+                list_insert_tail(&pq->pq_hot, &pf->pf_link);
+        }
+}
+
+static void
+pframe_queue_remove(pframe_queue_t *pq, pframe_t *pf)
+{
+        if (pframe_is_hot(pf))
+                pq->pq_nhot--;
+        else
+                pq->pq_ncold--;
+        list_remove(&pf->pf_link);
+}
+
+/* Records a request for a queued page. Only LRU touches the list; 2Q
+ * ignores the referenced bit of pages on the cold list, so that a page
+ * requested a few times in a row by one scan still leaves with it. */
+static void
+pframe_queue_hit(pframe_queue_t *pq, pframe_t *pf)
+{
+        if (PF_POLICY_LRU == pq->pq_policy) {
+                list_remove(&pf->pf_link);
+                list_insert_tail(&pq->pq_hot, &pf->pf_link);
+        } else {
+                pframe_set_referenced(pf);
+        }
+}
+
+/* Returns the page that should be reclaimed next without dequeueing it,
+ * or NULL if the queue is empty. */
+static pframe_t *
+pframe_queue_victim(pframe_queue_t *pq)
+{
+        pframe_t *pf;
+
+        if ((pq->pq_ncold > 0)
+            && ((0 == pq->pq_nhot)
+                || (pq->pq_ncold > (pq->pq_ncold + pq->pq_nhot) / PF_2Q_IN_SHARE)))
+                return list_head(&pq->pq_cold, pframe_t, pf_link);
+
+        while (!list_empty(&pq->pq_hot)) {
+                pf = list_head(&pq->pq_hot, pframe_t, pf_link);
+                if (!pframe_is_referenced(pf))
+                        return pf;
+                pframe_clear_referenced(pf);
+                list_remove(&pf->pf_link);
+                list_insert_tail(&pq->pq_hot, &pf->pf_link);
+        }
+        return NULL;
+}
+
+/* Called on the victim just before it is reclaimed. */
+static void
+pframe_queue_evicted(pframe_queue_t *pq, pframe_t *pf)
+{
+        if (!pframe_is_hot(pf))
+                pframe_ghost_add(pq, pf);
+}
+
+/* Adds a dirty page to its object's dirty list, and the object to
+ * dirty_objs if this is its first dirty page. */
+static void
+pframe_obj_dirty(pframe_t *pf)
+{
+        mmobj_t *o = pf->pf_obj;
+
+        list_insert_tail(&o->mmo_dirtypages, &pf->pf_odlink);
+        if (0 == o->mmo_ndirty++)
+                list_insert_tail(&dirty_objs, &o->mmo_dlink);
+}
+
+static void
+pframe_obj_undirty(pframe_t *pf)
+{
+        mmobj_t *o = pf->pf_obj;
+
+        list_remove(&pf->pf_odlink);
+        if (0 == --o->mmo_ndirty)
+                list_remove(&o->mmo_dlink);
+}
+
+/* Sets the dirty bit of a page and puts it at the back of the dirty lists,
+ * stamped with the current time. */
+static void
+pframe_mark_dirty(pframe_t *pf)
+{
+        if (pframe_is_dirty(pf))
+                return;
+        pframe_set_dirty(pf);
+        pf->pf_dirtied = time_ticks();
+        ndirty++;
+        list_insert_tail(&dirty_list, &pf->pf_dlink);
+        pframe_obj_dirty(pf);
+}
 
+static void
+pframe_mark_clean(pframe_t *pf)
+{
+        KASSERT(pframe_is_dirty(pf));
+        pframe_clear_dirty(pf);
+        ndirty--;
+        list_remove(&pf->pf_dlink);
+        pframe_obj_undirty(pf);
+}
+
+/* Moves the contents of one list to another, empty, one. */
+static void
+pframe_list_move(list_t *from, list_t *to)
+{
+        list_init(to);
+        if (!list_empty(from)) {
+                to->l_next = from->l_next;
+                to->l_prev = from->l_prev;
+                to->l_next->l_prev = to;
+                to->l_prev->l_next = to;
+                list_init(from);
+        }
+}
+
+#define dirty_pagenum(link) ((list_item(link, pframe_t, pf_odlink))->pf_pagenum)
+
+/* Sorts a list of pages linked by pf_odlink by page number. This is a
+ * merge sort of runs of doubling length, so it takes O(n log n) time
+ * and no extra memory. The list is treated as singly linked while it is
+ * sorted and the l_prev pointers are fixed up afterwards. */
+static void
+pframe_sort_dirty(list_t *list)
+{
+        list_link_t *head, *tail, *p, *q, *e, *prev;
+        int insize, nmerges, psize, qsize;
+
+        if (list_empty(list))
+                return;
+        head = list->l_next;
+        list->l_prev->l_next = NULL;
+
+        for (insize = 1;; insize <<= 1) {
+                p = head;
+                head = tail = NULL;
+                nmerges = 0;
+                while (NULL != p) {
+                        nmerges++;
+                        q = p;
+                        for (psize = 0; (psize < insize) && (NULL != q); ++psize)
+                                q = q->l_next;
+                        qsize = insize;
+                        while ((psize > 0) || ((qsize > 0) && (NULL != q))) {
+                                if ((0 == psize)
+                                    || ((qsize > 0) && (NULL != q)
+                                        && (dirty_pagenum(q) < dirty_pagenum(p)))) {
+                                        e = q;
+                                        q = q->l_next;
+                                        qsize--;
+                                } else {
+                                        e = p;
+                                        p = p->l_next;
+                                        psize--;
+                                }
+                                if (NULL != tail)
+                                        tail->l_next = e;
+                                else
+                                        head = e;
+                                tail = e;
+                        }
+                        p = q;
+                }
+                tail->l_next = NULL;
+                if (nmerges <= 1)
+                        break;
+        }
+
+        prev = list;
+        for (e = head; NULL != e; e = e->l_next) {
+                e->l_prev = prev;
+                prev = e;
+        }
+        prev->l_next = list;
+        list->l_next = head;
+        list->l_prev = prev;
+}
+
+/* Free pframes keep their wait queue initialized. */
+static void
+pframe_ctor(void *obj)
+{
+        sched_queue_init(&((pframe_t *) obj)->pf_waitq);
+}
 
 /*
  * Initialize the pinned and allocated counts and lists. Then, make a pframe
@@ -126,15 +486,19 @@ pframe_init(void)
         npinned = 0;
         list_init(&pinned_list);
         nallocated = 0;
-        list_init(&alloc_list);
+        pframe_queue_init(&alloc_queue, PF_POLICY);
+        ndirty = 0;
+        list_init(&dirty_list);
+        list_init(&dirty_objs);
 
-        pframe_allocator = slab_allocator_create("pframe", sizeof(pframe_t));
+        pframe_allocator = slab_allocator_create_ctor("pframe", sizeof(pframe_t),
+                                                      pframe_ctor, NULL);
         KASSERT(NULL != pframe_allocator);
 
         /* initialize pframe_hash: */
         int i;
-        for (i = 0; i < PF_HASH_SIZE; ++i)
-                list_init(&pframe_hash[i]);
+        for (i = 0; i < PF_HASH_MIN_SIZE; ++i)
+                list_init(&pframe_hash_min[i]);
 
         /* initialize pageout parameters: */
         nfreepages_target = page_free_count() >> 1;
@@ -149,12 +513,17 @@ pframe_shutdown()
 {
         KASSERT(PID_IDLE == curproc->p_pid); /* Should call from idleproc */
 
-        /* Stop pageoutd and wait for it */
+        /* Stop the daemons and wait for them */
+        pframe_readahead_shutdown();
         pageoutd_exit();
+        flushd_exit();
 
         int pid = pageoutd->p_pid;
-        int child = do_waitpid(-1, 0, NULL);
+        int child = do_waitpid(pid, 0, NULL);
         KASSERT(pid == child && "waited on process other than pageoutd");
+        pid = flushd->p_pid;
+        child = do_waitpid(pid, 0, NULL);
+        KASSERT(pid == child && "waited on process other than flushd");
         KASSERT(0 == npinned && "WARNING: FOUND PINNED "
                 "PAGES!!!!!!!!!! SOMETHING IS BROKEN!!\n");
 
@@ -163,12 +532,187 @@ pframe_shutdown()
 
         /* Free all pages */
         pframe_t *pf;
-        list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
+        while (NULL != (pf = pframe_queue_victim(&alloc_queue))) {
                 KASSERT(!pframe_is_dirty(pf));
                 KASSERT(!pframe_is_busy(pf));
                 KASSERT(!pframe_is_pinned(pf));
                 pframe_free(pf);
+        }
+}
+
+/*
+ * Moves every page in the resident page hash into a table with the
+ * given number of buckets. If there is not enough memory for the new
+ * table the old one is kept, which only makes its chains longer.
+ */
+static void
+pframe_hash_resize(uint32_t size)
+{
+        list_t *old = pframe_hash;
+        uint32_t oldsize = pframe_hash_size;
+        list_t *table;
+        pframe_t *pf;
+        uint32_t i;
+
+        if (PF_HASH_MIN_SIZE == size) {
+                table = pframe_hash_min;
+        } else if (NULL == (table = kmalloc(size * sizeof(list_t)))) {
+                dbg(DBG_PFRAME, "WARNING: not enough memory to grow the page hash\n");
+                return;
+        }
+        for (i = 0; i < size; ++i)
+                list_init(&table[i]);
+
+        pframe_hash = table;
+        pframe_hash_size = size;
+        for (i = 0; i < oldsize; ++i) {
+                list_iterate_begin(&old[i], pf, pframe_t, pf_hlink) {
+                        list_remove(&pf->pf_hlink);
+                        list_insert_head(&pframe_hash[hash_page(pf->pf_obj, pf->pf_pagenum)],
+                                         &pf->pf_hlink);
+                } list_iterate_end();
+        }
+
+        if (pframe_hash_min != old)
+                kfree(old);
+        dbg(DBG_PFRAME, "page hash resized from %u to %u buckets for %u pages\n",
+            oldsize, size, pframe_hash_count);
+}
+
+static void
+pframe_hash_insert(pframe_t *pf)
+{
+        list_insert_head(&pframe_hash[hash_page(pf->pf_obj, pf->pf_pagenum)], &pf->pf_hlink);
+        if (++pframe_hash_count > pframe_hash_size * PF_HASH_LOAD
+            && PF_HASH_MAX_SIZE > pframe_hash_size)
+                pframe_hash_resize(pframe_hash_size << 1);
+}
+
+static void
+pframe_hash_remove(pframe_t *pf)
+{
+        list_remove(&pf->pf_hlink);
+        if (--pframe_hash_count < (pframe_hash_size >> 1)
+            && PF_HASH_MIN_SIZE < pframe_hash_size)
+                pframe_hash_resize(pframe_hash_size >> 1);
+}
+
+/* Looks a page up in the resident page hash without counting it as a
+ * request for the page, or returns NULL if it is not resident. */
+static pframe_t *
+pframe_hash_find(mmobj_t *o, uint32_t pagenum)
+{
+        pframe_t *pf;
+
+        list_iterate_begin(&pframe_hash[hash_page(o, pagenum)], pf, pframe_t, pf_hlink) {
+                if ((o == pf->pf_obj) && (pagenum == pf->pf_pagenum))
+                        return pf;
         } list_iterate_end();
+        return NULL;
+}
+
+/*
+ * Prints the size of the resident page hash, the number of pages in
+ * it and the length of its longest chain.
+ */
+size_t
+pframe_hash_info(const void *arg, char *buf, size_t size)
+{
+        uint32_t i, len, maxlen = 0, nused = 0;
+        list_link_t *link;
+
+        for (i = 0; i < pframe_hash_size; ++i) {
+                len = 0;
+                for (link = pframe_hash[i].l_next; link != &pframe_hash[i]; link = link->l_next)
+                        ++len;
+                if (len > 0)
+                        ++nused;
+                if (len > maxlen)
+                        maxlen = len;
+        }
+        iprintf(&buf, &size, "page hash: %u pages in %u buckets (%u used), longest chain %u\n",
+                pframe_hash_count, pframe_hash_size, nused, maxlen);
+        return size;
+}
+
+/*
+ * Prints the number of allocated, pinned and dirty pages, how many pages
+ * each writeback wrote on average and how many pages were read ahead.
+ */
+size_t
+pframe_info(const void *arg, char *buf, size_t size)
+{
+        uint32_t avg10 = pframe_nwrites ? pframe_nwritten * 10 / pframe_nwrites : 0;
+
+        iprintf(&buf, &size, "pframes: %d allocated, %d pinned, %d dirty\n",
+                nallocated, npinned, ndirty);
+        iprintf(&buf, &size, "writeback: %u pages in %u writes, %u.%u pages per write\n",
+                pframe_nwritten, pframe_nwrites, avg10 / 10, avg10 % 10);
+        iprintf(&buf, &size, "readahead: %u pages, %u requests dropped\n",
+                pframe_nreadahead, pframe_nradropped);
+        return size;
+}
+
+/*
+ * Replays a trace of page numbers through a cache of nframes pages managed
+ * by the given replacement policy, and returns how many of the references
+ * hit, or -ENOMEM. No page frames are involved, so every policy can be
+ * compared on the same trace whichever one pageoutd is built with.
+ */
+int
+pframe_replay(int policy, const uint32_t *trace, int ntrace, int nframes)
+{
+        pframe_queue_t *pq;
+        pframe_t *frames, *pf, **resident;
+        uint32_t maxpage = 0;
+        int i, nused = 0, hits = 0;
+
+        KASSERT(0 <= policy && PF_NPOLICIES > policy);
+        KASSERT(0 < nframes);
+
+        for (i = 0; i < ntrace; ++i)
+                if (trace[i] > maxpage)
+                        maxpage = trace[i];
+
+        if (NULL == (pq = kmalloc(sizeof(*pq))))
+                return -ENOMEM;
+        if (NULL == (frames = kmalloc(nframes * sizeof(*frames)))) {
+                kfree(pq);
+                return -ENOMEM;
+        }
+        if (NULL == (resident = kmalloc((maxpage + 1) * sizeof(*resident)))) {
+                kfree(frames);
+                kfree(pq);
+                return -ENOMEM;
+        }
+        memset(resident, 0, (maxpage + 1) * sizeof(*resident));
+        pframe_queue_init(pq, policy);
+
+        for (i = 0; i < ntrace; ++i) {
+                if (NULL != (pf = resident[trace[i]])) {
+                        hits++;
+                        pframe_queue_hit(pq, pf);
+                        continue;
+                }
+                if (nused < nframes) {
+                        pf = &frames[nused++];
+                } else {
+                        pf = pframe_queue_victim(pq);
+                        pframe_queue_evicted(pq, pf);
+                        pframe_queue_remove(pq, pf);
+                        resident[pf->pf_pagenum] = NULL;
+                }
+                pf->pf_obj = (mmobj_t *) pq;
+                pf->pf_pagenum = trace[i];
+                pf->pf_flags = 0;
+                resident[trace[i]] = pf;
+                pframe_queue_insert(pq, pf);
+        }
+
+        kfree(resident);
+        kfree(frames);
+        kfree(pq);
+        return hits;
 }
 
 /*
@@ -189,25 +733,27 @@ pframe_shutdown()
 pframe_t *
 pframe_get_resident(struct mmobj *o, uint32_t pagenum)
 {
-        list_t *hashchain;
         pframe_t *pf;
 
-        hashchain = &pframe_hash[hash_page(o, pagenum)];
-        list_iterate_begin(hashchain, pf, pframe_t, pf_hlink) {
-                if ((o == pf->pf_obj) && (pagenum == pf->pf_pagenum)) {
-                        /* found a page with the specified identity. It is
-                         * up to the caller to recognize/care if the page
-                         * is busy. */
-                        if (!pframe_is_pinned(pf)) {
-                                /* send to back of alloc_list */
-                                list_remove(&pf->pf_link);
-                                list_insert_tail(&alloc_list, &pf->pf_link);
-                        }
-                        return pf;
-                }
-        } list_iterate_end();
+        if (NULL != (pf = pframe_hash_find(o, pagenum))) {
+                /* found a page with the specified identity. It is
+                 * up to the caller to recognize/care if the page
+                 * is busy. */
+                if (!pframe_is_pinned(pf))
+                        pframe_queue_hit(&alloc_queue, pf);
+        }
+        return pf;
+}
 
-        return NULL;
+/*
+ * Like pframe_get_resident, but does not count as a use of the page, so
+ * the replacement policy does not see it as recently referenced. For
+ * callers which only look at pages speculatively, such as fault-around.
+ */
+pframe_t *
+pframe_peek_resident(struct mmobj *o, uint32_t pagenum)
+{
+        return pframe_hash_find(o, pagenum);
 }
 
 /*
@@ -237,16 +783,16 @@ pframe_alloc(mmobj_t *o, uint32_t pagenum)
                 return NULL;
         }
 
-        nallocated++;
-        list_insert_tail(&alloc_list, &pf->pf_link);
-
         pf->pf_obj = o;
         pf->pf_pagenum = pagenum;
         pf->pf_flags = 0;
-        sched_queue_init(&pf->pf_waitq);
+        KASSERT(sched_queue_empty(&pf->pf_waitq));
         pf->pf_pincount = 0;
 
-        list_insert_head(&pframe_hash[hash_page(o, pagenum)], &pf->pf_hlink);
+        nallocated++;
+        pframe_queue_insert(&alloc_queue, pf);
+
+        pframe_hash_insert(pf);
 
         o->mmo_ops->ref(o);
         o->mmo_nrespages++;
@@ -281,6 +827,10 @@ pframe_fill(pframe_t *pf)
  * case this routine may block). After allocating the new pframe, we check to
  * see if we need to call pageoutd and wake it up if necessary.
  *
+ * If no page frame can be allocated, wake pageoutd and sleep on alloc_waitq
+ * with sched_sleep_on_exclusive, then try once more; give up with -ENOMEM
+ * if there is still no free page.
+ *
  * If the page is found (resident) but busy, then we will wait for it to become
  * unbusy and then try again (since it may have been freed after that). Thus,
  * as long as this routine returns successfully, the returned page will be a
@@ -329,12 +879,16 @@ pframe_migrate(pframe_t *pf, mmobj_t *dest)
                 pframe_free(pf);
         } else {
                 mmobj_t *src = pf->pf_obj;
-                pf->pf_obj = dest;
                 list_remove(&pf->pf_hlink);
+                if (pframe_is_dirty(pf))
+                        pframe_obj_undirty(pf);
+                pf->pf_obj = dest;
+                if (pframe_is_dirty(pf))
+                        pframe_obj_dirty(pf);
+                list_insert_head(&pframe_hash[hash_page(dest, pf->pf_pagenum)], &pf->pf_hlink);
                 list_remove(&pf->pf_olink);
                 src->mmo_nrespages--;
                 src->mmo_ops->put(src);
-                list_insert_head(&pframe_hash[hash_page(dest, pf->pf_pagenum)], &pf->pf_hlink);
                 list_insert_head(&dest->mmo_respages, &pf->pf_olink);
                 dest->mmo_nrespages++;
                 dest->mmo_ops->ref(dest);
@@ -346,9 +900,10 @@ pframe_migrate(pframe_t *pf, mmobj_t *dest)
  * paged out by pageoutd, so this ensures that the page will remain resident
  * until the pin count is decreased.
  *
- * If the pframe has not yet been pinned, remove this pframe's list link from
- * the allocated list and add it to the pinned list.  Be sure to decrement
- * nallocated and increment npinned.
+ * If the pframe has not yet been pinned, remove it from the allocated queue
+ * (pframe_queue_remove) and add it to the pinned list.  Be sure to decrement
+ * nallocated and increment npinned. pframe_queue_remove leaves PF_HOT alone,
+ * so the page remembers where in the queue it belongs.
  *
  * In either case, increment the pf_pincount.
  *
@@ -364,9 +919,11 @@ pframe_pin(pframe_t *pf)
  * Decreases the pin count on a page. If the pin count reaches zero, then the
  * page could be paged out any time after the calling context blocks.
  *
- * If the pin count reaches zero, move the pframe's list link from the pinned
- * list to the allocated list.  Be sure to correctly update npinned and
- * nallocated
+ * If the pin count reaches zero, move the pframe from the pinned list back
+ * to the tail of the allocated queue's hot or cold list, whichever PF_HOT
+ * says, and count it in pq_nhot or pq_ncold. Do not use pframe_queue_insert,
+ * which is for new pages and would put a hot page back on probation. Be sure
+ * to correctly update npinned and nallocated
  *
  * @param pf a pinned page (a page with a positive pin count)
  */
@@ -398,7 +955,7 @@ pframe_dirty(pframe_t *pf)
         pframe_set_busy(pf);
 
         if (!(ret = pf->pf_obj->mmo_ops->dirtypage(pf->pf_obj, pf))) {
-                pframe_set_dirty(pf);
+                pframe_mark_dirty(pf);
         }
         pframe_clear_busy(pf);
         sched_broadcast_on(&pf->pf_waitq);
@@ -418,10 +975,38 @@ pframe_dirty(pframe_t *pf)
 int
 pframe_clean(pframe_t *pf)
 {
+        KASSERT(pf->pf_pincount == 0 && "Cleaning a pinned page!");
+        return _pframe_clean(pf);
+}
+
+/*
+ * Wait for a page to be idle and write it back if it is dirty. Unlike
+ * pframe_clean, the page may be pinned, so this is only for objects whose
+ * pages have somewhere to go even while they are pinned, like the metadata
+ * blocks a file system keeps pinned. The caller must keep the page
+ * resident while this blocks, e.g. by pinning it.
+ *
+ * This routine can block at the mmobj operation level.
+ * @param pf the page to write back
+ * @return 0 on success, -errno on failure
+ */
+int
+pframe_sync(pframe_t *pf)
+{
+        while (pframe_is_busy(pf))
+                sched_sleep_on(&pf->pf_waitq);
+        if (!pframe_is_dirty(pf))
+                return 0;
+        return _pframe_clean(pf);
+}
+
+static int
+_pframe_clean(pframe_t *pf)
+{
+        uint32_t dirtied = pf->pf_dirtied;
         int ret;
 
         KASSERT(pframe_is_dirty(pf) && "Cleaning page that isn't dirty!");
-        KASSERT(pf->pf_pincount == 0 && "Cleaning a pinned page!");
 
         dbg(DBG_PFRAME, "cleaning page %d of obj %p\n", pf->pf_pagenum, pf->pf_obj);
 
@@ -431,7 +1016,7 @@ pframe_clean(pframe_t *pf)
          * that if the page is dirtied again while we're writing it out,
          * we won't (incorrectly) think the page has been fully cleaned.
          */
-        pframe_clear_dirty(pf);
+        pframe_mark_clean(pf);
 
         /* Make sure a future write to the page will fault (and hence dirty it) */
         tlb_flush((uintptr_t) pf->pf_addr);
@@ -439,14 +1024,96 @@ pframe_clean(pframe_t *pf)
 
         pframe_set_busy(pf);
         if ((ret = pf->pf_obj->mmo_ops->cleanpage(pf->pf_obj, pf)) < 0) {
-                pframe_set_dirty(pf);
+                /* it has been dirty since it was first dirtied, see
+                 * pframe_clean_obj */
+                pframe_mark_dirty(pf);
+                pf->pf_dirtied = dirtied;
         }
         pframe_clear_busy(pf);
         sched_broadcast_on(&pf->pf_waitq);
 
+        pframe_nwrites++;
+        pframe_nwritten++;
         return ret;
 }
 
+/* A neighbor can be cleaned along with a page if it is resident, dirty,
+ * idle and unpinned. */
+static int
+pframe_clusterable(mmobj_t *o, uint32_t pagenum)
+{
+        pframe_t *pf = pframe_hash_find(o, pagenum);
+
+        return (NULL != pf) && pframe_is_dirty(pf) && !pframe_is_busy(pf)
+               && !pframe_is_pinned(pf);
+}
+
+/*
+ * Clean a dirty page together with the run of dirty pages with
+ * consecutive page numbers around it in the same object, up to
+ * PF_CLUSTER_MAX pages in all, using the object's cleanpages entry
+ * point so that they are written in ascending order with one request.
+ * If the object has no such entry point, or no neighbor is dirty, this
+ * is the same as pframe_clean.
+ * The page must be dirty but unpinned.
+ *
+ * This routine can block at the mmobj operation level.
+ * @param pf the page to clean
+ * @return the number of pages written on success, -errno on failure
+ */
+int
+pframe_clean_cluster(pframe_t *pf)
+{
+        mmobj_t *o = pf->pf_obj;
+        pframe_t *cluster[PF_CLUSTER_MAX];
+        uint32_t dirtied[PF_CLUSTER_MAX];
+        uint32_t first, last;
+        int i, n, ret;
+
+        KASSERT(pframe_is_dirty(pf) && "Cleaning page that isn't dirty!");
+        KASSERT(pf->pf_pincount == 0 && "Cleaning a pinned page!");
+
+        first = last = pf->pf_pagenum;
+        if (NULL != o->mmo_ops->cleanpages) {
+                while ((last - first + 1 < PF_CLUSTER_MAX) && (first > 0)
+                       && pframe_clusterable(o, first - 1))
+                        first--;
+                while ((last - first + 1 < PF_CLUSTER_MAX)
+                       && pframe_clusterable(o, last + 1))
+                        last++;
+        }
+        if (first == last)
+                return ((ret = pframe_clean(pf)) < 0) ? ret : 1;
+
+        n = last - first + 1;
+        dbg(DBG_PFRAME, "cleaning pages %u-%u of obj %p\n", first, last, o);
+
+        /* See pframe_clean for why each page is marked clean before
+         * we block and is removed from the page tables */
+        for (i = 0; i < n; ++i) {
+                cluster[i] = pframe_hash_find(o, first + i);
+                dirtied[i] = cluster[i]->pf_dirtied;
+                pframe_mark_clean(cluster[i]);
+                tlb_flush((uintptr_t) cluster[i]->pf_addr);
+                pframe_remove_from_pts(cluster[i]);
+                pframe_set_busy(cluster[i]);
+        }
+
+        ret = o->mmo_ops->cleanpages(o, cluster, n);
+        for (i = 0; i < n; ++i) {
+                if (ret < 0) {
+                        pframe_mark_dirty(cluster[i]);
+                        cluster[i]->pf_dirtied = dirtied[i];
+                }
+                pframe_clear_busy(cluster[i]);
+                sched_broadcast_on(&cluster[i]->pf_waitq);
+        }
+
+        pframe_nwrites++;
+        pframe_nwritten += n;
+        return (ret < 0) ? ret : n;
+}
+
 /*
  * Deallocates a pframe (reclaims the page frame for use by something else).
  * The page should not be pinned, free, or busy. Note that if the page is dirty
@@ -472,11 +1139,13 @@ pframe_free(pframe_t *pf)
         /* Remove from all pagetables that map it */
         pframe_remove_from_pts(pf);
 
-        list_remove(&pf->pf_hlink);
+        pframe_hash_remove(pf);
+        if (pframe_is_dirty(pf))
+                pframe_mark_clean(pf);
 
         pf->pf_obj = NULL;
         nallocated--;
-        list_remove(&pf->pf_link);
+        pframe_queue_remove(&alloc_queue, pf);
 
         page_free(pf->pf_addr);
         slab_obj_free(pframe_allocator, pf);
@@ -491,40 +1160,99 @@ pframe_free(pframe_t *pf)
 }
 
 /*
- * Clean all allocated pages (that is, all pages that are not pinned and
- * not free). This is called by sync(2).
+ * Clean every dirty page of an object once, in ascending page order, so
+ * that runs of neighbors are written back together and a block device
+ * sees its blocks in order. Pages dirtied while this runs are left for
+ * later, so it always terminates. Pinned pages cannot be cleaned and
+ * are skipped.
+ *
+ * Another thread, such as flushd, may take a page off our list by
+ * starting to write it itself. So before returning we wait until no
+ * page is busy and clean again any page which has been dirty since
+ * before we started, whose write failed. Everything which was dirty
+ * when this was called is then on disk, which fsync(2) relies on.
+ *
+ * This routine can block at the mmobj operation level.
+ * @param o the object to clean
+ * @return 0 on success, or the last error a writeback returned
  */
-void
-pframe_clean_all()
+int
+pframe_clean_obj(mmobj_t *o)
 {
+        list_t todo;
         pframe_t *pf;
-        dbg(DBG_PFRAME, "pframe_clean_all: starting (this may take a while)\n");
+        uint32_t start = time_ticks();
+        int err, ret = 0;
 
-        /*
-         * Iterate from head of alloc_list to tail; This is a rough attempt to
-         * sync from least active to most active. Note that every time we block we
-         * need to start the loop over as the "current element" pf may have been
-         * moved or removed in the meantime (our list has no multithreaded
-         * integrity)
-         */
-list_start:
-        list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
-                KASSERT(!pframe_is_pinned(pf));
-                KASSERT(!pframe_is_free(pf));
+        /* the pages might all be freed while we block */
+        o->mmo_ops->ref(o);
+
+        pframe_sort_dirty(&o->mmo_dirtypages);
+        pframe_list_move(&o->mmo_dirtypages, &todo);
+        while (!list_empty(&todo)) {
+                pf = list_head(&todo, pframe_t, pf_odlink);
                 if (pframe_is_busy(pf)) {
+                        /* it leaves todo if it is cleaned meanwhile */
                         sched_sleep_on(&pf->pf_waitq);
-                        goto list_start;
+                        continue;
                 }
-                if (pframe_is_dirty(pf)) {
-                        pframe_clean(pf);
-                        goto list_start;
+                /* back on the object's list, where a page which stays
+                 * dirty belongs */
+                list_remove(&pf->pf_odlink);
+                list_insert_tail(&o->mmo_dirtypages, &pf->pf_odlink);
+                if (!pframe_is_pinned(pf) && (err = pframe_clean_cluster(pf)) < 0)
+                        ret = err;
+        }
+
+wait:
+        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                if (pframe_is_busy(pf)) {
+                        sched_sleep_on(&pf->pf_waitq);
+                        goto wait;
+                }
+                if (pframe_is_dirty(pf) && !pframe_is_pinned(pf)
+                    && (int32_t)(pf->pf_dirtied - start) <= 0) {
+                        /* give up if it fails again rather than retry
+                         * forever */
+                        if ((err = pframe_clean_cluster(pf)) < 0) {
+                                ret = err;
+                                goto done;
+                        }
+                        goto wait;
                 }
         } list_iterate_end();
 
-        /* In theory, this function might never terminate (if new pages are
-         * constantly being added at the same time). That's why the user shouldn't
-         * call sync(2) very much... */
-        dbg(DBG_PFRAME, "pframe_clean_all: completed!\n");
+done:
+        o->mmo_ops->put(o);
+        return ret;
+}
+
+/*
+ * Clean all allocated pages (that is, all pages that are not pinned and
+ * not free). This is called by sync(2).
+ *
+ * Each object which had dirty pages when we started is cleaned once with
+ * pframe_clean_obj, so only dirty pages are looked at and each of them
+ * at most once. An object is put back on dirty_objs before it is cleaned
+ * so that it simply drops off that list if it runs out of dirty pages.
+ */
+void
+pframe_clean_all()
+{
+        list_t todo;
+        mmobj_t *o;
+
+        dbg(DBG_PFRAME, "pframe_clean_all: starting with %d dirty pages\n", ndirty);
+
+        pframe_list_move(&dirty_objs, &todo);
+        while (!list_empty(&todo)) {
+                o = list_head(&todo, mmobj_t, mmo_dlink);
+                list_remove(&o->mmo_dlink);
+                list_insert_tail(&dirty_objs, &o->mmo_dlink);
+                pframe_clean_obj(o);
+        }
+
+        dbg(DBG_PFRAME, "pframe_clean_all: completed, %d pages dirty again\n", ndirty);
 }
 
 /* Remove a page frame from the page tables of all processes that map it
@@ -589,8 +1317,8 @@ pageoutd_exit()
 }
 
 /*
- * The pageout daemon, when run, gets the least-recently-requested page from the
- * list of pages which are available to be paged out. Make sure to check if the
+ * The pageout daemon, when run, gets the page the replacement policy picks from
+ * the queue of pages which are available to be paged out. Make sure to check if the
  * page is busy before yanking it. If the page you select is dirty, make sure
  * to clean it before yanking it. Finally, go back to sleep after having paged
  * out the appropriate page.
@@ -599,27 +1327,36 @@ pageoutd_exit()
 static void *
 pageoutd_run(int arg1, void *arg2)
 {
+        uint32_t target;
+        int nfreed;
+
         while (1) {
 
                 KASSERT(nallocated >= 0);
-                while ((!pageoutd_target_met()) && (!list_empty(&alloc_list))) {
+                nfreed = 0;
+                target = pageoutd_target();
+                while (page_free_count() < target) {
                         pframe_t *pf;
 
-                        /* obtain least-recently-requested page: */
-                        pf = list_head(&alloc_list, pframe_t, pf_link);
+                        /* obtain the page the replacement policy picks: */
+                        if (NULL == (pf = pframe_queue_victim(&alloc_queue)))
+                                break;
 
                         if (pframe_is_busy(pf)) {
                                 sched_sleep_on(&pf->pf_waitq);
                         } else if (pframe_is_dirty(pf)) {
-                                pframe_clean(pf);
+                                pframe_clean_cluster(pf);
                         } else {
                                 /* it's not busy, it's clean, and it's
-                                 * least-recently-requested; reclaim it: */
+                                 * the policy's victim; reclaim it: */
+                                pframe_queue_evicted(&alloc_queue, pf);
                                 pframe_free(pf);
+                                nfreed++;
                         }
                 }
-                /*   release the thundering herd... */
-                sched_broadcast_on(&alloc_waitq);
+                /* wake one waiter per freed page, or all of them if no
+                 * pages could be freed so that they can give up */
+                sched_wakeup_excl_on(&alloc_waitq, nfreed ? nfreed : alloc_waitq.tq_size);
 
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: Falling asleep\n");
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: "
@@ -637,3 +1374,337 @@ pageoutd_run(int arg1, void *arg2)
         }
         return NULL;
 }
+
+/* ------------------------------------------------------------------ */
+/* -------------------------- FLUSH DAEMON -------------------------- */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Initialize the flush daemon process, which writes dirty pages back in
+ * the background so that they do not all wait for pageoutd or sync(2).
+ */
+static __attribute__((unused)) void
+flushd_init(void)
+{
+        sched_queue_init(&flushd_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        flushd = proc_create("flushd");
+        KASSERT(NULL != flushd);
+        flushd_thr = kthread_create(flushd, flushd_run, 0, NULL);
+        KASSERT(NULL != flushd_thr);
+
+        sched_make_runnable(flushd_thr);
+}
+init_func(flushd_init);
+init_depends(sched_init);
+
+static void
+flushd_exit()
+{
+        KASSERT(NULL != flushd_thr);
+        kthread_cancel(flushd_thr, (void *) 0);
+        flushd_thr = NULL;
+}
+
+/*
+ * Every FLUSHD_PERIOD_MSECS, the flush daemon cleans the pages which
+ * have been dirty for at least FLUSHD_DIRTY_AGE_MSECS, oldest first,
+ * looking at no more than FLUSHD_BUDGET pages, written or not, so that
+ * it does not hog the disk or the CPU. Since the dirty list is in the
+ * order the pages became dirty, it stops at the first page which is not
+ * old enough. Pages which cannot be cleaned right now are sent to the
+ * back of the list with a fresh stamp, which can be later than the time
+ * the pass started, so ages are compared as signed differences.
+ * Both arguments unused.
+ */
+static void *
+flushd_run(int arg1, void *arg2)
+{
+        uint32_t now, written, skipped;
+        pframe_t *pf;
+        int ret;
+
+        while (1) {
+                now = time_ticks();
+                written = 0;
+                skipped = 0;
+                while ((written + skipped < FLUSHD_BUDGET)
+                       && !list_empty(&dirty_list)) {
+                        pf = list_head(&dirty_list, pframe_t, pf_dlink);
+                        if ((int32_t)(now - pf->pf_dirtied)
+                            < (int32_t) TIME_MSECS_TO_TICKS(FLUSHD_DIRTY_AGE_MSECS))
+                                break;
+
+                        if (pframe_is_busy(pf) || pframe_is_pinned(pf)) {
+                                /* try again later; only its place on
+                                 * dirty_list changes, the object's
+                                 * lists may be in use by
+                                 * pframe_clean_obj */
+                                pf->pf_dirtied = time_ticks();
+                                list_remove(&pf->pf_dlink);
+                                list_insert_tail(&dirty_list, &pf->pf_dlink);
+                                skipped++;
+                        } else if ((ret = pframe_clean_cluster(pf)) < 0) {
+                                /* the page went back to the end of the list */
+                                dbg(DBG_PFRAME, "flushd: failed to clean page %d of obj %p\n",
+                                    pf->pf_pagenum, pf->pf_obj);
+                                skipped++;
+                        } else {
+                                written += ret;
+                        }
+                }
+                if (0 != written)
+                        dbg(DBG_PFRAME, "flushd: wrote back %u pages, %d still dirty\n",
+                            written, ndirty);
+
+                if (-EINTR == sched_sleep_on_timeout(&flushd_waitq,
+                                                     TIME_MSECS_TO_TICKS(FLUSHD_PERIOD_MSECS)))
+                        return NULL;
+        }
+        return NULL;
+}
+
+/* An object whose writes are slow when flushd makes them, for
+ * pframe_fsync_test. */
+#define PF_TEST_PAGES          4 /* pages of the object, all dirty */
+#define PF_TEST_WRITE_MSECS  100 /* how long each of flushd's writes takes */
+
+typedef struct pframe_test_obj {
+        mmobj_t         pt_mmobj;
+        ktqueue_t       pt_waitq;       /* slow writes sleep here */
+        int             pt_inflight;    /* writes started but not finished */
+        int             pt_nwritten[PF_TEST_PAGES]; /* finished writes of each page */
+} pframe_test_obj_t;
+
+static void
+pframe_test_ref(mmobj_t *o)
+{
+}
+
+static void
+pframe_test_put(mmobj_t *o)
+{
+}
+
+static int
+pframe_test_cleanpage(mmobj_t *o, pframe_t *pf)
+{
+        pframe_test_obj_t *pt = CONTAINER_OF(o, pframe_test_obj_t, pt_mmobj);
+
+        KASSERT(PF_TEST_PAGES > pf->pf_pagenum);
+        pt->pt_inflight++;
+        if (curthr == flushd_thr)
+                sched_sleep_on_timeout(&pt->pt_waitq,
+                                       TIME_MSECS_TO_TICKS(PF_TEST_WRITE_MSECS));
+        pt->pt_inflight--;
+        pt->pt_nwritten[pf->pf_pagenum]++;
+        return 0;
+}
+
+static mmobj_ops_t pframe_test_ops = {
+        .ref = pframe_test_ref,
+        .put = pframe_test_put,
+        .cleanpage = pframe_test_cleanpage
+};
+
+/*
+ * Checks that pframe_clean_obj, as fsync(2) uses it, waits for a write
+ * of one of the object's pages which flushd started before it and has
+ * not finished. Returns NULL if it does, otherwise what went wrong.
+ */
+const char *
+pframe_fsync_test(void)
+{
+        pframe_test_obj_t pt;
+        const char *failed = NULL;
+        pframe_t *pf;
+        uint32_t i, tries;
+
+        if (NULL == flushd_thr)
+                return "flushd is not running";
+
+        memset(&pt, 0, sizeof(pt));
+        mmobj_init(&pt.pt_mmobj, &pframe_test_ops);
+        sched_queue_init(&pt.pt_waitq);
+
+        /* dirty pages old enough for flushd, at the head of dirty_list
+         * so that it gets to them first */
+        for (i = PF_TEST_PAGES; i-- > 0;) {
+                if (NULL == (pf = pframe_alloc(&pt.pt_mmobj, i))) {
+                        failed = "out of memory";
+                        goto out;
+                }
+                pframe_mark_dirty(pf);
+                pf->pf_dirtied -= TIME_MSECS_TO_TICKS(FLUSHD_DIRTY_AGE_MSECS) + 1;
+                list_remove(&pf->pf_dlink);
+                list_insert_head(&dirty_list, &pf->pf_dlink);
+        }
+
+        sched_broadcast_on(&flushd_waitq);
+        for (tries = TIME_MSECS_TO_TICKS(FLUSHD_PERIOD_MSECS);
+             0 == pt.pt_inflight && tries > 0; --tries)
+                sched_sleep_on_timeout(&pt.pt_waitq, 1);
+        if (0 == pt.pt_inflight) {
+                failed = "flushd did not start writing";
+                goto out;
+        }
+
+        pframe_clean_obj(&pt.pt_mmobj);
+        if (0 != pt.pt_inflight) {
+                failed = "returned with a write in flight";
+                goto out;
+        }
+        for (i = 0; i < PF_TEST_PAGES; ++i) {
+                if (0 == pt.pt_nwritten[i]) {
+                        failed = "left a page unwritten";
+                        goto out;
+                }
+                pf = pframe_hash_find(&pt.pt_mmobj, i);
+                if (NULL != pf && (pframe_is_busy(pf) || pframe_is_dirty(pf))) {
+                        failed = "left a page busy or dirty";
+                        goto out;
+                }
+        }
+
+out:
+        /* the pages must be gone before pt is */
+        while (!list_empty(&pt.pt_mmobj.mmo_respages)) {
+                pf = list_head(&pt.pt_mmobj.mmo_respages, pframe_t, pf_olink);
+                if (pframe_is_busy(pf))
+                        sched_sleep_on(&pf->pf_waitq);
+                else
+                        pframe_free(pf);
+        }
+        return failed;
+}
+
+/* ------------------------------------------------------------------ */
+/* ------------------------ READ-AHEAD DAEMON ----------------------- */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Asks readaheadd to bring pages [pagenum, pagenum + npages) of o into
+ * memory, so that a thread which is about to need them does not have
+ * to wait for them. This never blocks; read-ahead is only a hint, so
+ * the request is dropped if the queue is full.
+ */
+void
+pframe_readahead(mmobj_t *o, uint32_t pagenum, uint32_t npages)
+{
+        pframe_ra_t *ra;
+
+        KASSERT(NULL != o);
+
+        if (0 == npages || NULL == readaheadd_thr)
+                return;
+        if (PF_READAHEAD_QUEUE == ra_count) {
+                pframe_nradropped++;
+                return;
+        }
+
+        ra = &ra_queue[(ra_head + ra_count) % PF_READAHEAD_QUEUE];
+        o->mmo_ops->ref(o);
+        ra->ra_obj = o;
+        ra->ra_pagenum = pagenum;
+        ra->ra_npages = npages;
+        ra_count++;
+        sched_broadcast_on(&readaheadd_waitq);
+}
+
+/*
+ * Initialize the read-ahead daemon process, which fills the pages that
+ * pframe_readahead asks for.
+ */
+static __attribute__((unused)) void
+readaheadd_init(void)
+{
+        sched_queue_init(&readaheadd_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        readaheadd = proc_create("readaheadd");
+        KASSERT(NULL != readaheadd);
+        readaheadd_thr = kthread_create(readaheadd, readaheadd_run, 0, NULL);
+        KASSERT(NULL != readaheadd_thr);
+
+        sched_make_runnable(readaheadd_thr);
+}
+init_func(readaheadd_init);
+init_depends(sched_init);
+
+static void
+readaheadd_exit()
+{
+        KASSERT(NULL != readaheadd_thr);
+        kthread_cancel(readaheadd_thr, (void *) 0);
+        readaheadd_thr = NULL;
+}
+
+/*
+ * Stops the read-ahead daemon and waits for it to drop the requests still
+ * queued. Each of them holds a reference on its object, so this must run
+ * before vfs_shutdown, which expects every vnode to have been released.
+ * Read-ahead requests made afterwards are ignored. Does nothing if the
+ * daemon was already stopped.
+ */
+void
+pframe_readahead_shutdown(void)
+{
+        KASSERT(PID_IDLE == curproc->p_pid); /* Should call from idleproc */
+
+        if (NULL == readaheadd_thr)
+                return;
+        readaheadd_exit();
+
+        int pid = readaheadd->p_pid;
+        int child = do_waitpid(pid, 0, NULL);
+        KASSERT(pid == child && "waited on process other than readaheadd");
+}
+
+/*
+ * The read-ahead daemon takes requests off the queue in order and fills
+ * the pages of each which are not resident yet. Reading ahead must not
+ * push out pages somebody is using, so it stops filling pages once the
+ * free pages are down to nfreepages_min, where pageoutd starts
+ * reclaiming. Fragmented free memory alone does not stop it, since
+ * pageoutd frees pages then without needing them. When cancelled, it
+ * drops the requests still queued.
+ * Both arguments unused.
+ */
+static void *
+readaheadd_run(int arg1, void *arg2)
+{
+        pframe_ra_t ra;
+        pframe_t *pf;
+        uint32_t i;
+
+        while (1) {
+                while (ra_count > 0) {
+                        ra = ra_queue[ra_head];
+                        ra_head = (ra_head + 1) % PF_READAHEAD_QUEUE;
+                        ra_count--;
+
+                        for (i = 0; i < ra.ra_npages && page_free_count() > nfreepages_min; ++i) {
+                                if (NULL != pframe_hash_find(ra.ra_obj, ra.ra_pagenum + i))
+                                        continue;
+                                if (0 > pframe_get(ra.ra_obj, ra.ra_pagenum + i, &pf))
+                                        break;
+                                pframe_nreadahead++;
+                        }
+                        ra.ra_obj->mmo_ops->put(ra.ra_obj);
+                }
+
+                if (sched_cancellable_sleep_on(&readaheadd_waitq)) {
+                        while (ra_count > 0) {
+                                ra = ra_queue[ra_head];
+                                ra_head = (ra_head + 1) % PF_READAHEAD_QUEUE;
+                                ra_count--;
+                                ra.ra_obj->mmo_ops->put(ra.ra_obj);
+                        }
+                        return NULL;
+                }
+        }
+        return NULL;
+}
@@ -9,6 +9,16 @@
  * Note that there is no need for locking in allocation and deallocation because
  * it never blocks nor is used by an interrupt handler. Hurray for non preemptible
  * kernels!
+ *
+ * As in Bonwick's allocator, an allocator may be given a constructor and a
+ * destructor. The constructor runs once when a slab is created and the
+ * destructor once when the slab is reclaimed; in between objects keep their
+ * constructed state, so users only reset what changes from one use to the
+ * next. In front of the slabs each allocator keeps a magazine of recently
+ * freed objects which are handed out again first. There is a single
+ * magazine per allocator rather than one per CPU: the allocator is only
+ * called from kernel code, which runs with the kernel lock held (see
+ * main/smp.h), so no two processors ever use a magazine at once.
  */
 
 #include "types.h"
@@ -18,8 +28,10 @@
 #include "mm/page.h"
 
 #include "util/gdb.h"
+#include "util/list.h"
 #include "util/string.h"
 #include "util/debug.h"
+#include "util/printf.h"
 
 #ifdef SLAB_REDZONE
 #define front_rz(obj)           (*(uintptr_t*)(obj))
@@ -38,7 +50,7 @@
 #endif
 
 struct slab {
-        struct slab             *s_next;       /* link on list of slabs */
+        list_link_t              s_link;       /* link on one of the allocator's slab lists */
         int                      s_inuse;      /* number of allocated objs */
         void                    *s_free;       /* head of obj free list */
         void                    *s_addr;       /* start address */
@@ -48,9 +60,22 @@ struct slab_allocator {
         struct slab_allocator   *sa_next;       /* link on list of slab allocators */
         const char              *sa_name;       /* user-provided name */
         size_t                   sa_objsize;    /* object size */
-        struct slab             *sa_slabs;      /* head of slab list */
+        list_t                   sa_full;       /* slabs with no free objects */
+        list_t                   sa_partial;    /* slabs with some free objects */
+        list_t                   sa_empty;      /* slabs with no allocated objects */
         int                      sa_order;      /* npages = (1 << order) */
         int                      sa_slab_nobjs; /* number of objs per slab */
+        slab_ctor_t              sa_ctor;       /* object constructor, or NULL */
+        slab_dtor_t              sa_dtor;       /* object destructor, or NULL */
+        int                      sa_mag_rounds; /* number of objs in sa_mag */
+        void                    *sa_mag[SLAB_MAGAZINE_SIZE]; /* recently freed objs */
+
+        /* Statistics for slab_allocators_info */
+        uint32_t                 sa_nslabs;     /* slabs currently allocated */
+        uint32_t                 sa_inuse;      /* objs allocated and not freed */
+        uint32_t                 sa_nallocs;    /* calls to slab_obj_alloc */
+        uint32_t                 sa_nfrees;     /* calls to slab_obj_free */
+        uint32_t                 sa_ngrows;     /* slabs ever allocated */
 };
 
 struct slab_bufctl {
@@ -73,6 +98,13 @@ struct slab_bufctl {
         ( (void*) (((uintptr_t)(obj)) + (allocator)->sa_objsize \
                    + sizeof(struct slab_bufctl)) )
 
+/* the address the user of an object sees, past the front red-zone */
+#ifdef SLAB_REDZONE
+#define user_obj(obj)           ( (void*)(((uintptr_t)(obj)) + sizeof(SLAB_REDZONE)) )
+#else
+#define user_obj(obj)           (obj)
+#endif
+
 GDB_DEFINE_HOOK(slab_obj_alloc, void *addr, struct slab_allocator *allocator)
 GDB_DEFINE_HOOK(slab_obj_free, void *addr, struct slab_allocator *allocator)
 
@@ -158,7 +190,8 @@ _calc_slab_size(struct slab_allocator *allocator)
 }
 
 static void
-_allocator_init(struct slab_allocator *allocator, const char *name, size_t size)
+_allocator_init(struct slab_allocator *allocator, const char *name, size_t size,
+                slab_ctor_t ctor, slab_dtor_t dtor)
 {
 #ifdef SLAB_REDZONE
         /*
@@ -172,7 +205,17 @@ _allocator_init(struct slab_allocator *allocator, const char *name, size_t size)
 
         allocator->sa_name = name;
         allocator->sa_objsize = size;
-        allocator->sa_slabs = NULL;
+        list_init(&allocator->sa_full);
+        list_init(&allocator->sa_partial);
+        list_init(&allocator->sa_empty);
+        allocator->sa_ctor = ctor;
+        allocator->sa_dtor = dtor;
+        allocator->sa_mag_rounds = 0;
+        allocator->sa_nslabs = 0;
+        allocator->sa_inuse = 0;
+        allocator->sa_nallocs = 0;
+        allocator->sa_nfrees = 0;
+        allocator->sa_ngrows = 0;
         _calc_slab_size(allocator);
 
         /* Add cache to global cache list. */
@@ -187,17 +230,24 @@ _allocator_init(struct slab_allocator *allocator, const char *name, size_t size)
 }
 
 struct slab_allocator *
-slab_allocator_create(const char *name, size_t size) {
+slab_allocator_create_ctor(const char *name, size_t size,
+                           slab_ctor_t ctor, slab_dtor_t dtor)
+{
         struct slab_allocator *allocator;
 
         allocator = (struct slab_allocator *) slab_obj_alloc(&slab_allocator_allocator);
         if (!allocator)
                 return NULL;
 
-        _allocator_init(allocator, name, size);
+        _allocator_init(allocator, name, size, ctor, dtor);
         return allocator;
 }
 
+struct slab_allocator *
+slab_allocator_create(const char *name, size_t size) {
+        return slab_allocator_create_ctor(name, size, NULL, NULL);
+}
+
 
 static int
 _slab_allocator_grow(struct slab_allocator *allocator)
@@ -211,6 +261,7 @@ _slab_allocator_grow(struct slab_allocator *allocator)
         addr = page_alloc_n(npages);
         if (!addr)
                 return 0;
+        page_set_owner(addr, npages, allocator);
 
         /* Initialize each bufctl to be free and point to the next object. */
         obj = addr;
@@ -245,6 +296,8 @@ _slab_allocator_grow(struct slab_allocator *allocator)
                 front_rz(obj) = SLAB_REDZONE;
                 rear_rz(allocator, obj) = SLAB_REDZONE;
 #endif
+                if (allocator->sa_ctor)
+                        allocator->sa_ctor(user_obj(obj));
                 obj = next_obj(allocator, obj);
         }
 
@@ -253,28 +306,43 @@ _slab_allocator_grow(struct slab_allocator *allocator)
             1 << allocator->sa_order);
 
         /* Place this slab into the cache. */
-        slab->s_next = allocator->sa_slabs;
-        allocator->sa_slabs = slab;
+        list_insert_head(&allocator->sa_empty, &slab->s_link);
+        allocator->sa_nslabs++;
+        allocator->sa_ngrows++;
 
         return 1;
 }
 
-void *
-slab_obj_alloc(struct slab_allocator *allocator)
+/*
+ * Moves a slab to the head of one of its allocator's slab lists.
+ */
+static inline void
+_slab_move(struct slab *slab, list_t *list)
+{
+        list_remove(&slab->s_link);
+        list_insert_head(list, &slab->s_link);
+}
+
+/*
+ * Takes a free object from one of the allocator's slabs, growing the
+ * allocator if it has to. Returns NULL if it is out of memory.
+ */
+static void *
+_slab_obj_alloc(struct slab_allocator *allocator)
 {
         struct slab *slab;
         void *obj;
 
-        /* Find a slab with a free object. */
-        for (;;) {
-                slab = allocator->sa_slabs;
-                while (slab && (slab->s_inuse == allocator->sa_slab_nobjs))
-                        slab = slab->s_next;
-                if (slab && (slab->s_inuse < allocator->sa_slab_nobjs))
-                        break;
-                if (!_slab_allocator_grow(allocator))
+        /* Use a partially full slab if there is one, so that empty
+         * slabs stay empty and can be reclaimed. */
+        if (!list_empty(&allocator->sa_partial)) {
+                slab = list_head(&allocator->sa_partial, struct slab, s_link);
+        } else {
+                if (list_empty(&allocator->sa_empty) && !_slab_allocator_grow(allocator))
                         return NULL;
+                slab = list_head(&allocator->sa_empty, struct slab, s_link);
         }
+        KASSERT(slab->s_inuse < allocator->sa_slab_nobjs);
 
         /*
          * Remove an object from the slab's free list.  We'll use the
@@ -288,11 +356,65 @@ slab_obj_alloc(struct slab_allocator *allocator)
         obj_bufctl(allocator, obj)->sb_free = 0;
 #endif
 
-        slab->s_inuse++;
+        if (++slab->s_inuse == allocator->sa_slab_nobjs)
+                _slab_move(slab, &allocator->sa_full);
+        else if (1 == slab->s_inuse)
+                _slab_move(slab, &allocator->sa_partial);
 
         dbg(DBG_MM, "Allocated object 0x%p from \"%s\" (0x%p), "
             "slab 0x%p, inuse %d\n", obj, allocator->sa_name,
             allocator, allocator, slab->s_inuse);
+        return obj;
+}
+
+/*
+ * Puts an object back on its slab's free list.
+ */
+static void
+_slab_obj_free(struct slab_allocator *allocator, void *obj)
+{
+        struct slab *slab = obj_bufctl(allocator, obj)->sb_slab;
+
+        /* Place this object back on the slab's free list. */
+        obj_bufctl(allocator, obj)->sb_next = slab->s_free;
+        slab->s_free = obj;
+
+        if (0 == --slab->s_inuse)
+                _slab_move(slab, &allocator->sa_empty);
+        else if (allocator->sa_slab_nobjs - 1 == slab->s_inuse)
+                _slab_move(slab, &allocator->sa_partial);
+
+        dbg(DBG_MM, "Freed object 0x%p from \"%s\" (0x%p), slab 0x%p, inuse %d\n",
+            obj, allocator->sa_name, allocator, slab, slab->s_inuse);
+}
+
+/*
+ * Returns all the objects in the allocator's magazine to their slabs.
+ */
+static void
+_slab_mag_flush(struct slab_allocator *allocator)
+{
+        while (allocator->sa_mag_rounds > 0)
+                _slab_obj_free(allocator, allocator->sa_mag[--allocator->sa_mag_rounds]);
+}
+
+void *
+slab_obj_alloc(struct slab_allocator *allocator)
+{
+        void *obj;
+
+        /* Objects in the magazine are still allocated as far as their
+         * slabs are concerned, so reusing one is just a pop. */
+        if (allocator->sa_mag_rounds > 0) {
+                obj = allocator->sa_mag[--allocator->sa_mag_rounds];
+#ifdef SLAB_CHECK_FREE
+                obj_bufctl(allocator, obj)->sb_free = 0;
+#endif
+        } else if (NULL == (obj = _slab_obj_alloc(allocator))) {
+                return NULL;
+        }
+        allocator->sa_nallocs++;
+        allocator->sa_inuse++;
 
 #ifdef SLAB_REDZONE
         VERIFY_REDZONES(allocator, obj);
@@ -310,7 +432,6 @@ slab_obj_alloc(struct slab_allocator *allocator)
 void
 slab_obj_free(struct slab_allocator *allocator, void *obj)
 {
-        struct slab *slab;
         GDB_CALL_HOOK(slab_obj_free, obj, allocator);
 
 #ifdef SLAB_REDZONE
@@ -325,21 +446,20 @@ slab_obj_free(struct slab_allocator *allocator, void *obj)
         obj_bufctl(allocator, obj)->sb_free = 1;
 #endif
 
-        slab = obj_bufctl(allocator, obj)->sb_slab;
-
-        /* Place this object back on the slab's free list. */
-        obj_bufctl(allocator, obj)->sb_next = slab->s_free;
-        slab->s_free = obj;
+        allocator->sa_nfrees++;
+        allocator->sa_inuse--;
 
-        slab->s_inuse--;
-
-        dbg(DBG_MM, "Freed object 0x%p from \"%s\" (0x%p), slab 0x%p, inuse %d\n",
-            obj, allocator->sa_name, allocator, slab, slab->s_inuse);
+        if (allocator->sa_mag_rounds < SLAB_MAGAZINE_SIZE)
+                allocator->sa_mag[allocator->sa_mag_rounds++] = obj;
+        else
+                _slab_obj_free(allocator, obj);
 }
 
 /*
  * Reclaims as much memory (up to a target) from
- * unused slabs as possible
+ * unused slabs as possible, which are the slabs on the
+ * allocators' empty lists once their magazines have been
+ * emptied. Objects are destructed before their slab is freed.
  * @param target - target number of pages to reclaim. If negative,
  * try to reclaim as many pages as possible
  * @return number of pages freed
@@ -347,78 +467,237 @@ slab_obj_free(struct slab_allocator *allocator, void *obj)
 int
 slab_allocators_reclaim(int target)
 {
-        int npages_freed = 0, npages;
+        int npages_freed = 0, npages, ii;
 
         struct slab_allocator *a;
-        struct slab *s, **prev;
+        struct slab *s;
+        void *obj;
 
         /* Go through all caches */
         for (a = slab_allocators; NULL != a; a = a->sa_next) {
-                prev = &(a->sa_slabs);
-                s = a->sa_slabs;
-                while (NULL != s) {
-                        struct slab *next = s->s_next;
-                        if (0 == s->s_inuse) {
-                                /* Free Slab */
-                                (*prev) = next;
-                                npages = 1 << a->sa_order;
-
-                                page_free_n(s->s_addr, npages);
-                                npages_freed += npages;
-                        } else {
-                                prev = &(s->s_next);
+                _slab_mag_flush(a);
+                while (!list_empty(&a->sa_empty)) {
+                        s = list_head(&a->sa_empty, struct slab, s_link);
+                        KASSERT(0 == s->s_inuse);
+                        list_remove(&s->s_link);
+
+                        if (a->sa_dtor) {
+                                obj = s->s_addr;
+                                for (ii = 0; ii < a->sa_slab_nobjs; ii++) {
+                                        a->sa_dtor(user_obj(obj));
+                                        obj = next_obj(a, obj);
+                                }
                         }
+
+                        /* Free Slab */
+                        npages = 1 << a->sa_order;
+                        page_set_owner(s->s_addr, npages, NULL);
+                        page_free_n(s->s_addr, npages);
+                        npages_freed += npages;
+                        a->sa_nslabs--;
+
                         /* Check if target was met */
                         if ((target > 0) && (npages_freed >= target)) {
                                 return npages_freed;
                         }
-                        s = next;
                 }
         }
         return npages_freed;
 }
 
-#define KMALLOC_SIZE_MIN_ORDER  (6)
-#define KMALLOC_SIZE_MAX_ORDER  (18)
+/*
+ * Prints one line for each slab allocator: its object size, how many
+ * objects are in use, how many slabs it has and how many pages they
+ * take up, the bytes of those slabs lost to rounding and bookkeeping,
+ * and the number of allocations, frees and slab allocations so far.
+ */
+size_t
+slab_allocators_info(const void *arg, char *buf, size_t size)
+{
+        struct slab_allocator *a;
+        size_t objsize, waste;
 
-static struct slab_allocator *kmalloc_allocators[KMALLOC_SIZE_MAX_ORDER - KMALLOC_SIZE_MIN_ORDER + 1];
+        iprintf(&buf, &size, "%-16s %6s %7s %6s %6s %8s %9s %9s %6s\n",
+                "name", "size", "inuse", "slabs", "pages", "waste",
+                "allocs", "frees", "grows");
+        for (a = slab_allocators; NULL != a; a = a->sa_next) {
+                objsize = a->sa_objsize;
+#ifdef SLAB_REDZONE
+                objsize -= 2 * sizeof(SLAB_REDZONE);
+#endif
+                /* everything in a slab which is not an object, whether
+                 * it is allocated or not, is waste */
+                waste = a->sa_nslabs * ((PAGE_SIZE << a->sa_order)
+                                        - a->sa_slab_nobjs * objsize);
+                iprintf(&buf, &size, "%-16s %6u %7u %6u %6u %7uK %9u %9u %6u\n",
+                        a->sa_name, objsize, a->sa_inuse, a->sa_nslabs,
+                        a->sa_nslabs << a->sa_order, waste >> 10,
+                        a->sa_nallocs, a->sa_nfrees, a->sa_ngrows);
+        }
+        return size;
+}
 
-/* Note that kmem_cache_names should be modified to remain consistent
- * with KMALLOC_SIZE_MIN_ORDER ... KMALLOC_SIZE_MAX_ORDER.
+/*
+ * The kmalloc size classes. There is a class half way between each pair
+ * of powers of two, so no more than a third of an object is wasted.
+ * Objects carry no header, kfree finds the cache an object came from
+ * with page_owner().
+ *
+ * Requests bigger than the largest class get a block of whole pages
+ * from page_alloc_n, so that rarely used big classes do not hold on to
+ * large slabs.
  */
-static const char *kmalloc_allocator_names[] = {
-        "size-64",
-        "size-128",
-        "size-256",
-        "size-512",
-        "size-1024",
-        "size-2048",
-        "size-4096",
-        "size-8192",
-        "size-16384",
-        "size-32768",
-        "size-65536",
-        "size-131072",
-        "size-262144"
+static const struct kmalloc_class {
+        size_t           kc_size;       /* object size */
+        const char      *kc_name;       /* cache name */
+} kmalloc_classes[] = {
+        { 32,     "size-32" },
+        { 64,     "size-64" },
+        { 96,     "size-96" },
+        { 128,    "size-128" },
+        { 192,    "size-192" },
+        { 256,    "size-256" },
+        { 384,    "size-384" },
+        { 512,    "size-512" },
+        { 768,    "size-768" },
+        { 1024,   "size-1024" },
+        { 1536,   "size-1536" },
+        { 2048,   "size-2048" },
+        { 3072,   "size-3072" },
+        { 4096,   "size-4096" },
+        { 6144,   "size-6144" },
+        { 8192,   "size-8192" },
+        { 12288,  "size-12288" },
+        { 16384,  "size-16384" }
 };
 
+#define KMALLOC_NCLASSES (sizeof(kmalloc_classes) / sizeof(kmalloc_classes[0]))
+
+static struct slab_allocator *kmalloc_allocators[KMALLOC_NCLASSES];
+
+/* Page blocks given out by kmalloc. Their pages are owned by
+ * KMALLOC_LARGE_OWNER, and kfree looks the block up in this table to
+ * find out how big it is. */
+typedef struct kmalloc_large {
+        void           *kl_addr;        /* start of the block */
+        uint32_t        kl_npages;      /* size of the block */
+        list_link_t     kl_link;        /* link on a kmalloc_large_table bucket */
+} kmalloc_large_t;
+
+#define KMALLOC_LARGE_NBUCKETS  16
+#define KMALLOC_LARGE_OWNER     ((void *)kmalloc_large_table)
+
+static list_t kmalloc_large_table[KMALLOC_LARGE_NBUCKETS];
+static struct slab_allocator *kmalloc_large_allocator;
+
+#define kmalloc_large_bucket(addr) \
+        (&kmalloc_large_table[ADDR_TO_PN(addr) % KMALLOC_LARGE_NBUCKETS])
+
+/* one entry per size class, and one more for page blocks */
+static struct kmalloc_stats {
+        uint64_t        ks_allocs;      /* objects allocated */
+        uint64_t        ks_requested;   /* bytes asked for in those allocations */
+        uint64_t        ks_used;        /* bytes actually given out for them */
+        uint64_t        ks_pow2;        /* bytes they would have used with a
+                                         * header and power of two classes */
+} kmalloc_stats[KMALLOC_NCLASSES + 1];
+
+/* The smallest class the old kmalloc used, which also stored a
+ * pointer to the cache in front of every object. */
+#define KMALLOC_POW2_MIN        64
+
+/*
+ * @return the size kmalloc used to take for a request of size bytes
+ */
+static size_t
+_kmalloc_pow2_size(size_t size)
+{
+        size_t pow2 = KMALLOC_POW2_MIN;
+
+        size += sizeof(struct slab_allocator *);
+        while (pow2 < size)
+                pow2 <<= 1;
+        return pow2;
+}
+
+/*
+ * Records an allocation in the statistics for its class.
+ */
+static void
+_kmalloc_account(struct kmalloc_stats *ks, size_t size, size_t used)
+{
+        ks->ks_allocs++;
+        ks->ks_requested += size;
+        ks->ks_used += used;
+        ks->ks_pow2 += _kmalloc_pow2_size(size);
+}
+
+/*
+ * Allocates a block of whole pages for a request too big for any of
+ * the size classes.
+ */
+static void *
+_kmalloc_large(size_t size)
+{
+        uint32_t npages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        kmalloc_large_t *kl;
+        void *addr;
+
+        if (npages > (1U << (PAGE_NSIZES - 1))) {
+                dbg(DBG_MM, "WARNING: kmalloc of %u bytes is too big\n", size);
+                return NULL;
+        }
+        if (NULL == (kl = slab_obj_alloc(kmalloc_large_allocator)))
+                return NULL;
+        if (NULL == (addr = page_alloc_n(npages))) {
+                slab_obj_free(kmalloc_large_allocator, kl);
+                return NULL;
+        }
+
+        page_set_owner(addr, npages, KMALLOC_LARGE_OWNER);
+        kl->kl_addr = addr;
+        kl->kl_npages = npages;
+        list_insert_head(kmalloc_large_bucket(addr), &kl->kl_link);
+
+        _kmalloc_account(&kmalloc_stats[KMALLOC_NCLASSES], size, npages << PAGE_SHIFT);
+        return addr;
+}
+
+/*
+ * Frees a block allocated by _kmalloc_large.
+ */
+static void
+_kfree_large(void *addr)
+{
+        list_t *bucket = kmalloc_large_bucket(addr);
+        kmalloc_large_t *kl;
+
+        list_iterate_begin(bucket, kl, kmalloc_large_t, kl_link) {
+                if (addr == kl->kl_addr)
+                        goto found;
+        } list_iterate_end();
+        panic("kfree of 0x%p, which is not the start of a kmalloc block\n", addr);
+
+found:
+        list_remove(&kl->kl_link);
+#ifdef MM_POISON
+        memset(addr, MM_POISON_FREE, kl->kl_npages << PAGE_SHIFT);
+#endif /* MM_POISON */
+        page_set_owner(addr, kl->kl_npages, NULL);
+        page_free_n(addr, kl->kl_npages);
+        slab_obj_free(kmalloc_large_allocator, kl);
+}
+
 void *
 kmalloc(size_t size)
 {
-        int order;
-        struct slab_allocator **cs;
+        unsigned int i;
         void *addr;
 
-        size += sizeof(struct slab_allocator *);
-
-        /*
-         * Find the first power of two bucket bigger than the
-         * requested size, and allocate from it.
-         */
-        cs = kmalloc_allocators;
-        for (order = KMALLOC_SIZE_MIN_ORDER; order <= KMALLOC_SIZE_MAX_ORDER; order++, cs++) {
-                if ((size_t)(1 << order) >= size) {
-                        addr = slab_obj_alloc(*cs);
+        /* Find the smallest class the request fits in. */
+        for (i = 0; i < KMALLOC_NCLASSES; i++) {
+                if (kmalloc_classes[i].kc_size >= size) {
+                        addr = slab_obj_alloc(kmalloc_allocators[i]);
                         if (!addr) {
                                 dbg(DBG_MM, "WARNING: kmalloc out of memory\n");
                                 return NULL;
@@ -426,13 +705,67 @@ kmalloc(size_t size)
 #ifdef MM_POISON
                         memset(addr, MM_POISON_ALLOC, size);
 #endif /* MM_POISON */
-                        *((struct slab_allocator **)addr) = *cs;
-                        return (void *)(((struct slab_allocator **)addr) + 1);
+                        _kmalloc_account(&kmalloc_stats[i], size, kmalloc_classes[i].kc_size);
+                        return addr;
                 }
         }
 
-        panic("size bigger than maxorder %ld\n", (unsigned long) size);
-        return NULL;
+        if (NULL == (addr = _kmalloc_large(size))) {
+                dbg(DBG_MM, "WARNING: kmalloc out of memory\n");
+                return NULL;
+        }
+#ifdef MM_POISON
+        memset(addr, MM_POISON_ALLOC, size);
+#endif /* MM_POISON */
+        return addr;
+}
+
+/*
+ * @return part as a percentage of whole, without 64 bit division
+ */
+static uint32_t
+_kmalloc_percent(uint64_t part, uint64_t whole)
+{
+        while (whole > 0xffffff) {
+                part >>= 1;
+                whole >>= 1;
+        }
+        return whole ? (uint32_t)(part * 100) / (uint32_t)whole : 0;
+}
+
+size_t
+kmalloc_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        struct kmalloc_stats *ks;
+        uint64_t allocs = 0, requested = 0, used = 0, pow2 = 0;
+        unsigned int i;
+
+        KASSERT(NULL == arg);
+        KASSERT(NULL != buf);
+
+        iprintf(&buf, &size, "%-12s %10s %12s %7s %11s\n",
+                "CLASS", "ALLOCS", "REQ(KB)", "WASTE%", "POW2 WASTE%");
+        for (i = 0; i <= KMALLOC_NCLASSES; i++) {
+                ks = &kmalloc_stats[i];
+                if (0 == ks->ks_allocs)
+                        continue;
+                iprintf(&buf, &size, "%-12s %10u %12u %7u %11u\n",
+                        i < KMALLOC_NCLASSES ? kmalloc_classes[i].kc_name : "pages",
+                        (uint32_t)ks->ks_allocs, (uint32_t)(ks->ks_requested >> 10),
+                        _kmalloc_percent(ks->ks_used - ks->ks_requested, ks->ks_used),
+                        _kmalloc_percent(ks->ks_pow2 - ks->ks_requested, ks->ks_pow2));
+                allocs += ks->ks_allocs;
+                requested += ks->ks_requested;
+                used += ks->ks_used;
+                pow2 += ks->ks_pow2;
+        }
+        iprintf(&buf, &size, "%-12s %10u %12u %7u %11u\n",
+                "total", (uint32_t)allocs, (uint32_t)(requested >> 10),
+                _kmalloc_percent(used - requested, used),
+                _kmalloc_percent(pow2 - requested, pow2));
+
+        return size;
 }
 
 __attribute__((used)) static void *
@@ -447,8 +780,13 @@ malloc(size_t size)
 void
 kfree(void *addr)
 {
-        addr = (void *)(((struct slab_allocator **)addr) - 1);
-        struct slab_allocator *sa = *(struct slab_allocator **)addr;
+        struct slab_allocator *sa = page_owner(addr);
+
+        KASSERT(NULL != sa && "kfree of memory kmalloc did not allocate");
+        if (KMALLOC_LARGE_OWNER == sa) {
+                _kfree_large(addr);
+                return;
+        }
 
 #ifdef MM_POISON
         /* If poisoning is enabled, wipe the memory given in
@@ -476,20 +814,25 @@ free(void *addr)
 void
 slab_init()
 {
-        int order;
-        struct slab_allocator **cs;
+        unsigned int i;
 
         /* Special case initialization of the kmem_cache_t cache. */
-        _allocator_init(&slab_allocator_allocator, "slab_allocators", sizeof(struct slab_allocator));
+        _allocator_init(&slab_allocator_allocator, "slab_allocators",
+                        sizeof(struct slab_allocator), NULL, NULL);
 
         /*
-         * Allocate the power of two buckets for generic
+         * Allocate the size class buckets for generic
          * kmalloc/kfree.
          */
-        cs = kmalloc_allocators;
-        for (order = KMALLOC_SIZE_MIN_ORDER; order <= KMALLOC_SIZE_MAX_ORDER; order++, cs++) {
-                if (NULL == (*cs = slab_allocator_create(kmalloc_allocator_names[order - KMALLOC_SIZE_MIN_ORDER], (1 << order)))) {
+        for (i = 0; i < KMALLOC_NCLASSES; i++) {
+                if (NULL == (kmalloc_allocators[i] = slab_allocator_create(kmalloc_classes[i].kc_name,
+                                                                           kmalloc_classes[i].kc_size))) {
                         panic("Couldn't create kmalloc allocators!\n");
                 }
         }
+
+        for (i = 0; i < KMALLOC_LARGE_NBUCKETS; i++)
+                list_init(&kmalloc_large_table[i]);
+        if (NULL == (kmalloc_large_allocator = slab_allocator_create("kmalloc-pages", sizeof(kmalloc_large_t))))
+                panic("Couldn't create kmalloc allocators!\n");
 }
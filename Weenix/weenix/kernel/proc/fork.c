@@ -55,3 +55,34 @@ do_fork(struct regs *regs)
         NOT_YET_IMPLEMENTED("VM: do_fork");
         return 0;
 }
+
+#ifdef __MTP__
+/*
+ * Creates a thread which shares everything with the current thread's
+ * process. The caller provides the new thread's user stack.
+ */
+int
+do_thr_create(struct regs *regs, uint32_t entry, uint32_t stack)
+{
+        kthread_t *thr;
+        regs_t nregs;
+
+        KASSERT(NULL != regs);
+
+        /* the context is pointed at userland_entry below */
+        if (NULL == (thr = kthread_create(curproc, NULL, 0, NULL)))
+                return -ENOMEM;
+
+        memcpy(&nregs, regs, sizeof(nregs));
+        nregs.r_eip = entry;
+        nregs.r_useresp = stack;
+        nregs.r_ebp = 0;
+        nregs.r_eax = 0;
+
+        thr->kt_ctx.c_eip = (uint32_t) userland_entry;
+        thr->kt_ctx.c_esp = fork_setup_stack(&nregs, thr->kt_kstack);
+
+        sched_make_runnable(thr);
+        return thr->kt_tid;
+}
+#endif
@@ -2,6 +2,8 @@
 #include "errno.h"
 
 #include "util/debug.h"
+#include "util/list.h"
+#include "util/time.h"
 
 #include "proc/kthread.h"
 #include "proc/kmutex.h"
@@ -13,8 +15,43 @@
  * thread context.
  */
 
+/* All classes of mutexes which have been used, for statistics.
+ * Statically initialized so that mutexes can be set up by any init
+ * function. */
+static list_t kmutex_classes = { &kmutex_classes, &kmutex_classes };
+
+/* the class of mutexes initialized without one */
+static kmutex_class_t kmutex_other = KMUTEX_CLASS_INITIALIZER("kmutex");
+
+/**
+ * Records that the current thread took the mutex, after waiting for
+ * it since start if it was contended. The IPL must be high.
+ *
+ * @param mtx the mutex which was taken
+ * @param start when the thread started waiting, 0 if it did not wait
+ */
+static void
+kmutex_taken(kmutex_t *mtx, uint64_t start)
+{
+        krwlock_stats_t *st = &mtx->km_class->kmc_stats;
+        uint64_t now = time_cycles();
+
+        st->krs_acquired++;
+        if (0 != start) {
+                st->krs_contended++;
+                st->krs_wait += now - start;
+        }
+        mtx->km_holdstart = now;
+}
+
 void
 kmutex_init(kmutex_t *mtx)
+{
+        kmutex_init_class(mtx, &kmutex_other);
+}
+
+void
+kmutex_init_class(kmutex_t *mtx, kmutex_class_t *cls)
 {
    /*
    Here we're initialising the mutex by setting the queue to be empty and the mutex holder to be NULL
@@ -25,6 +62,10 @@ kmutex_init(kmutex_t *mtx)
 		             
          sched_queue_init(&(mtx->km_waitq));  
          mtx->km_holder = NULL;   
+         mtx->km_holdstart = 0;
+         mtx->km_class = cls;
+         if (!list_link_is_linked(&cls->kmc_link))
+                 list_insert_tail(&kmutex_classes, &cls->kmc_link);
    }
    else
 		panic("Undefined reference to mutex\n");
@@ -49,11 +90,14 @@ kmutex_lock(kmutex_t *mtx)
    if(mtx->km_holder == NULL)
    {
          mtx->km_holder = curthr;
+         kmutex_taken(mtx, 0);
     }
    else
    {
+          uint64_t start = time_cycles();
           dbg_print("Mutex already latched by another process. %s sleeping on the Mutex queue\n",curproc->p_comm);
           sched_sleep_on(&(mtx->km_waitq));
+          kmutex_taken(mtx, start);
    }
 
     apic_setipl(curr_intr_level);
@@ -76,11 +120,14 @@ kmutex_lock_cancellable(kmutex_t *mtx)
         if(mtx->km_holder == NULL)
         {  
          mtx->km_holder = curthr;
+         kmutex_taken(mtx, 0);
         }
         else
          {          
+          uint64_t start = time_cycles();
           dbg_print("Mutex already latched by another process. %s sleeping on the Mutex queue in a cancellable sleep state\n",curproc->p_comm);
           sched_cancellable_sleep_on(&(mtx->km_waitq));
+          kmutex_taken(mtx, start);
           }
         apic_setipl(curr_intr_level);
 
@@ -117,6 +164,11 @@ kmutex_unlock(kmutex_t *mtx)
 
       return;
     }
+   krwlock_stats_t *st = &mtx->km_class->kmc_stats;
+   uint64_t held = time_cycles() - mtx->km_holdstart;
+   if (held > st->krs_maxhold)
+           st->krs_maxhold = held;
+
    mtx->km_holder = sched_wakeup_on(&(mtx->km_waitq));   
      apic_setipl(curr_intr_level);
 
@@ -125,3 +177,9 @@ kmutex_unlock(kmutex_t *mtx)
   return;
 
 }
+
+list_t *
+kmutex_class_list(void)
+{
+        return &kmutex_classes;
+}
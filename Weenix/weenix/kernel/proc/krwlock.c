@@ -0,0 +1,169 @@
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/time.h"
+
+#include "proc/kthread.h"
+#include "proc/krwlock.h"
+#include "main/interrupt.h"
+
+/*
+ * IMPORTANT: Like mutexes, reader/writer locks can _NEVER_ be locked
+ * or unlocked from an interrupt context.
+ *
+ * The lock is handed off directly to waiting threads when it is
+ * released, in the same way as kmutex_unlock() does. When a writer
+ * releases the lock all waiting readers are let in together, otherwise
+ * one waiting writer is. Readers do not take the lock while a writer is
+ * waiting, so a steady stream of readers cannot starve writers, and
+ * handing off to readers first means writers cannot starve readers.
+ */
+
+/* All initialized locks, for statistics. Statically initialized so
+ * that locks can be set up by any init function. */
+static list_t krwlock_all = { &krwlock_all, &krwlock_all };
+
+/**
+ * Ends the current hold of the lock, recording how long it lasted.
+ * If the lock is being handed off, the next hold starts now.
+ *
+ * @param lock the lock being released
+ * @param handoff nonzero if the lock is being handed to waiters
+ */
+static void
+krwlock_endhold(krwlock_t *lock, int handoff)
+{
+        uint64_t now = time_cycles();
+
+        if (now - lock->krw_holdstart > lock->krw_stats.krs_maxhold)
+                lock->krw_stats.krs_maxhold = now - lock->krw_holdstart;
+        if (handoff)
+                lock->krw_holdstart = now;
+}
+
+/**
+ * Sleeps on one of the lock's wait queues until the lock is handed to
+ * the current thread, and records the time spent waiting.
+ *
+ * @param lock the lock being taken
+ * @param q the wait queue to sleep on
+ */
+static void
+krwlock_wait(krwlock_t *lock, ktqueue_t *q)
+{
+        uint64_t start = time_cycles();
+
+        lock->krw_stats.krs_contended++;
+        sched_sleep_on(q);
+        lock->krw_stats.krs_wait += time_cycles() - start;
+}
+
+void
+krwlock_init(krwlock_t *lock, const char *name)
+{
+        KASSERT(NULL != lock);
+
+        sched_queue_init(&lock->krw_rwaitq);
+        sched_queue_init(&lock->krw_wwaitq);
+        lock->krw_readers = 0;
+        lock->krw_writer = NULL;
+        lock->krw_holdstart = 0;
+
+        lock->krw_name = name;
+        memset(&lock->krw_stats, 0, sizeof(lock->krw_stats));
+        list_insert_tail(&krwlock_all, &lock->krw_link);
+}
+
+void
+krwlock_destroy(krwlock_t *lock)
+{
+        KASSERT(NULL == lock->krw_writer && 0 == lock->krw_readers);
+        KASSERT(sched_queue_empty(&lock->krw_rwaitq));
+        KASSERT(sched_queue_empty(&lock->krw_wwaitq));
+
+        list_remove(&lock->krw_link);
+}
+
+void
+krwlock_rdlock(krwlock_t *lock)
+{
+        uint8_t oldipl = apic_getipl();
+        apic_setipl(IPL_HIGH);
+
+        KASSERT(curthr && (curthr != lock->krw_writer));
+
+        lock->krw_stats.krs_acquired++;
+        if (NULL == lock->krw_writer && sched_queue_empty(&lock->krw_wwaitq)) {
+                if (0 == lock->krw_readers++)
+                        lock->krw_holdstart = time_cycles();
+        } else {
+                /* krw_readers is incremented for us when we are woken */
+                krwlock_wait(lock, &lock->krw_rwaitq);
+        }
+
+        apic_setipl(oldipl);
+}
+
+void
+krwlock_wrlock(krwlock_t *lock)
+{
+        uint8_t oldipl = apic_getipl();
+        apic_setipl(IPL_HIGH);
+
+        KASSERT(curthr && (curthr != lock->krw_writer));
+
+        lock->krw_stats.krs_acquired++;
+        if (NULL == lock->krw_writer && 0 == lock->krw_readers) {
+                lock->krw_writer = curthr;
+                lock->krw_holdstart = time_cycles();
+        } else {
+                krwlock_wait(lock, &lock->krw_wwaitq);
+                KASSERT(curthr == lock->krw_writer);
+        }
+
+        apic_setipl(oldipl);
+}
+
+void
+krwlock_unlock(krwlock_t *lock)
+{
+        uint8_t oldipl = apic_getipl();
+        apic_setipl(IPL_HIGH);
+
+        KASSERT(NULL != curthr);
+
+        if (curthr == lock->krw_writer) {
+                lock->krw_writer = NULL;
+                if (!sched_queue_empty(&lock->krw_rwaitq)) {
+                        krwlock_endhold(lock, 1);
+                        lock->krw_readers = lock->krw_rwaitq.tq_size;
+                        sched_broadcast_on(&lock->krw_rwaitq);
+                } else if (!sched_queue_empty(&lock->krw_wwaitq)) {
+                        krwlock_endhold(lock, 1);
+                        lock->krw_writer = sched_wakeup_on(&lock->krw_wwaitq);
+                } else {
+                        krwlock_endhold(lock, 0);
+                }
+        } else {
+                KASSERT(0 < lock->krw_readers && "unlocking a lock which is not held");
+                if (0 == --lock->krw_readers) {
+                        if (!sched_queue_empty(&lock->krw_wwaitq)) {
+                                krwlock_endhold(lock, 1);
+                                lock->krw_writer = sched_wakeup_on(&lock->krw_wwaitq);
+                        } else {
+                                krwlock_endhold(lock, 0);
+                        }
+                }
+        }
+
+        apic_setipl(oldipl);
+}
+
+list_t *
+krwlock_list(void)
+{
+        return &krwlock_all;
+}
@@ -16,9 +16,11 @@
 #include "mm/page.h"
 #include "mm/kmalloc.h"
 
-kthread_t *curthr; /* global */
 static slab_allocator_t *kthread_allocator = NULL;
 
+/* the thread id given to the next thread created */
+static int kthread_next_tid = 1;
+
 #ifdef __MTP__
 /* Stuff for the reaper daemon, which cleans up dead detached threads */
 static proc_t *reapd = NULL;
@@ -27,15 +29,48 @@ static ktqueue_t reapd_waitq;
 static list_t kthread_reapd_deadlist; /* Threads to be cleaned */
 
 static void *kthread_reapd_run(int arg1, void *arg2);
+static int kthread_proc_exiting(proc_t *p);
+#endif
+
+/* Free threads are kept with their links unlinked and their join queue
+ * initialized. */
+static void
+kthread_ctor(void *obj)
+{
+        kthread_t *t = obj;
+
+        memset(t, 0, sizeof(kthread_t));
+        list_link_init(&t->kt_qlink);
+        list_link_init(&t->kt_plink);
+#ifdef __MTP__
+        sched_queue_init(&t->kt_joinq);
 #endif
+}
 
 void
 kthread_init()
 {
-        kthread_allocator = slab_allocator_create("kthread", sizeof(kthread_t));
+        kthread_allocator = slab_allocator_create_ctor("kthread", sizeof(kthread_t),
+                                                       kthread_ctor, NULL);
         KASSERT(NULL != kthread_allocator);
 }
 
+/* extra page for "magic" data */
+#define KSTACK_NPAGES (1 + (DEFAULT_STACK_SIZE >> PAGE_SHIFT))
+
+/* The guard area is the lowest KSTACK_GUARD_WORDS words of the stack.
+ * It is filled with a known pattern when the stack is handed out and
+ * checked when it is freed, so a thread which overflowed its stack is
+ * caught before the memory is reused. */
+#define KSTACK_GUARD_WORDS 16
+#define KSTACK_GUARD_MAGIC 0xbadd57ac
+
+/* Recently freed stacks, linked through their first word, so that
+ * creating a thread does not have to split a buddy block and
+ * destroying one does not have to coalesce it. */
+static char *kstack_cache = NULL;
+static int kstack_cache_count = 0;
+
 /**
  * Allocates a new kernel stack.
  *
@@ -45,24 +80,69 @@ kthread_init()
 static char *
 alloc_stack(void)
 {
-
-        /* extra page for "magic" data */
         char *kstack;
-        int npages = 1 + (DEFAULT_STACK_SIZE >> PAGE_SHIFT);
-        kstack = (char *)page_alloc_n(npages);
-        
+
+        if (NULL != kstack_cache) {
+                kstack = kstack_cache;
+                kstack_cache = *(char **)kstack;
+                kstack_cache_count--;
+        } else if (NULL == (kstack = (char *)page_alloc_n(KSTACK_NPAGES))) {
+                return NULL;
+        }
+
+#if KSTACK_GUARD
+        int i;
+        for (i = 0; i < KSTACK_GUARD_WORDS; i++)
+                ((uint32_t *)kstack)[i] = KSTACK_GUARD_MAGIC;
+#endif
+
         return kstack;
 }
 
 /**
- * Frees a stack allocated with alloc_stack.
+ * Frees a stack allocated with alloc_stack. The stack is kept in the
+ * stack cache unless the cache already holds KSTACK_CACHE_MAX stacks.
  *
  * @param stack the stack to free
  */
 static void
 free_stack(char *stack)
 {
-        page_free_n(stack, 1 + (DEFAULT_STACK_SIZE >> PAGE_SHIFT));
+#if KSTACK_GUARD
+        int i;
+        for (i = 0; i < KSTACK_GUARD_WORDS; i++) {
+                if (KSTACK_GUARD_MAGIC != ((uint32_t *)stack)[i])
+                        panic("kernel stack overflow detected on stack 0x%p\n", stack);
+        }
+#endif
+
+        if (KSTACK_CACHE_MAX > kstack_cache_count) {
+                *(char **)stack = kstack_cache;
+                kstack_cache = stack;
+                kstack_cache_count++;
+        } else {
+                page_free_n(stack, KSTACK_NPAGES);
+        }
+}
+
+int
+kthread_stacks_reclaim(int target)
+{
+        int npages_freed = 0;
+        char *stack;
+
+        while (NULL != kstack_cache) {
+                stack = kstack_cache;
+                kstack_cache = *(char **)stack;
+                kstack_cache_count--;
+
+                page_free_n(stack, KSTACK_NPAGES);
+                npages_freed += KSTACK_NPAGES;
+
+                if ((target > 0) && (npages_freed >= target))
+                        break;
+        }
+        return npages_freed;
 }
 
 /*
@@ -80,18 +160,31 @@ kthread_create(struct proc *p, kthread_func_t func, long arg1, void *arg2)
         KASSERT(NULL != p);
 
         kthread_t *new_thread = (kthread_t *)slab_obj_alloc(kthread_allocator);
-        memset(new_thread,0,sizeof(kthread_t));
+        if (NULL == new_thread)
+                return NULL;
+        KASSERT(!list_link_is_linked(&new_thread->kt_plink));
         
-        new_thread->kt_kstack = alloc_stack();
+        if (NULL == (new_thread->kt_kstack = alloc_stack())) {
+                slab_obj_free(kthread_allocator, new_thread);
+                return NULL;
+        }
         
         new_thread->kt_proc = p;
+        new_thread->kt_tid = kthread_next_tid++;
+        new_thread->kt_retval = NULL;
+        new_thread->kt_errno = 0;
         new_thread->kt_cancelled = 0;
         new_thread->kt_state = KT_RUN;
+        new_thread->kt_prio = 0;
+        new_thread->kt_ticks = 0;
+        new_thread->kt_need_resched = 0;
+        new_thread->kt_wexcl = 0;
         new_thread->kt_wchan = NULL;
-
-        /*sched_queue_init((new_thread->kt_wchan));*/
-        list_init(&(new_thread->kt_qlink));
-        list_init(&(new_thread->kt_plink));
+        new_thread->kt_cpu = curcpu()->cpu_id;
+#ifdef __MTP__
+        new_thread->kt_detached = 0;
+        KASSERT(sched_queue_empty(&new_thread->kt_joinq));
+#endif
 
         context_setup(&(new_thread->kt_ctx),(context_func_t)func, arg1, arg2,
                    new_thread->kt_kstack, DEFAULT_STACK_SIZE, new_thread->kt_proc->p_pagedir);
@@ -105,6 +198,7 @@ void
 kthread_destroy(kthread_t *t)
 {
         KASSERT(t && t->kt_kstack);
+        KASSERT(!list_link_is_linked(&t->kt_qlink));
         
         free_stack(t->kt_kstack);
 
@@ -144,6 +238,10 @@ kthread_cancel(kthread_t *kthr, void *retval)
         {
                       kthr->kt_cancelled = 1; 
                       kthr->kt_retval = retval;    
+                      /* it may be running user code on another processor,
+                       * where it only notices once it enters the kernel */
+                      if (kthr->kt_state == KT_RUN)
+                              sched_preempt(kthr);
         }        
 
 }
@@ -169,7 +267,18 @@ kthread_exit(void *retval)
 
     curthr->kt_retval = retval;    
     curthr->kt_state = KT_EXITED;
+#ifdef __MTP__
+    if (kthread_proc_exiting(curproc)) {
+            proc_thread_exited(retval);
+    } else if (curthr->kt_detached) {
+            list_insert_tail(&kthread_reapd_deadlist, &curthr->kt_qlink);
+            sched_wakeup_on(&reapd_waitq);
+    } else {
+            sched_broadcast_on(&curthr->kt_joinq);
+    }
+#else
     proc_thread_exited(retval); 
+#endif
     sched_switch(); 
 }
 
@@ -193,17 +302,86 @@ kthread_clone(kthread_t *thr)
  * unless your weenix is perfect.
  */
 #ifdef __MTP__
+/*
+ * Called by an exiting thread. If the thread is the last one in p
+ * which has not exited, the whole process is exiting: its exited
+ * threads are destroyed by its parent in do_waitpid, so any which are
+ * still waiting for the reaper are taken back from it.
+ *
+ * @return 1 if the current thread is the last thread of p, otherwise 0
+ */
+static int
+kthread_proc_exiting(proc_t *p)
+{
+        kthread_t *thr;
+
+        list_iterate_begin(&p->p_threads, thr, kthread_t, kt_plink) {
+                if (curthr != thr && KT_EXITED != thr->kt_state)
+                        return 0;
+        } list_iterate_end();
+
+        list_iterate_begin(&kthread_reapd_deadlist, thr, kthread_t, kt_qlink) {
+                if (p == thr->kt_proc)
+                        list_remove(&thr->kt_qlink);
+        } list_iterate_end();
+        return 1;
+}
+
+kthread_t *
+kthread_lookup(proc_t *p, int tid)
+{
+        kthread_t *thr;
+
+        list_iterate_begin(&p->p_threads, thr, kthread_t, kt_plink) {
+                if (tid == thr->kt_tid)
+                        return thr;
+        } list_iterate_end();
+        return NULL;
+}
+
+/*
+ * A detached thread is destroyed by the reaper daemon when it exits,
+ * or right away if it has already exited. A thread which somebody is
+ * waiting to join cannot be detached.
+ */
 int
 kthread_detach(kthread_t *kthr)
 {
-        NOT_YET_IMPLEMENTED("MTP: kthread_detach");
+        KASSERT(NULL != kthr);
+
+        if (kthr->kt_detached || !sched_queue_empty(&kthr->kt_joinq))
+                return -EINVAL;
+
+        kthr->kt_detached = 1;
+        if (KT_EXITED == kthr->kt_state)
+                kthread_destroy(kthr);
         return 0;
 }
 
+/*
+ * Waits for kthr to exit, then destroys it. Only one thread may wait
+ * to join a given thread, and a detached thread cannot be joined.
+ */
 int
 kthread_join(kthread_t *kthr, void **retval)
 {
-        NOT_YET_IMPLEMENTED("MTP: kthread_join");
+        KASSERT(NULL != kthr);
+
+        if (curthr == kthr)
+                return -EDEADLK;
+        if (curproc != kthr->kt_proc)
+                return -ESRCH;
+        if (kthr->kt_detached || !sched_queue_empty(&kthr->kt_joinq))
+                return -EINVAL;
+
+        while (KT_EXITED != kthr->kt_state) {
+                if (sched_cancellable_sleep_on(&kthr->kt_joinq))
+                        return -EINTR;
+        }
+
+        if (NULL != retval)
+                *retval = kthr->kt_retval;
+        kthread_destroy(kthr);
         return 0;
 }
 
@@ -213,21 +391,59 @@ kthread_join(kthread_t *kthr, void **retval)
 static __attribute__((unused)) void
 kthread_reapd_init()
 {
-        NOT_YET_IMPLEMENTED("MTP: kthread_reapd_init");
+        sched_queue_init(&reapd_waitq);
+        list_init(&kthread_reapd_deadlist);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        reapd = proc_create("reapd");
+        KASSERT(NULL != reapd);
+        reapd_thr = kthread_create(reapd, kthread_reapd_run, 0, NULL);
+        KASSERT(NULL != reapd_thr);
+
+        sched_make_runnable(reapd_thr);
 }
 init_func(kthread_reapd_init);
 init_depends(sched_init);
 
+/*
+ * Cancels the reaper and waits for it to exit.
+ */
 void
 kthread_reapd_shutdown()
 {
-        NOT_YET_IMPLEMENTED("MTP: kthread_reapd_shutdown");
+        int pid, child;
+
+        KASSERT(NULL != reapd_thr);
+        pid = reapd->p_pid;
+        kthread_cancel(reapd_thr, (void *) 0);
+        reapd_thr = NULL;
+
+        child = do_waitpid(pid, 0, NULL);
+        KASSERT(pid == child && "waited on process other than reapd");
+        reapd = NULL;
 }
 
+/*
+ * Destroys the detached threads on the dead list, then sleeps until
+ * more of them exit. Both arguments unused.
+ */
 static void *
 kthread_reapd_run(int arg1, void *arg2)
 {
-        NOT_YET_IMPLEMENTED("MTP: kthread_reapd_run");
+        kthread_t *thr;
+
+        while (1) {
+                while (!list_empty(&kthread_reapd_deadlist)) {
+                        thr = list_head(&kthread_reapd_deadlist, kthread_t, kt_qlink);
+                        list_remove(&thr->kt_qlink);
+                        KASSERT(KT_EXITED == thr->kt_state && thr->kt_detached);
+                        kthread_destroy(thr);
+                }
+
+                if (sched_cancellable_sleep_on(&reapd_waitq))
+                        do_exit(0);
+        }
         return (void *) 0;
 }
 #endif
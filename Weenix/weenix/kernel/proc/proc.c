@@ -4,6 +4,7 @@
 #include "errno.h"
 
 #include "util/debug.h"
+#include "util/bits.h"
 #include "util/list.h"
 #include "util/string.h"
 #include "util/printf.h"
@@ -27,49 +28,105 @@
 #include "fs/vnode.h"
 #include "fs/file.h"
 
-proc_t *curproc = NULL; /* global */
 static slab_allocator_t *proc_allocator = NULL;
 
+#define PROC_PIDMAP_WORDS (PROC_MAX_COUNT / 32)
+#define PROC_HASH_SIZE    256 /* must be a power of 2 */
+#define PROC_HASH(pid)    (&_proc_hash[(pid) & (PROC_HASH_SIZE - 1)])
+
 static list_t _proc_list;
+static list_t _proc_hash[PROC_HASH_SIZE];         /* processes, keyed by PID */
+static uint32_t _proc_pidmap[PROC_PIDMAP_WORDS];  /* bit set iff the PID is in use */
 static proc_t *proc_initproc = NULL; /* Pointer to the init process (PID 1) */
 
+/* Free processes are kept with their lists and wait queue initialized
+ * and their links unlinked, which is how _proc_free leaves them. */
+static void
+proc_ctor(void *obj)
+{
+        proc_t *p = obj;
+
+        memset(p, 0, sizeof(proc_t));
+        list_init(&p->p_threads);
+        list_init(&p->p_children);
+        sched_queue_init(&p->p_wait);
+        list_link_init(&p->p_list_link);
+        list_link_init(&p->p_hash_link);
+        list_link_init(&p->p_child_link);
+}
+
 void
 proc_init()
 {
+        int i;
+
         list_init(&_proc_list);
-        proc_allocator = slab_allocator_create("proc", sizeof(proc_t));
+        for (i = 0; i < PROC_HASH_SIZE; i++)
+                list_init(&_proc_hash[i]);
+        memset(_proc_pidmap, 0, sizeof(_proc_pidmap));
+        proc_allocator = slab_allocator_create_ctor("proc", sizeof(proc_t),
+                                                    proc_ctor, NULL);
         KASSERT(proc_allocator != NULL);
 }
 
 static pid_t next_pid = 0;
 
 /**
- * Returns the next available PID.
+ * Returns the next available PID and marks it as in use.
  *
- * Note: Where n is the number of running processes, this algorithm is
- * worst case O(n^2). As long as PIDs never wrap around it is O(n).
+ * PIDs are handed out in increasing order, wrapping around at
+ * PROC_MAX_COUNT. The PID bitmap is searched a word at a time, so
+ * this is O(PROC_MAX_COUNT / 32) in the worst case, and usually the
+ * first word looked at has a free PID.
  *
- * @return the next available PID
+ * @return the next available PID, or -1 if there is none
  */
 static int
 _proc_getid()
 {
-        proc_t *p;
-        pid_t pid = next_pid;
-        while (1) {
-failed:
-                list_iterate_begin(&_proc_list, p, proc_t, p_list_link) {
-                        if (p->p_pid == pid) {
-                                if ((pid = (pid + 1) % PROC_MAX_COUNT) == next_pid) {
-                                        return -1;
-                                } else {
-                                        goto failed;
-                                }
-                        }
-                } list_iterate_end();
-                next_pid = (pid + 1) % PROC_MAX_COUNT;
-                return pid;
+        int n, w;
+        uint32_t free, skip;
+        pid_t pid;
+
+        /* The first word is looked at twice: once for the PIDs from
+         * next_pid up, and again after wrapping around for the PIDs
+         * below next_pid. */
+        w = next_pid >> 5;
+        skip = (1U << (next_pid & 0x1f)) - 1;
+        for (n = 0; n <= PROC_PIDMAP_WORDS; n++) {
+                if (0 != (free = ~(_proc_pidmap[w] | skip))) {
+                        pid = (w << 5) + bit_ffs(free) - 1;
+                        bit_flip(_proc_pidmap, pid);
+                        next_pid = (pid + 1) % PROC_MAX_COUNT;
+                        return pid;
+                }
+                skip = 0;
+                w = (w + 1) % PROC_PIDMAP_WORDS;
         }
+        return -1;
+}
+
+/**
+ * Removes a process which has been waited on from the process list
+ * and the PID hash, releases its PID and frees it.
+ *
+ * @param p the process to free
+ */
+static void
+_proc_free(proc_t *p)
+{
+        KASSERT(bit_check(_proc_pidmap, p->p_pid));
+
+        if (list_link_is_linked(&(p->p_list_link)))
+                list_remove(&(p->p_list_link));
+        if (list_link_is_linked(&(p->p_hash_link)))
+                list_remove(&(p->p_hash_link));
+        if (list_link_is_linked(&(p->p_child_link)))
+                list_remove(&(p->p_child_link));
+        bit_flip(_proc_pidmap, p->p_pid);
+
+        dbg_print("FREEING RESOURCES FOR PROCESS %s\n", p->p_comm);
+        slab_obj_free(proc_allocator, p);
 }
 
 /*
@@ -87,9 +144,18 @@ proc_create(char *name)
         int i;
 
         proc_t *new = (proc_t *)slab_obj_alloc(proc_allocator);
+        if (NULL == new)
+                return NULL;
+
         pid_t pid = _proc_getid();
+        if (-1 == pid) {
+                /* every PID is in use */
+                slab_obj_free(proc_allocator, new);
+                return NULL;
+        }
 
-        memset(new,0,sizeof(proc_t));
+        KASSERT(list_empty(&new->p_threads) && list_empty(&new->p_children));
+        KASSERT(sched_queue_empty(&new->p_wait));
 
         if(!pid)
           KASSERT(PID_IDLE != pid || list_empty(&_proc_list));
@@ -106,6 +172,7 @@ proc_create(char *name)
         {
           new->p_files[i] = NULL;
         }
+        new->p_cwd = NULL;
 
         if(pid > 2)
         {
@@ -120,12 +187,12 @@ proc_create(char *name)
         new->p_pagedir = pt_get();
         new->p_status = 0;
         strcpy(new->p_comm,name);
-
-        list_init(&(new->p_threads));
-        list_init(&(new->p_children));
-        sched_queue_init(&(new->p_wait));
+        new->p_brk = NULL;
+        new->p_start_brk = NULL;
+        new->p_vmmap = NULL;
         
         list_insert_before(&_proc_list, &(new->p_list_link));
+        list_insert_head(PROC_HASH(pid), &(new->p_hash_link));
         
         if(pid > 0)
           list_insert_before(&((new->p_pproc)->p_children), &(new->p_child_link)); 
@@ -258,11 +325,13 @@ proc_kill(proc_t *p, int status)
 
   else
   {
+    /* the threads exit later, so their retval must outlive this call */
+    p->p_status = status;
     list_iterate_begin(&(p->p_threads), t, kthread_t, kt_plink) {
                 
           if(t->kt_state != KT_EXITED)
           {
-            kthread_cancel(t, (void*) &status);
+            kthread_cancel(t, (void*) &p->p_status);
           }
     }list_iterate_end();
          /*NOT_YET_IMPLEMENTED("PROCS: proc_kill");*/
@@ -330,7 +399,11 @@ proc_t *
 proc_lookup(int pid)
 {
         proc_t *p;
-        list_iterate_begin(&_proc_list, p, proc_t, p_list_link) {
+
+        if (0 > pid || PROC_MAX_COUNT <= pid)
+                return NULL;
+
+        list_iterate_begin(PROC_HASH(pid), p, proc_t, p_hash_link) {
                 if (p->p_pid == pid) {
                         return p;
                 }
@@ -356,9 +429,15 @@ void
 proc_thread_exited(void *retval)
 {
         
-        /*remove the thread from parent's list of threads.*/
-     
+#ifdef __MTP__
+        /* kthread_exit only calls this for the last thread of the
+         * process. Threads which exit through do_exit return a pointer
+         * to the status, any other retval came from a thread which
+         * returned on its own, so the process exits normally. */
+         proc_cleanup(retval == &curproc->p_status ? curproc->p_status : 0);
+#else
          proc_cleanup(*((int *)retval)); 
+#endif
           
            
 }
@@ -442,9 +521,9 @@ do_waitpid(pid_t pid, int options, int *status)
                       {
                           KASSERT(KT_EXITED == thr->kt_state);
                           kthread_destroy(thr); 
-                          goto haha;
                       }
                   } list_iterate_end();   
+                  goto haha;
                 }   
           }list_iterate_end();
 haha:  
@@ -455,13 +534,7 @@ haha:
           }
           else if (count != 0 )
           {
-             if (list_link_is_linked(&(p->p_list_link)))
-                    list_remove(&(p->p_list_link));
-              if (list_link_is_linked(&(p->p_child_link)))
-                    list_remove(&(p->p_child_link)); 
-
-              dbg_print("FREEING RESOURCES FOR PROCESS %s\n", p->p_comm);        
-             slab_obj_free(proc_allocator,p);
+             _proc_free(p);
              break;
           } 
 
@@ -533,13 +606,7 @@ haha:
                         kthread_destroy(thr);  
                    } list_iterate_end();
           
-       if (list_link_is_linked(&(p->p_list_link)))
-                    list_remove(&(p->p_list_link));
-       if (list_link_is_linked(&(p->p_child_link)))
-                    list_remove(&(p->p_child_link));         
-
-             dbg_print("FREEING RESOURCES FOR PROCESS %s\n", p->p_comm); 
-             slab_obj_free(proc_allocator,p);         
+       _proc_free(p);
     }   
         return pid;
 }
@@ -553,8 +620,24 @@ haha:
 void
 do_exit(int status)
 {
-/*if mtp puy in loop      */
+#ifdef __MTP__
+  kthread_t *thr;
+
+  /* a thread which was cancelled exits with the status it was given */
+  if (curthr->kt_cancelled)
+      kthread_exit(curthr->kt_retval);
+
+  /* the other threads exit when they next run, whichever exits last
+   * cleans up the process with this status */
+  curproc->p_status = status;
+  list_iterate_begin(&curproc->p_threads, thr, kthread_t, kt_plink) {
+      if (thr != curthr && KT_EXITED != thr->kt_state)
+          kthread_cancel(thr, (void*) &curproc->p_status);
+  } list_iterate_end();
+  kthread_exit((void*) &curproc->p_status);
+#else
   kthread_cancel(curthr, (void*) &status );
+#endif
 }
 
 size_t
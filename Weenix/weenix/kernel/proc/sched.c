@@ -2,19 +2,82 @@
 #include "errno.h"
 
 #include "main/interrupt.h"
+#include "main/smp.h"
 
 #include "proc/sched.h"
 #include "proc/kthread.h"
 
 #include "util/init.h"
+#include "util/bits.h"
 #include "util/debug.h"
+#include "util/printf.h"
+#include "util/string.h"
+#include "util/time.h"
 
-static ktqueue_t kt_runq;
+#include "mm/page.h"
+#include "mm/pagetable.h"
+
+/*
+ * Each processor has its own run queue, a multi-level feedback queue.
+ * There is one ktqueue_t per priority level, level 0 being the highest
+ * priority. Bit i of rq_bitmap is set iff rq_levels[i] is not empty,
+ * so the next thread to run can be found without looking at every
+ * level.
+ *
+ * Threads start at level 0. A thread which is preempted because it used
+ * up its quantum (SCHED_QUANTUM << level clock ticks) is demoted one level.
+ * A thread which is woken up from a sleep is boosted back to level 0, so
+ * that I/O-bound threads do not wait behind CPU-bound ones. So that a
+ * CPU-bound thread at a low level is not starved by a steady stream of
+ * higher priority threads, every SCHED_BOOST_TICKS clock ticks all
+ * threads are moved back to level 0.
+ *
+ * A thread goes back on the run queue of the processor it last ran on,
+ * whose caches may still hold its data. A processor with nothing on its
+ * own run queue steals the next thread from the longest one before it
+ * goes idle, and enqueueing a thread wakes up an idle processor so that
+ * it can do so.
+ */
+typedef struct runq {
+        ktqueue_t       rq_levels[SCHED_NLEVELS];
+        uint32_t        rq_bitmap;
+        int             rq_size;        /* threads on all levels */
+
+        uint32_t        rq_switches;    /* threads switched to */
+        uint32_t        rq_steals;      /* threads taken from other processors */
+        uint32_t        rq_halts;       /* times the processor went idle */
+} runq_t;
+
+static runq_t kt_runq[SMP_MAX_CPUS];
+
+/* where each processor runs its idle loop when it has no thread to run */
+static context_t sched_idlectx[SMP_MAX_CPUS];
+
+#define runq_contains(q) \
+        ((char *)(q) >= (char *)&kt_runq[0] && (char *)(q) < (char *)&kt_runq[SMP_MAX_CPUS])
+
+static void *sched_idle_run(int arg1, void *arg2);
 
 static __attribute__((unused)) void
 sched_init(void)
 {
-        sched_queue_init(&kt_runq);
+        int cpu, i;
+        void *stack;
+
+        KASSERT(SCHED_NLEVELS <= 32);
+        for (cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+                for (i = 0; i < SCHED_NLEVELS; i++)
+                        sched_queue_init(&kt_runq[cpu].rq_levels[i]);
+                kt_runq[cpu].rq_bitmap = 0;
+                kt_runq[cpu].rq_size = 0;
+        }
+
+        /* the application processors run their idle loops on the
+         * stacks they start on, see sched_idle() */
+        stack = page_alloc_n(IDLE_STACK_SIZE >> PAGE_SHIFT);
+        KASSERT(NULL != stack && "Ran out of memory while booting.");
+        context_setup(&sched_idlectx[0], sched_idle_run, 0, NULL,
+                      stack, IDLE_STACK_SIZE, pt_get());
 }
 init_func(sched_init);
 
@@ -77,6 +140,206 @@ ktqueue_remove(ktqueue_t *q, kthread_t *thr)
         q->tq_size--;
 }
 
+/*** PRIVATE RUN QUEUE MANIPULATION FUNCTIONS ***/
+/**
+ * Places a runnable thread on the run queue for its priority level on
+ * its processor, and wakes up an idle processor to run it. The IPL
+ * must be high.
+ *
+ * @param thr the thread to place on the run queue
+ */
+static void
+runq_enqueue(kthread_t *thr)
+{
+        runq_t *rq = &kt_runq[thr->kt_cpu];
+        int cpu;
+
+        KASSERT(0 <= thr->kt_prio && SCHED_NLEVELS > thr->kt_prio);
+        KASSERT(0 <= thr->kt_cpu && smp_ncpus > thr->kt_cpu);
+
+        thr->kt_state = KT_RUN;
+        ktqueue_enqueue(&rq->rq_levels[thr->kt_prio], thr);
+        rq->rq_bitmap |= (1 << thr->kt_prio);
+        rq->rq_size++;
+
+        /* prefer the thread's own processor, otherwise any idle one
+         * will steal the thread */
+        if (smp_cpus[thr->kt_cpu].cpu_idle) {
+                smp_resched(thr->kt_cpu);
+                return;
+        }
+        for (cpu = 0; cpu < smp_ncpus; cpu++) {
+                if (smp_cpus[cpu].cpu_idle) {
+                        smp_resched(cpu);
+                        return;
+                }
+        }
+}
+
+/**
+ * Removes the oldest thread from the highest priority non-empty
+ * level of a run queue. The IPL must be high.
+ *
+ * @param rq the run queue to take a thread from
+ * @return the dequeued thread, or NULL if the run queue is empty
+ */
+static kthread_t *
+runq_dequeue(runq_t *rq)
+{
+        kthread_t *thr;
+        int level;
+
+        if (0 == (level = bit_ffs(rq->rq_bitmap)))
+                return NULL;
+        --level;
+
+        thr = ktqueue_dequeue(&rq->rq_levels[level]);
+        KASSERT(NULL != thr);
+        if (sched_queue_empty(&rq->rq_levels[level]))
+                rq->rq_bitmap &= ~(1 << level);
+        rq->rq_size--;
+
+        return thr;
+}
+
+/**
+ * Picks the next thread for a processor to run: the next one on its
+ * own run queue, or if that is empty the next one on the longest run
+ * queue of another processor. Threads which exited while they were
+ * still on a run queue are skipped. The IPL must be high.
+ *
+ * @param cpu the processor looking for a thread
+ * @return the thread to run, or NULL if every run queue is empty
+ */
+static kthread_t *
+runq_pick(cpu_t *cpu)
+{
+        runq_t *rq = &kt_runq[cpu->cpu_id];
+        kthread_t *thr;
+        int i, victim;
+
+        while (NULL != (thr = runq_dequeue(rq))) {
+                if (KT_EXITED != thr->kt_state)
+                        return thr;
+        }
+
+        for (;;) {
+                victim = -1;
+                for (i = 0; i < smp_ncpus; i++) {
+                        if (0 < kt_runq[i].rq_size
+                            && (0 > victim || kt_runq[i].rq_size > kt_runq[victim].rq_size))
+                                victim = i;
+                }
+                if (0 > victim)
+                        return NULL;
+
+                thr = runq_dequeue(&kt_runq[victim]);
+                if (KT_EXITED != thr->kt_state) {
+                        rq->rq_steals++;
+                        return thr;
+                }
+        }
+}
+
+/**
+ * Moves a thread which is being woken up to the highest priority
+ * level and places it on the run queue.
+ *
+ * @param thr the thread being woken up
+ */
+static void
+runq_wakeup(kthread_t *thr)
+{
+        thr->kt_wexcl = 0;
+        thr->kt_prio = 0;
+        runq_enqueue(thr);
+}
+
+/**
+ * Makes a thread the current thread of this processor and switches to
+ * it. The IPL must be high.
+ *
+ * @param oldc the context to save the current state in
+ * @param thr the thread to switch to
+ */
+static void
+sched_dispatch(context_t *oldc, kthread_t *thr)
+{
+        cpu_t *cpu = curcpu();
+
+        curthr = thr;
+        curproc = thr->kt_proc;
+        thr->kt_ticks = 0;
+        thr->kt_need_resched = 0;
+        thr->kt_cpu = cpu->cpu_id;
+        kt_runq[cpu->cpu_id].rq_switches++;
+
+        context_switch(oldc, &thr->kt_ctx);
+}
+
+/**
+ * The idle loop of the processor calling it. It runs with the IPL high
+ * on the processor's own stack, so that the thread which was running
+ * last can be picked up by another processor while this one waits. If
+ * there is nothing to run it zeroes free pages ahead of time, and once
+ * there are none left to zero it halts until an interrupt comes in.
+ * Both are done without the kernel lock and with the IPL low, so that
+ * neither other processors nor interrupts are held up. Never returns.
+ */
+static void
+sched_idle_loop(void)
+{
+        cpu_t *cpu = curcpu();
+        kthread_t *thr;
+        void *page;
+
+        apic_setipl(IPL_HIGH);
+        for (;;) {
+                KASSERT(NULL == curthr);
+                if (NULL != (thr = runq_pick(cpu))) {
+                        dbg(DBG_THR, "PROCESS CURRENTLY EXECUTING: %s\n", thr->kt_proc->p_comm);
+                        sched_dispatch(&sched_idlectx[cpu->cpu_id], thr);
+                        continue;
+                }
+
+                if (NULL != (page = page_zero_take())) {
+                        smp_kernel_unlock();
+                        apic_setipl(IPL_LOW);
+                        memset(page, 0, PAGE_SIZE);
+
+                        intr_disable();
+                        apic_setipl(IPL_HIGH);
+                        smp_kernel_lock();
+                        intr_enable();
+                        page_zero_give(page);
+                        continue;
+                }
+
+                kt_runq[cpu->cpu_id].rq_halts++;
+                intr_disable();
+                cpu->cpu_idle = 1;
+                smp_kernel_unlock();
+                apic_setipl(IPL_LOW);
+                intr_wait();
+
+                intr_disable();
+                apic_setipl(IPL_HIGH);
+                smp_kernel_lock();
+                cpu->cpu_idle = 0;
+                intr_enable();
+        }
+}
+
+/**
+ * The boot processor's idle context starts here.
+ */
+static void *
+sched_idle_run(int arg1, void *arg2)
+{
+        sched_idle_loop();
+        return NULL;
+}
+
 /*** PUBLIC KTQUEUE MANIPULATION FUNCTIONS ***/
 void
 sched_queue_init(ktqueue_t *q)
@@ -109,6 +372,18 @@ sched_sleep_on(ktqueue_t *q)
 }
 
 
+/*
+ * Like sched_sleep_on, but the thread is only woken by
+ * sched_wakeup_excl_on when it is one of the first nexcl exclusive
+ * waiters on the queue.
+ */
+void
+sched_sleep_on_exclusive(ktqueue_t *q)
+{
+        curthr->kt_wexcl = 1;
+        sched_sleep_on(q);
+}
+
 /*
  * Similar to sleep on, but the sleep can be cancelled.
  *
@@ -134,6 +409,62 @@ sched_cancellable_sleep_on(ktqueue_t *q)
 
 }
 
+/* a thread in a timed sleep, and the queue it sleeps on */
+typedef struct sched_timeout {
+        kthread_t      *st_thr;
+        ktqueue_t      *st_queue;
+        int             st_expired;
+} sched_timeout_t;
+
+/*
+ * Timer callback for sched_sleep_on_timeout. Runs from the clock
+ * interrupt, so the IPL is already high. If the thread has not been
+ * woken up yet, take it off its queue and make it runnable.
+ */
+static void
+sched_timeout_expire(void *arg)
+{
+        sched_timeout_t *st = (sched_timeout_t *)arg;
+
+        if (st->st_queue == st->st_thr->kt_wchan) {
+                st->st_expired = 1;
+                ktqueue_remove(st->st_queue, st->st_thr);
+                runq_wakeup(st->st_thr);
+        }
+}
+
+/*
+ * A cancellable sleep which also ends once the given number of clock
+ * ticks have passed. The timer and its bookkeeping live on the
+ * sleeping thread's stack, since they are only needed until the
+ * thread wakes up.
+ */
+int
+sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks)
+{
+        sched_timeout_t st;
+        ktimer_t timer;
+        int ret;
+
+        st.st_thr = curthr;
+        st.st_queue = q;
+        st.st_expired = 0;
+        timer_init(&timer, sched_timeout_expire, &st);
+
+        uint8_t oldipl = apic_getipl();
+        apic_setipl(IPL_HIGH);
+
+        timer_add(&timer, ticks);
+        ret = sched_cancellable_sleep_on(q);
+        timer_del(&timer);
+
+        apic_setipl(oldipl);
+
+        if (0 == ret && st.st_expired)
+                ret = -ETIMEDOUT;
+        return ret;
+}
+
 kthread_t *
 sched_wakeup_on(ktqueue_t *q)
 {
@@ -145,8 +476,7 @@ sched_wakeup_on(ktqueue_t *q)
         
         KASSERT((thr->kt_state == KT_SLEEP) || (thr->kt_state == KT_SLEEP_CANCELLABLE));
 
-        thr->kt_state = KT_RUN;
-        ktqueue_enqueue(&kt_runq, thr);
+        runq_wakeup(thr);
         
         return thr;
 }
@@ -159,8 +489,7 @@ sched_broadcast_on(ktqueue_t *q)
        while(!list_empty(&(q->tq_list)))
        {
                 temp = ktqueue_dequeue(q);
-                temp->kt_state = KT_RUN;
-                ktqueue_enqueue(&kt_runq, temp);
+                runq_wakeup(temp);
        }
 
        sched_queue_init(q);
@@ -168,6 +497,28 @@ sched_broadcast_on(ktqueue_t *q)
 
 }
 
+int
+sched_wakeup_excl_on(ktqueue_t *q, int nexcl)
+{
+        kthread_t *thr;
+        int nwoken = 0;
+
+        /* oldest waiters are at the tail of the queue */
+        list_iterate_reverse(&q->tq_list, thr, kthread_t, kt_qlink) {
+                KASSERT((thr->kt_state == KT_SLEEP) || (thr->kt_state == KT_SLEEP_CANCELLABLE));
+                if (thr->kt_wexcl) {
+                        if (0 >= nexcl)
+                                continue;
+                        nexcl--;
+                }
+                ktqueue_remove(q, thr);
+                runq_wakeup(thr);
+                nwoken++;
+        } list_iterate_end();
+
+        return nwoken;
+}
+
 /*
  * If the thread's sleep is cancellable, we set the kt_cancelled
  * flag and remove it from the queue. Otherwise, we just set the
@@ -183,10 +534,9 @@ sched_cancel(struct kthread *kthr)
         if(kthr->kt_state == KT_SLEEP_CANCELLABLE)
         {
                 kthr->kt_cancelled = 1;
-                kthr->kt_state = KT_RUN;
                 ktqueue_t *q = kthr->kt_wchan;
                 ktqueue_remove(q,kthr);
-                ktqueue_enqueue(&kt_runq,kthr);
+                runq_wakeup(kthr);
         }
 }
 
@@ -198,7 +548,8 @@ sched_cancel(struct kthread *kthr)
  * re-enable interrupts when you are done. This is analagous to
  * locking a mutex before modifying a data structure shared between
  * threads. Masking interrupts is accomplished by setting the IPL to
- * high.
+ * high. Other processors are kept out by the kernel lock, which the
+ * processor running this already holds.
  *
  * Once you have masked interrupts, you need to remove a thread from
  * the run queue and switch into its context from the currently
@@ -207,79 +558,165 @@ sched_cancel(struct kthread *kthr)
  * If there are no threads on the run queue (assuming you do not have
  * any bugs), then all kernel threads are waiting for an interrupt
  * (for example, when reading from a block device, a kernel thread
- * will wait while the block device seeks). You will need to re-enable
- * interrupts and wait for one to occur in the hopes that a thread
- * gets put on the run queue from the interrupt context.
- *
- * The proper way to do this is with the intr_wait call. See
- * interrupt.h for more details on intr_wait.
- *
- * Note: When waiting for an interrupt, don't forget to modify the
- * IPL. If the IPL of the currently executing thread masks the
- * interrupt you are waiting for, the interrupt will never happen, and
- * your run queue will remain empty. This is very subtle, but
- * _EXTREMELY_ important.
+ * will wait while the block device seeks). The processor switches to
+ * its idle context, see sched_idle_loop(), rather than waiting on the
+ * stack of the thread which is going to sleep, since another
+ * processor may wake that thread up and run it in the meantime.
  *
  * Note: Don't forget to set curproc and curthr. When sched_switch
  * returns, a different thread should be executing than the thread
  * which was executing when sched_switch was called.
  *
- * Note: The IPL is process specific.
+ * Note: The IPL is process specific. It is put back when the thread
+ * which called sched_switch runs again, which may be on another
+ * processor.
  */
 void
 sched_switch(void)
 {
-       /*MASKING THE INTERRUPT LEVELS*/
         uint8_t curr_intr_level = apic_getipl();
         apic_setipl(IPL_HIGH);
 
-        if(list_empty(&(kt_runq.tq_list)))
-        {
-                apic_setipl(IPL_LOW);
-                intr_wait();
-                apic_setipl(curr_intr_level);
-                sched_switch();          
+        cpu_t *cpu = curcpu();
+        kthread_t *old_thr = curthr;
+        kthread_t *new_thr;
+
+        dbg(DBG_THR,"PROCESS FORMERLY EXECUTING: %s\n", curthr->kt_proc->p_comm);
+
+        if (NULL != (new_thr = runq_pick(cpu))) {
+                dbg(DBG_THR,"PROCESS CURRENTLY EXECUTING: %s\n", new_thr->kt_proc->p_comm);
+                sched_dispatch(&old_thr->kt_ctx, new_thr);
+        } else {
+                curthr = NULL;
+                curproc = NULL;
+                context_switch(&old_thr->kt_ctx, &sched_idlectx[cpu->cpu_id]);
         }
-        else
+
+        /* old_thr is running again, maybe on another processor */
+        KASSERT(old_thr == curthr);
+        if (curthr->kt_cancelled == 1)
         {
-                kthread_t *old_thr = curthr;
-
-                dbg(DBG_THR,"PROCESS FORMERLY EXECUTING: %s\n", curthr->kt_proc->p_comm);
-
-                if(kt_runq.tq_size > 0)
-                    {
-                            while(1)
-                            {
-                                curthr = ktqueue_dequeue(&kt_runq);
-                                curproc = curthr->kt_proc;
-                                if(curthr->kt_state == KT_EXITED)
-                                    continue;
-                                else
-                                    break;
-                                
-                                if(kt_runq.tq_size == 0)
-                                    sched_switch();
-                            }
-
-                    }
-                else
-                    sched_switch();
+                dbg(DBG_THR,"%s was cancelled\n", curproc->p_comm);
+                do_exit(0);
+        }
+
+        apic_setipl(curr_intr_level);
+}
+
+void
+sched_idle(void *kstack, size_t kstacksz)
+{
+        context_t *c = &sched_idlectx[curcpu()->cpu_id];
+
+        KASSERT(PAGE_ALIGNED(kstack));
+
+        /* the rest of the context is saved the first time the
+         * processor switches to a thread */
+        c->c_kstack = (uintptr_t)kstack;
+        c->c_kstacksz = kstacksz;
+        c->c_pdptr = pt_get();
+        sched_idle_loop();
+}
+
+/**
+ * Moves every thread on a processor's run queue to level 0, keeping
+ * the order they would have run in, and does the same for the thread
+ * the processor is running. The IPL must be high.
+ *
+ * @param cpu the processor whose threads to boost
+ */
+static void
+runq_boost(int cpu)
+{
+        runq_t *rq = &kt_runq[cpu];
+        kthread_t *thr;
+        int level;
+
+        for (level = 1; level < SCHED_NLEVELS; level++) {
+                while (NULL != (thr = ktqueue_dequeue(&rq->rq_levels[level]))) {
+                        thr->kt_prio = 0;
+                        ktqueue_enqueue(&rq->rq_levels[0], thr);
+                }
+        }
+        if (0 != rq->rq_bitmap)
+                rq->rq_bitmap = 1;
+
+        if (NULL != (thr = smp_cpus[cpu].cpu_thr))
+                thr->kt_prio = 0;
+}
 
-                     if(curthr->kt_cancelled == 1)
-                    {
-                        dbg(DBG_THR,"%s was cancelled\n", curproc->p_comm);
-                        do_exit(0); 
-                    }
-                 
-                    
-                    apic_setipl(curr_intr_level);
-                 dbg(DBG_THR,"PROCESS CURRENTLY EXECUTING: %s\n", curthr->kt_proc->p_comm);
+void
+sched_tick(void)
+{
+        static uint32_t ticks = 0;
+        int cpu;
 
-                context_switch(&(old_thr->kt_ctx), &(curthr->kt_ctx));
+        if (0 == ++ticks % SCHED_BOOST_TICKS) {
+                for (cpu = 0; cpu < smp_ncpus; cpu++)
+                        runq_boost(cpu);
+        }
 
+        /* only the boot processor gets clock interrupts, so it charges
+         * the tick to every processor's thread */
+        for (cpu = 0; cpu < smp_ncpus; cpu++) {
+                kthread_t *thr = smp_cpus[cpu].cpu_thr;
+
+                if (NULL == thr || KT_RUN != thr->kt_state)
+                        continue;
+
+                if (++thr->kt_ticks >= (SCHED_QUANTUM << thr->kt_prio)) {
+                        /* nobody else wants the processor, start a new quantum */
+                        if (0 == kt_runq[cpu].rq_bitmap)
+                                thr->kt_ticks = 0;
+                        else if (!thr->kt_need_resched)
+                                sched_preempt(thr);
+                }
         }
 }
 
+void
+sched_preempt_check(void)
+{
+        if (curthr->kt_need_resched) {
+                dbg(DBG_SCHED, "preempting thread %p of proc %d\n",
+                    curthr, curproc->p_pid);
+                sched_make_runnable(curthr);
+                sched_switch();
+        }
+}
+
+void
+sched_preempt(kthread_t *thr)
+{
+        cpu_t *cpu = &smp_cpus[thr->kt_cpu];
+
+        thr->kt_need_resched = 1;
+        if (cpu->cpu_thr == thr)
+                smp_resched(cpu->cpu_id);
+}
+
+size_t
+sched_cpu_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        int cpu;
+
+        KASSERT(NULL == arg);
+        KASSERT(NULL != buf);
+
+        iprintf(&buf, &size, "cpu apic  runq  switches    steals     halts  running\n");
+        for (cpu = 0; cpu < smp_ncpus; cpu++) {
+                kthread_t *thr = smp_cpus[cpu].cpu_thr;
+                iprintf(&buf, &size, "%3d 0x%.2x %5d %9u %9u %9u  %s\n",
+                        cpu, (uint32_t)smp_cpus[cpu].cpu_apicid, kt_runq[cpu].rq_size,
+                        kt_runq[cpu].rq_switches, kt_runq[cpu].rq_steals,
+                        kt_runq[cpu].rq_halts,
+                        NULL == thr ? "(idle)" : thr->kt_proc->p_comm);
+        }
+
+        return size;
+}
+
 /*
  * Since we are modifying the run queue, we _MUST_ set the IPL to high
  * so that no interrupts happen at an inopportune moment.
@@ -297,24 +734,17 @@ sched_switch(void)
 void
 sched_make_runnable(kthread_t *thr)
 {
-    
-    KASSERT(&kt_runq != thr->kt_wchan);
-
-    static int i = 1;
-        if(thr->kt_proc->p_pid == 0 && i == 1)
-            {
-                sched_queue_init(&kt_runq);
-                i = i+1;
-            }
+        KASSERT(!runq_contains(thr->kt_wchan));
 
         dbg(DBG_THR,"ADDING PROCESS: %s, ON RUN_QUEUE\n", thr->kt_proc->p_comm);
 
         uint8_t curr_intr_level = apic_getipl();
         apic_setipl(IPL_HIGH);
 
-        thr->kt_state = KT_RUN;
-        ktqueue_enqueue(&kt_runq,thr);
+        /* the current thread used up its whole quantum */
+        if (thr == curthr && thr->kt_need_resched && SCHED_NLEVELS - 1 > thr->kt_prio)
+                thr->kt_prio++;
+        runq_enqueue(thr);
 
         apic_setipl(curr_intr_level);
-
 }
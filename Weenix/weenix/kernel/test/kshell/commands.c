@@ -13,8 +13,24 @@
 
 #include "test/kshell/io.h"
 
+#include "proc/kmutex.h"
+#include "proc/krwlock.h"
+#include "proc/sched.h"
+
+#include "mm/kmalloc.h"
+#include "mm/mm.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
+
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/time.h"
+
+#ifdef __VM__
+#include "mm/mman.h"
+#include "vm/vmmap.h"
+#endif
 
 int kshell_help(kshell_t *ksh, int argc, char **argv)
 {
@@ -60,6 +76,420 @@ int kshell_echo(kshell_t *ksh, int argc, char **argv)
         return 0;
 }
 
+#define KSH_LOCKS_TOP 10
+
+/**
+ * Inserts the statistics of a lock into an array of the n most
+ * contended ones seen so far, which is sorted by contention.
+ */
+static void
+ksh_locks_insert(const char **names, krwlock_stats_t **top, int *ntop, int n,
+                 const char *name, krwlock_stats_t *st)
+{
+        int i;
+
+        for (i = *ntop; i > 0; --i) {
+                if (top[i - 1]->krs_contended >= st->krs_contended)
+                        break;
+                if (i < n) {
+                        top[i] = top[i - 1];
+                        names[i] = names[i - 1];
+                }
+        }
+        if (i < n) {
+                top[i] = st;
+                names[i] = name;
+                if (*ntop < n)
+                        ++*ntop;
+        }
+}
+
+int kshell_locks(kshell_t *ksh, int argc, char **argv)
+{
+        /* Print the locks which were contended the most often, the
+         * times are in thousands of cycles. Mutexes are counted per
+         * class, so a line for a mutex covers all mutexes of its
+         * class. */
+        const char *names[KSH_LOCKS_TOP];
+        krwlock_stats_t *top[KSH_LOCKS_TOP];
+        krwlock_t *lock;
+        kmutex_class_t *cls;
+        int ntop = 0, i;
+
+        list_iterate_begin(krwlock_list(), lock, krwlock_t, krw_link) {
+                ksh_locks_insert(names, top, &ntop, KSH_LOCKS_TOP,
+                                 lock->krw_name, &lock->krw_stats);
+        } list_iterate_end();
+        list_iterate_begin(kmutex_class_list(), cls, kmutex_class_t, kmc_link) {
+                ksh_locks_insert(names, top, &ntop, KSH_LOCKS_TOP,
+                                 cls->kmc_name, &cls->kmc_stats);
+        } list_iterate_end();
+
+        kprintf(ksh, "%-20s %10s %10s %12s %12s\n",
+                "NAME", "ACQUIRED", "CONTENDED", "WAIT(Kcyc)", "MAXHOLD(Kcyc)");
+        for (i = 0; i < ntop; ++i) {
+                krwlock_stats_t *st = top[i];
+                kprintf(ksh, "%-20s %10u %10u %12u %12u\n",
+                        names[i], st->krs_acquired, st->krs_contended,
+                        (uint32_t)(st->krs_wait >> 10), (uint32_t)(st->krs_maxhold >> 10));
+        }
+
+        return 0;
+}
+
+#define KSH_SLABBENCH_ROUNDS 8
+#define KSH_SLABBENCH_SHIFT  10
+#define KSH_SLABBENCH_BATCH  (1 << KSH_SLABBENCH_SHIFT)
+
+int kshell_slabbench(kshell_t *ksh, int argc, char **argv)
+{
+        /* Allocates objects from a private cache in batches, holding
+         * on to all of them, and prints the average cost of an
+         * allocation (including growing the cache) as the cache gets
+         * bigger. The cost should not go up with the number of full
+         * slabs. */
+        static slab_allocator_t *bench = NULL;
+        void **objs;
+        uint64_t start, cycles;
+        int round, i, n = 0;
+
+        if (NULL == bench && NULL == (bench = slab_allocator_create("slabbench", 64))) {
+                kprintf(ksh, "slabbench: could not create the cache\n");
+                return 0;
+        }
+        if (NULL == (objs = kmalloc(sizeof(*objs) * KSH_SLABBENCH_ROUNDS * KSH_SLABBENCH_BATCH))) {
+                kprintf(ksh, "slabbench: out of memory\n");
+                return 0;
+        }
+
+        kprintf(ksh, "%10s %14s\n", "OBJECTS", "CYCLES/ALLOC");
+        for (round = 0; round < KSH_SLABBENCH_ROUNDS; ++round) {
+                start = time_cycles();
+                for (i = 0; i < KSH_SLABBENCH_BATCH; ++i, ++n) {
+                        if (NULL == (objs[n] = slab_obj_alloc(bench))) {
+                                kprintf(ksh, "slabbench: out of memory\n");
+                                goto out;
+                        }
+                }
+                cycles = time_cycles() - start;
+                kprintf(ksh, "%10d %14u\n", n, (uint32_t)(cycles >> KSH_SLABBENCH_SHIFT));
+        }
+
+out:
+        while (n-- > 0)
+                slab_obj_free(bench, objs[n]);
+        kfree(objs);
+        return 0;
+}
+
+#define KSH_KMALLOC_BUF_SIZE 2048
+
+int kshell_kmalloc(kshell_t *ksh, int argc, char **argv)
+{
+        /* Print how much space is wasted in each kmalloc size class */
+        char buf[KSH_KMALLOC_BUF_SIZE];
+        size_t left = kmalloc_info(NULL, buf, sizeof(buf));
+
+        kshell_write_all(ksh, buf, sizeof(buf) - left);
+        return 0;
+}
+
+int kshell_slabinfo(kshell_t *ksh, int argc, char **argv)
+{
+        /* One line per slab allocator is more than fits on the stack */
+        char *buf;
+        size_t left;
+
+        if (NULL == (buf = page_alloc())) {
+                kprintf(ksh, "slabinfo: out of memory\n");
+                return 0;
+        }
+        left = slab_allocators_info(NULL, buf, PAGE_SIZE);
+        kshell_write_all(ksh, buf, PAGE_SIZE - left);
+        page_free(buf);
+        return 0;
+}
+
+int kshell_meminfo(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[KSH_KMALLOC_BUF_SIZE];
+        size_t left = page_info(NULL, buf, sizeof(buf));
+
+        left = pframe_info(NULL, buf + sizeof(buf) - left, left);
+        kshell_write_all(ksh, buf, sizeof(buf) - left);
+        return 0;
+}
+
+int kshell_cpus(kshell_t *ksh, int argc, char **argv)
+{
+        char buf[KSH_BUF_SIZE];
+        size_t left = sched_cpu_info(NULL, buf, sizeof(buf));
+
+        kshell_write_all(ksh, buf, sizeof(buf) - left);
+        return 0;
+}
+
+#define KSH_PFHASH_SHIFT 12
+
+int kshell_pfhash(kshell_t *ksh, int argc, char **argv)
+{
+        /* Times lookups of pages which are not resident, each of which
+         * walks a whole hash chain, so the cost shows how long the
+         * chains are. It should stay flat as the page cache grows. */
+        char buf[KSH_BUF_SIZE];
+        mmobj_t nobody;
+        uint64_t start, cycles;
+        uint32_t i;
+
+        pframe_hash_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+
+        start = time_cycles();
+        for (i = 0; i < (1 << KSH_PFHASH_SHIFT); ++i)
+                pframe_get_resident(&nobody, i);
+        cycles = time_cycles() - start;
+        kprintf(ksh, "%u cycles per missed lookup\n", (uint32_t)(cycles >> KSH_PFHASH_SHIFT));
+        return 0;
+}
+
+#define KSH_REPLAY_FRAMES    256 /* pages the replayed cache holds */
+#define KSH_REPLAY_HOT       192 /* pages in the working set */
+#define KSH_REPLAY_SCAN     2048 /* pages read once by the scan */
+#define KSH_REPLAY_PASSES      8 /* working set references before and after the scan */
+#define KSH_REPLAY_LEN      (2 * KSH_REPLAY_PASSES * KSH_REPLAY_HOT + 2 * KSH_REPLAY_SCAN)
+
+int kshell_pfreplay(kshell_t *ksh, int argc, char **argv)
+{
+        /* Replays a working set which fits in the cache, then a scan of
+         * pages read only once with working set references between
+         * them, then the working set again, through each replacement
+         * policy. A scan resistant policy keeps hitting the working set
+         * while the scan goes by. */
+        static const char *names[PF_NPOLICIES] = { "lru", "clock", "2q" };
+        uint32_t *trace, seed = 1;
+        int i, n = 0, policy, hits;
+
+        if (NULL == (trace = kmalloc(KSH_REPLAY_LEN * sizeof(*trace)))) {
+                kprintf(ksh, "pfreplay: %s\n", strerror(ENOMEM));
+                return 0;
+        }
+#define KSH_REPLAY_NEXT() \
+        (seed = seed * 1103515245 + 12345, (seed >> 16) % KSH_REPLAY_HOT)
+        for (i = 0; i < KSH_REPLAY_PASSES * KSH_REPLAY_HOT; ++i)
+                trace[n++] = KSH_REPLAY_NEXT();
+        for (i = 0; i < KSH_REPLAY_SCAN; ++i) {
+                trace[n++] = KSH_REPLAY_HOT + i;
+                trace[n++] = KSH_REPLAY_NEXT();
+        }
+        for (i = 0; i < KSH_REPLAY_PASSES * KSH_REPLAY_HOT; ++i)
+                trace[n++] = KSH_REPLAY_NEXT();
+#undef KSH_REPLAY_NEXT
+
+        kprintf(ksh, "%d references, %d page cache, %d page working set, %d page scan\n",
+                n, KSH_REPLAY_FRAMES, KSH_REPLAY_HOT, KSH_REPLAY_SCAN);
+        for (policy = 0; policy < PF_NPOLICIES; ++policy) {
+                if (0 > (hits = pframe_replay(policy, trace, n, KSH_REPLAY_FRAMES))) {
+                        kprintf(ksh, "pfreplay: %s\n", strerror(-hits));
+                        break;
+                }
+                kprintf(ksh, "%-6s %6d hits %3d.%d%%%s\n", names[policy], hits,
+                        hits * 100 / n, hits * 1000 / n % 10,
+                        PF_POLICY == policy ? " (pageoutd)" : "");
+        }
+        kfree(trace);
+        return 0;
+}
+
+int kshell_fsynctest(kshell_t *ksh, int argc, char **argv)
+{
+        /* Has flushd start a slow write of a page of an object with
+         * several dirty pages, then cleans the object as fsync(2) does
+         * and checks that it waited for that write. */
+        const char *failed = pframe_fsync_test();
+
+        kprintf(ksh, "fsynctest: %s%s\n",
+                failed ? "FAILED: " : "passed", failed ? failed : "");
+        return 0;
+}
+
+#ifdef __VM__
+#define KSH_VMMAP_OPS       4096 /* inserts and unlinks performed */
+#define KSH_VMMAP_AREAS      512 /* most areas in the map at once */
+#define KSH_VMMAP_WINDOW    8192 /* pages at each end of user memory probed */
+#define KSH_VMMAP_PROBES       8 /* lookups checked after every operation */
+
+/* The linear scans of vmm_list the tree is checked against: */
+
+static vmarea_t *ksh_vmmap_lookup(vmmap_t *map, uint32_t vfn)
+{
+        list_link_t *link;
+        vmarea_t *vma;
+
+        for (link = map->vmm_list.l_next; link != &map->vmm_list; link = link->l_next) {
+                vma = list_item(link, vmarea_t, vma_plink);
+                if (vfn >= vma->vma_start && vfn < vma->vma_end)
+                        return vma;
+        }
+        return NULL;
+}
+
+static int ksh_vmmap_empty(vmmap_t *map, uint32_t start, uint32_t npages)
+{
+        list_link_t *link;
+        vmarea_t *vma;
+
+        for (link = map->vmm_list.l_next; link != &map->vmm_list; link = link->l_next) {
+                vma = list_item(link, vmarea_t, vma_plink);
+                if (start < vma->vma_end && start + npages > vma->vma_start)
+                        return 0;
+        }
+        return 1;
+}
+
+static int ksh_vmmap_find(vmmap_t *map, uint32_t npages, int dir)
+{
+        uint32_t low = ADDR_TO_PN(USER_MEM_LOW), high = ADDR_TO_PN(USER_MEM_HIGH);
+        uint32_t edge;
+        list_link_t *link;
+        vmarea_t *vma;
+
+        if (VMMAP_DIR_LOHI == dir) {
+                edge = low;
+                for (link = map->vmm_list.l_next; link != &map->vmm_list; link = link->l_next) {
+                        vma = list_item(link, vmarea_t, vma_plink);
+                        if (vma->vma_start >= edge + npages)
+                                return edge;
+                        edge = vma->vma_end;
+                }
+                return (high >= edge + npages) ? (int) edge : -1;
+        } else {
+                edge = high;
+                for (link = map->vmm_list.l_prev; link != &map->vmm_list; link = link->l_prev) {
+                        vma = list_item(link, vmarea_t, vma_plink);
+                        if (vma->vma_end + npages <= edge)
+                                return edge - npages;
+                        edge = vma->vma_start;
+                }
+                return (low + npages <= edge) ? (int)(edge - npages) : -1;
+        }
+}
+
+/* Checks the list is sorted, then compares the tree with the scans. */
+static const char *ksh_vmmap_check(vmmap_t *map, uint32_t *seed)
+{
+        uint32_t low = ADDR_TO_PN(USER_MEM_LOW), high = ADDR_TO_PN(USER_MEM_HIGH);
+        uint32_t vfn, npages, end = 0;
+        list_link_t *link;
+        vmarea_t *vma;
+        int i;
+
+        for (link = map->vmm_list.l_next; link != &map->vmm_list; link = link->l_next) {
+                vma = list_item(link, vmarea_t, vma_plink);
+                if (vma->vma_start < end)
+                        return "vmm_list out of order";
+                end = vma->vma_end;
+        }
+
+        for (i = 0; i < KSH_VMMAP_PROBES; ++i) {
+                *seed = *seed * 1103515245 + 12345;
+                vfn = (*seed >> 16) % KSH_VMMAP_WINDOW;
+                vfn = (*seed & 1) ? low + vfn : high - 1 - vfn;
+                npages = 1 + (*seed >> 8) % 32;
+                if (vmmap_lookup(map, vfn) != ksh_vmmap_lookup(map, vfn))
+                        return "vmmap_lookup";
+                if (vfn + npages <= high
+                    && vmmap_is_range_empty(map, vfn, npages) != ksh_vmmap_empty(map, vfn, npages))
+                        return "vmmap_is_range_empty";
+                if (vmmap_find_range(map, npages, VMMAP_DIR_LOHI)
+                    != ksh_vmmap_find(map, npages, VMMAP_DIR_LOHI))
+                        return "vmmap_find_range lohi";
+                if (vmmap_find_range(map, npages, VMMAP_DIR_HILO)
+                    != ksh_vmmap_find(map, npages, VMMAP_DIR_HILO))
+                        return "vmmap_find_range hilo";
+        }
+        return NULL;
+}
+
+int kshell_vmmaptest(kshell_t *ksh, int argc, char **argv)
+{
+        /* Fills a vmmap with areas placed both by vmmap_find_range, in
+         * either direction, and at random spots near either end of user
+         * memory, unlinks random ones, and after every step checks the
+         * tree's answers against a linear scan of vmm_list. */
+        uint32_t low = ADDR_TO_PN(USER_MEM_LOW), high = ADDR_TO_PN(USER_MEM_HIGH);
+        uint32_t seed = 1, start, npages;
+        int i, n, nareas = 0, ninserted = 0, nunlinked = 0;
+        const char *failed = NULL;
+        vmarea_t **areas, *vma;
+        vmmap_t *map;
+
+        if (NULL == (areas = kmalloc(KSH_VMMAP_AREAS * sizeof(*areas)))) {
+                kprintf(ksh, "vmmaptest: %s\n", strerror(ENOMEM));
+                return 0;
+        }
+        if (NULL == (map = vmmap_create())) {
+                kfree(areas);
+                kprintf(ksh, "vmmaptest: %s\n", strerror(ENOMEM));
+                return 0;
+        }
+
+        for (i = 0; i < KSH_VMMAP_OPS && NULL == failed; ++i) {
+                seed = seed * 1103515245 + 12345;
+                if (nareas > 0 && (KSH_VMMAP_AREAS == nareas || 0 == (seed >> 16) % 3)) {
+                        n = (seed >> 8) % nareas;
+                        vma = areas[n];
+                        areas[n] = areas[--nareas];
+                        vmmap_unlink(map, vma);
+                        if (NULL != vmmap_lookup(map, vma->vma_start))
+                                failed = "vmmap_unlink";
+                        vmarea_free(vma);
+                        nunlinked++;
+                } else {
+                        npages = 1 + (seed >> 16) % 16;
+                        switch ((seed >> 8) % 3) {
+                                case 0:
+                                        start = vmmap_find_range(map, npages, VMMAP_DIR_LOHI);
+                                        break;
+                                case 1:
+                                        start = vmmap_find_range(map, npages, VMMAP_DIR_HILO);
+                                        break;
+                                default:
+                                        start = (seed >> 4) % KSH_VMMAP_WINDOW;
+                                        start = (seed & 1) ? low + start : high - npages - start;
+                                        if (!ksh_vmmap_empty(map, start, npages))
+                                                continue;
+                                        break;
+                        }
+                        if ((uint32_t) -1 == start)
+                                continue;
+                        if (NULL == (vma = vmarea_alloc())) {
+                                failed = strerror(ENOMEM);
+                                break;
+                        }
+                        vma->vma_start = start;
+                        vma->vma_end = start + npages;
+                        vma->vma_off = 0;
+                        vma->vma_prot = PROT_READ;
+                        vma->vma_flags = MAP_PRIVATE;
+                        vma->vma_obj = NULL;
+                        vmmap_insert(map, vma);
+                        if (vmmap_lookup(map, start + npages - 1) != vma)
+                                failed = "vmmap_insert";
+                        areas[nareas++] = vma;
+                        ninserted++;
+                }
+                if (NULL == failed)
+                        failed = ksh_vmmap_check(map, &seed);
+        }
+
+        vmmap_destroy(map);
+        kfree(areas);
+        kprintf(ksh, "vmmaptest: %d inserts, %d unlinks: %s%s\n", ninserted, nunlinked,
+                failed ? "FAILED at " : "passed", failed ? failed : "");
+        return 0;
+}
+#endif
+
 #ifdef __VFS__
 int kshell_cat(kshell_t *ksh, int argc, char **argv)
 {
@@ -8,6 +8,18 @@
 KSHELL_CMD(help);
 KSHELL_CMD(exit);
 KSHELL_CMD(echo);
+KSHELL_CMD(locks);
+KSHELL_CMD(slabbench);
+KSHELL_CMD(kmalloc);
+KSHELL_CMD(slabinfo);
+KSHELL_CMD(meminfo);
+KSHELL_CMD(cpus);
+KSHELL_CMD(pfhash);
+KSHELL_CMD(pfreplay);
+KSHELL_CMD(fsynctest);
+#ifdef __VM__
+KSHELL_CMD(vmmaptest);
+#endif
 #ifdef __VFS__
 KSHELL_CMD(cat);
 KSHELL_CMD(ls);
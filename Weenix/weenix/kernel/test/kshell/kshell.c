@@ -34,6 +34,28 @@ static __attribute__((unused)) void kshell_init()
         kshell_add_command("help", kshell_help,
                            "prints a list of available commands");
         kshell_add_command("echo", kshell_echo, "display a line of text");
+        kshell_add_command("locks", kshell_locks,
+                           "list the most contended locks and mutex classes");
+        kshell_add_command("slabbench", kshell_slabbench,
+                           "time slab allocations as a cache grows");
+        kshell_add_command("kmalloc", kshell_kmalloc,
+                           "show the space wasted by each kmalloc size class");
+        kshell_add_command("slabinfo", kshell_slabinfo,
+                           "show the state of each slab allocator");
+        kshell_add_command("meminfo", kshell_meminfo,
+                           "show free pages, fragmentation and writeback");
+        kshell_add_command("cpus", kshell_cpus,
+                           "show each processor's run queue and what it runs");
+        kshell_add_command("pfhash", kshell_pfhash,
+                           "show the resident page hash and time lookups in it");
+        kshell_add_command("pfreplay", kshell_pfreplay,
+                           "compare page replacement hit rates on a scan");
+        kshell_add_command("fsynctest", kshell_fsynctest,
+                           "check that cleaning an object waits for flushd's writes");
+#ifdef __VM__
+        kshell_add_command("vmmaptest", kshell_vmmaptest,
+                           "check the vmmap tree against a scan of its list");
+#endif
 #ifdef __VFS__
         kshell_add_command("cat", kshell_cat,
                            "concatenate files and print on the standard output");
@@ -6,9 +6,195 @@
 
 #include "util/debug.h"
 #include "util/init.h"
+#include "util/list.h"
+#include "util/time.h"
 
 #include "proc/sched.h"
 #include "proc/kthread.h"
 
+/*
+ * Timers are kept on a hierarchical timer wheel. Level 0 has one slot
+ * per tick for the next TIMER_SLOTS ticks. Each slot of level i covers
+ * TIMER_SLOTS^i ticks. Adding and removing a timer are O(1). When the
+ * level 0 wheel wraps around, the next slot of level 1 is "cascaded"
+ * down by re-adding its timers, which sorts them into finer slots, and
+ * so on up the levels. Timers further out than the wheel can represent
+ * are parked in the last slot of the top level until they come within
+ * range.
+ */
+#define TIMER_BITS      6
+#define TIMER_SLOTS     (1 << TIMER_BITS)
+#define TIMER_MASK      (TIMER_SLOTS - 1)
+#define TIMER_LEVELS    4
+#define TIMER_MAXDELTA  ((1U << (TIMER_BITS * TIMER_LEVELS)) - 1)
+
+#define TIMER_INDEX(ticks, level) \
+        (((ticks) >> ((level) * TIMER_BITS)) & TIMER_MASK)
+
+static list_t timer_wheel[TIMER_LEVELS][TIMER_SLOTS];
+
+/* the next tick the timer wheel will process */
+static uint32_t timer_jiffies = 0;
+
+/* milliseconds since the clock was started */
+static uint32_t time_msecs = 0;
+
+uint32_t
+time_ticks(void)
+{
+        return timer_jiffies;
+}
+
+/**
+ * Places a timer in the slot for its expiry time. The IPL must be high.
+ *
+ * @param timer the timer to place
+ */
+static void
+timer_enqueue(ktimer_t *timer)
+{
+        uint32_t expires = timer->tm_expires;
+        uint32_t delta = expires - timer_jiffies;
+        int level;
+
+        if ((int32_t)delta < 0) {
+                /* already due, run it on the next tick */
+                list_insert_tail(&timer_wheel[0][TIMER_INDEX(timer_jiffies, 0)],
+                                 &timer->tm_link);
+                return;
+        }
+
+        if (delta > TIMER_MAXDELTA) {
+                /* park it as far out as possible, it is re-sorted
+                 * when that slot is cascaded */
+                delta = TIMER_MAXDELTA;
+                expires = timer_jiffies + delta;
+        }
+
+        for (level = 0; level < TIMER_LEVELS - 1; level++) {
+                if (delta < (1U << ((level + 1) * TIMER_BITS)))
+                        break;
+        }
+        list_insert_tail(&timer_wheel[level][TIMER_INDEX(expires, level)],
+                         &timer->tm_link);
+}
+
+/**
+ * Moves every timer in a slot down into the finer levels.
+ *
+ * @param level the level of the slot
+ * @param index the index of the slot
+ * @return index, so that callers can tell when a level wraps around
+ */
+static int
+timer_cascade(int level, int index)
+{
+        list_t *slot = &timer_wheel[level][index];
+        ktimer_t *timer;
+
+        list_iterate_begin(slot, timer, ktimer_t, tm_link) {
+                list_remove(&timer->tm_link);
+                timer_enqueue(timer);
+        } list_iterate_end();
+
+        return index;
+}
+
+/**
+ * Advances the timer wheel by one tick and runs the timers which are
+ * due. Called from the clock interrupt handler.
+ */
+static void
+timer_tick(void)
+{
+        int index = TIMER_INDEX(timer_jiffies, 0);
+        int level;
+        list_t *slot;
+        ktimer_t *timer;
+
+        /* when a level wraps around, cascade the next slot of the
+         * level above it */
+        for (level = 1; 0 == index && level < TIMER_LEVELS; level++)
+                index = timer_cascade(level, TIMER_INDEX(timer_jiffies, level));
+
+        slot = &timer_wheel[0][TIMER_INDEX(timer_jiffies, 0)];
+        timer_jiffies++;
+
+        while (!list_empty(slot)) {
+                timer = list_head(slot, ktimer_t, tm_link);
+                list_remove(&timer->tm_link);
+                timer->tm_func(timer->tm_arg);
+        }
+}
+
+void
+timer_init(ktimer_t *timer, ktimer_func_t func, void *arg)
+{
+        KASSERT(NULL != func);
+
+        timer->tm_expires = 0;
+        timer->tm_func = func;
+        timer->tm_arg = arg;
+        list_link_init(&timer->tm_link);
+}
+
+void
+timer_add(ktimer_t *timer, uint32_t ticks)
+{
+        uint8_t oldipl = apic_getipl();
+        apic_setipl(IPL_HIGH);
+
+        KASSERT(!list_link_is_linked(&timer->tm_link) && "timer already pending");
+        timer->tm_expires = timer_jiffies + ticks;
+        timer_enqueue(timer);
+
+        apic_setipl(oldipl);
+}
+
+int
+timer_del(ktimer_t *timer)
+{
+        int pending;
+        uint8_t oldipl = apic_getipl();
+        apic_setipl(IPL_HIGH);
+
+        if ((pending = list_link_is_linked(&timer->tm_link)))
+                list_remove(&timer->tm_link);
+
+        apic_setipl(oldipl);
+        return pending;
+}
+
+/*
+ * Handles a clock interrupt from the PIT. Every TICK_MSECS milliseconds
+ * the timer wheel advances by one tick. With UPREEMPT the current
+ * thread is also charged a scheduler tick, and if that uses up its
+ * quantum the thread is preempted by __intr_handler() on its way back
+ * to user mode.
+ */
+static void
+time_intr_handler(regs_t *regs)
+{
+        time_msecs += 1000 / PIT_HZ;
+        if (0 == time_msecs % TICK_MSECS) {
+                timer_tick();
 #ifdef __UPREEMPT__
+                sched_tick();
 #endif
+        }
+}
+
+static __attribute__((unused)) void
+time_init(void)
+{
+        int i, j;
+
+        for (i = 0; i < TIMER_LEVELS; i++) {
+                for (j = 0; j < TIMER_SLOTS; j++)
+                        list_init(&timer_wheel[i][j]);
+        }
+
+        intr_register(INTR_PIT, time_intr_handler);
+        pit_starttimer(INTR_PIT);
+}
+init_func(time_init);
@@ -55,6 +55,14 @@ anon_create()
         return NULL;
 }
 
+/* Returns 1 if o is an anonymous object, which has no backing store to
+ * read ahead from, 0 otherwise. */
+int
+anon_is_anon(mmobj_t *o)
+{
+        return &anon_mmobj_ops == o->mmo_ops;
+}
+
 /* Implementation of mmobj entry points: */
 
 /*
@@ -39,6 +39,13 @@
  * into account when deciding how to set the mappings if p_brk or p_start_brk
  * is not page aligned.
  *
+ * Do NOT grow or shrink the heap vmarea by assigning to its vma_end while
+ * it is in the vmmap. The vmmap's tree caches the end of every subtree and
+ * the gaps between areas, which would go stale, and vmmap_find_range could
+ * then hand out a range overlapping the heap. Instead vmmap_unlink the
+ * area, change vma_end, and vmmap_insert it again. When shrinking, also
+ * unmap the pages past the new end with pt_unmap_range.
+ *
  * You are guaranteed that the process data/bss region is non-empty.
  * That is, if the starting brk is not page-aligned, its page has
  * read/write permissions.
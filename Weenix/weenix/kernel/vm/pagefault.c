@@ -13,9 +13,101 @@
 #include "mm/mmobj.h"
 #include "mm/pframe.h"
 #include "mm/pagetable.h"
+#include "mm/tlb.h"
 
 #include "vm/pagefault.h"
 #include "vm/vmmap.h"
+#include "vm/anon.h"
+
+/* Whether the area's permissions allow the access described by cause. */
+static int
+pagefault_allowed(vmarea_t *vma, uint32_t cause)
+{
+        if (cause & FAULT_WRITE)
+                return vma->vma_prot & PROT_WRITE;
+        if (cause & FAULT_EXEC)
+                return vma->vma_prot & PROT_EXEC;
+        return vma->vma_prot & PROT_READ;
+}
+
+/* Returns the page a read of vfn would see if it is resident and idle
+ * now, or NULL. Walks down the shadow chain like lookuppage, but never
+ * blocks or fills a page, and does not count as a reference to it, so
+ * that mapping pages nobody touched yet does not keep them in memory. */
+static pframe_t *
+pagefault_resident(vmarea_t *vma, uint32_t vfn)
+{
+        uint32_t pagenum = vfn - vma->vma_start + vma->vma_off;
+        mmobj_t *o;
+        pframe_t *pf;
+
+        for (o = vma->vma_obj; NULL != o; o = o->mmo_shadowed) {
+                if (NULL != (pf = pframe_peek_resident(o, pagenum)))
+                        return pframe_is_busy(pf) ? NULL : pf;
+        }
+        return NULL;
+}
+
+/*
+ * Fault-around: maps the resident pages of the area in the aligned block
+ * of PF_FAULT_AROUND pages around vfn, so that touching them later does
+ * not trap. They are mapped read-only, so a write to one of them still
+ * faults and goes through pframe_dirty and copy-on-write, and pages which
+ * are already mapped are left alone.
+ */
+static void
+pagefault_around(vmarea_t *vma, uint32_t vfn)
+{
+        pagedir_t *pd = curproc->p_pagedir;
+        uint32_t block = vfn & ~(PF_FAULT_AROUND - 1);
+        uint32_t lo = MAX(vma->vma_start, block);
+        uint32_t hi = MIN(vma->vma_end, block + PF_FAULT_AROUND);
+        uintptr_t vaddr;
+        pframe_t *pf;
+
+        for (; lo < hi; ++lo) {
+                vaddr = (uintptr_t) PN_TO_ADDR(lo);
+                if (lo == vfn || pt_is_mapped(pd, vaddr))
+                        continue;
+                if (NULL == (pf = pagefault_resident(vma, lo)))
+                        continue;
+                /* the entry was not present, so it can't be in the TLB */
+                if (0 > pt_map(pd, vaddr, pt_virt_to_phys((uintptr_t) pf->pf_addr),
+                               PD_PRESENT | PD_WRITE | PD_USER, PT_PRESENT | PT_USER))
+                        return;
+        }
+}
+
+/*
+ * Read-ahead: a fault is sequential if it lands past the last fault in
+ * the area but no further than the pages read ahead so far. Each
+ * sequential fault doubles the window, from PF_READAHEAD_MIN up to
+ * PF_READAHEAD_MAX pages, and asks for the pages past the ones already
+ * requested; any other fault starts over. The pages are filled in the
+ * bottom object, where the file's pages live for private mappings too.
+ */
+static void
+pagefault_readahead(vmarea_t *vma, uint32_t vfn, mmobj_t *bottom)
+{
+        uint32_t lo, hi;
+
+        if (vfn <= vma->vma_ralast || vfn > vma->vma_ranext) {
+                vma->vma_ralast = vfn;
+                vma->vma_ranext = vfn + 1;
+                vma->vma_rawindow = 0;
+                return;
+        }
+
+        vma->vma_ralast = vfn;
+        vma->vma_rawindow = MIN(MAX(2 * vma->vma_rawindow, PF_READAHEAD_MIN),
+                                PF_READAHEAD_MAX);
+        lo = MAX(vfn + 1, vma->vma_ranext);
+        hi = MIN(vfn + 1 + vma->vma_rawindow, vma->vma_end);
+        if (lo < hi) {
+                pframe_readahead(bottom, lo - vma->vma_start + vma->vma_off, hi - lo);
+                vma->vma_ranext = hi;
+        }
+}
 
 /*
  * This gets called by _pt_fault_handler in mm/pagetable.c The
@@ -42,6 +134,10 @@
  * Finally call pt_map to have the new mapping placed into the
  * appropriate page table.
  *
+ * For file-backed areas, read faults also map the resident pages
+ * around the faulting one, and sequential faults have the following
+ * pages read ahead in the background by readaheadd.
+ *
  * @param vaddr the address that was accessed to cause the fault
  *
  * @param cause this is the type of operation on the memory
@@ -51,5 +147,39 @@
 void
 handle_pagefault(uintptr_t vaddr, uint32_t cause)
 {
-        NOT_YET_IMPLEMENTED("VM: handle_pagefault");
+        uint32_t vfn = ADDR_TO_PN(vaddr);
+        int forwrite = cause & FAULT_WRITE;
+        uint32_t ptflags = PT_PRESENT | PT_USER;
+        vmarea_t *vma;
+        mmobj_t *bottom;
+        pframe_t *pf;
+
+        vma = vmmap_lookup(curproc->p_vmmap, vfn);
+        if (NULL == vma || !pagefault_allowed(vma, cause))
+                do_exit(EFAULT);
+
+        if (0 > pframe_lookup(vma->vma_obj, vfn - vma->vma_start + vma->vma_off,
+                              forwrite, &pf))
+                do_exit(EFAULT);
+        KASSERT(NULL != pf);
+        if (forwrite) {
+                if (0 > pframe_dirty(pf))
+                        do_exit(EFAULT);
+                ptflags |= PT_WRITE;
+        }
+
+        vaddr = (uintptr_t) PN_TO_ADDR(vfn);
+        if (0 > pt_map(curproc->p_pagedir, vaddr, pt_virt_to_phys((uintptr_t) pf->pf_addr),
+                       PD_PRESENT | PD_WRITE | PD_USER, ptflags))
+                do_exit(EFAULT);
+        tlb_flush(vaddr);
+
+        /* fault-around and read-ahead only pay off for pages a file has
+         * to be read for */
+        bottom = mmobj_bottom_obj(vma->vma_obj);
+        if (!anon_is_anon(bottom)) {
+                if (!forwrite)
+                        pagefault_around(vma, vfn);
+                pagefault_readahead(vma, vfn, bottom);
+        }
 }
@@ -1,11 +1,14 @@
 #include "types.h"
 #include "globals.h"
+#include "errno.h"
 
 #include "mm/mmobj.h"
+#include "mm/page.h"
 #include "mm/pframe.h"
 
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/time.h"
 
 #include "proc/proc.h"
 #include "proc/sched.h"
@@ -32,7 +35,7 @@ shadowd_alloc_sleep()
          * before it has been properly initialized then the system
          * does not have enough memory. */
         KASSERT(shadowd_initialized);
-        sched_sleep_on(&kmem_alloc_waitq);
+        sched_sleep_on_exclusive(&kmem_alloc_waitq);
 }
 
 /*
@@ -54,8 +57,11 @@ shadowd_alloc_sleep()
 static void *
 shadowd(int arg1, void *arg2)
 {
+        int nfree, nfreed;
+
         while (1) {
                 proc_t *p;
+                nfree = page_free_count();
                 /* for each process, go through its vmareas */
                 list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
                         /* all of the dead process's shadow objects will be takenen care of by init */
@@ -103,8 +109,14 @@ shadowd(int arg1, void *arg2)
                         }
                 } list_iterate_end();
 
-                sched_broadcast_on(&kmem_alloc_waitq);
-                if (sched_cancellable_sleep_on(&shadowd_waitq) < 0) {
+                /* wake one waiter per freed page, or all of them if no
+                 * pages were freed so that they can give up */
+                nfreed = page_free_count() - nfree;
+                sched_wakeup_excl_on(&kmem_alloc_waitq,
+                                     nfreed > 0 ? nfreed : kmem_alloc_waitq.tq_size);
+                /* run again when memory runs short, or after a while anyway */
+                if (-EINTR == sched_sleep_on_timeout(&shadowd_waitq,
+                                                     TIME_MSECS_TO_TICKS(SHADOWD_PERIOD_MSECS))) {
                         return (void *)0;
                 }
         }
@@ -42,6 +42,10 @@ vmarea_alloc(void)
         vmarea_t *newvma = (vmarea_t *) slab_obj_alloc(vmarea_allocator);
         if (newvma) {
                 newvma->vma_vmmap = NULL;
+                list_link_init(&newvma->vma_olink);
+                newvma->vma_ralast = 0;
+                newvma->vma_ranext = 0;
+                newvma->vma_rawindow = 0;
         }
         return newvma;
 }
@@ -53,59 +57,337 @@ vmarea_free(vmarea_t *vma)
         slab_obj_free(vmarea_allocator, vma);
 }
 
+/*
+ * Besides the sorted vmm_list, each vmmap keeps its areas in an AVL
+ * tree keyed by vma_start. Every node also records the lowest and
+ * highest vfn mapped in its subtree and the largest hole between two
+ * areas of the subtree, so that lookups, overlap checks and the gap
+ * search in vmmap_find_range are all logarithmic in the number of areas.
+ */
+
+#define vma_height(n)   ((n) ? (n)->vma_height : 0)
+#define vma_gap(lo, hi) ((hi) > (lo) ? (hi) - (lo) : 0)
+
+static void
+vmmap_tree_update(vmarea_t *n)
+{
+        vmarea_t *l = n->vma_left;
+        vmarea_t *r = n->vma_right;
+
+        n->vma_height = 1 + MAX(vma_height(l), vma_height(r));
+        n->vma_treelo = l ? l->vma_treelo : n->vma_start;
+        n->vma_treehi = r ? r->vma_treehi : n->vma_end;
+        n->vma_maxgap = 0;
+        if (NULL != l) {
+                n->vma_maxgap = MAX(l->vma_maxgap,
+                                    vma_gap(l->vma_treehi, n->vma_start));
+        }
+        if (NULL != r) {
+                n->vma_maxgap = MAX(n->vma_maxgap, r->vma_maxgap);
+                n->vma_maxgap = MAX(n->vma_maxgap,
+                                    vma_gap(n->vma_end, r->vma_treelo));
+        }
+}
+
+static vmarea_t *
+vmmap_tree_rotate_left(vmarea_t *n)
+{
+        vmarea_t *r = n->vma_right;
+
+        n->vma_right = r->vma_left;
+        vmmap_tree_update(n);
+        r->vma_left = n;
+        vmmap_tree_update(r);
+        return r;
+}
+
+static vmarea_t *
+vmmap_tree_rotate_right(vmarea_t *n)
+{
+        vmarea_t *l = n->vma_left;
+
+        n->vma_left = l->vma_right;
+        vmmap_tree_update(n);
+        l->vma_right = n;
+        vmmap_tree_update(l);
+        return l;
+}
+
+/* Recomputes n after one of its subtrees changed height by at most one
+ * and rotates it back into balance. Returns the new subtree root. */
+static vmarea_t *
+vmmap_tree_balance(vmarea_t *n)
+{
+        vmarea_t *l = n->vma_left;
+        vmarea_t *r = n->vma_right;
+
+        if (vma_height(l) > vma_height(r) + 1) {
+                if (vma_height(l->vma_left) < vma_height(l->vma_right))
+                        n->vma_left = vmmap_tree_rotate_left(l);
+                return vmmap_tree_rotate_right(n);
+        } else if (vma_height(r) > vma_height(l) + 1) {
+                if (vma_height(r->vma_right) < vma_height(r->vma_left))
+                        n->vma_right = vmmap_tree_rotate_right(r);
+                return vmmap_tree_rotate_left(n);
+        }
+        vmmap_tree_update(n);
+        return n;
+}
+
+/* Adds vma to the subtree rooted at n. On return *succ is the lowest
+ * area of the subtree which starts above vma, if any. */
+static vmarea_t *
+vmmap_tree_insert(vmarea_t *n, vmarea_t *vma, vmarea_t **succ)
+{
+        if (NULL == n) {
+                vma->vma_left = NULL;
+                vma->vma_right = NULL;
+                vmmap_tree_update(vma);
+                return vma;
+        }
+
+        if (vma->vma_start < n->vma_start) {
+                *succ = n;
+                n->vma_left = vmmap_tree_insert(n->vma_left, vma, succ);
+        } else {
+                n->vma_right = vmmap_tree_insert(n->vma_right, vma, succ);
+        }
+        return vmmap_tree_balance(n);
+}
+
+/* Detaches the lowest area of the subtree rooted at n into *min. */
+static vmarea_t *
+vmmap_tree_remove_min(vmarea_t *n, vmarea_t **min)
+{
+        if (NULL == n->vma_left) {
+                *min = n;
+                return n->vma_right;
+        }
+        n->vma_left = vmmap_tree_remove_min(n->vma_left, min);
+        return vmmap_tree_balance(n);
+}
+
+static vmarea_t *
+vmmap_tree_remove(vmarea_t *n, vmarea_t *vma)
+{
+        vmarea_t *min;
+
+        KASSERT(NULL != n && "area is not in this vmmap");
+
+        if (vma->vma_start < n->vma_start) {
+                n->vma_left = vmmap_tree_remove(n->vma_left, vma);
+        } else if (vma->vma_start > n->vma_start) {
+                n->vma_right = vmmap_tree_remove(n->vma_right, vma);
+        } else {
+                KASSERT(n == vma);
+                if (NULL == n->vma_right)
+                        return n->vma_left;
+                n->vma_right = vmmap_tree_remove_min(n->vma_right, &min);
+                min->vma_left = n->vma_left;
+                min->vma_right = n->vma_right;
+                n = min;
+        }
+        return vmmap_tree_balance(n);
+}
+
+/* Whether a gap of npages fits within the subtree rooted at n or just
+ * below it, given that the closest area below the subtree ends at prev. */
+#define vmmap_fits_lohi(n, prev, npages)                        \
+        (vma_gap((prev), (n)->vma_treelo) >= (npages)           \
+         || (n)->vma_maxgap >= (npages))
+
+/* The same, above the subtree, given the next area starts at next. */
+#define vmmap_fits_hilo(n, next, npages)                        \
+        (vma_gap((n)->vma_treehi, (next)) >= (npages)           \
+         || (n)->vma_maxgap >= (npages))
+
+/* Returns the start of the lowest fitting gap; vmmap_fits_lohi must
+ * hold for n. */
+static uint32_t
+vmmap_gap_lohi(vmarea_t *n, uint32_t prev, uint32_t npages)
+{
+        vmarea_t *l;
+        uint32_t before;
+
+        while (1) {
+                l = n->vma_left;
+                if (NULL != l && vmmap_fits_lohi(l, prev, npages)) {
+                        n = l;
+                        continue;
+                }
+                before = l ? l->vma_treehi : prev;
+                if (vma_gap(before, n->vma_start) >= npages)
+                        return before;
+                prev = n->vma_end;
+                n = n->vma_right;
+                KASSERT(NULL != n);
+        }
+}
+
+/* Returns the start of the highest fitting gap; vmmap_fits_hilo must
+ * hold for n. */
+static uint32_t
+vmmap_gap_hilo(vmarea_t *n, uint32_t next, uint32_t npages)
+{
+        vmarea_t *r;
+        uint32_t after;
+
+        while (1) {
+                r = n->vma_right;
+                if (NULL != r && vmmap_fits_hilo(r, next, npages)) {
+                        n = r;
+                        continue;
+                }
+                after = r ? r->vma_treelo : next;
+                if (vma_gap(n->vma_end, after) >= npages)
+                        return after - npages;
+                next = n->vma_start;
+                n = n->vma_left;
+                KASSERT(NULL != n);
+        }
+}
+
 /* Create a new vmmap, which has no vmareas and does
  * not refer to a process. */
 vmmap_t *
 vmmap_create(void)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_create");
-        return NULL;
+        vmmap_t *map = (vmmap_t *) slab_obj_alloc(vmmap_allocator);
+        if (NULL == map)
+                return NULL;
+
+        list_init(&map->vmm_list);
+        map->vmm_root = NULL;
+        map->vmm_cache = NULL;
+        map->vmm_proc = NULL;
+        return map;
 }
 
-/* Removes all vmareas from the address space and frees the
- * vmmap struct. */
+/* Removes all vmareas from the address space, dropping their references
+ * on their mmobjs, and frees the vmmap struct. */
 void
 vmmap_destroy(vmmap_t *map)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_destroy");
+        vmarea_t *vma;
+
+        KASSERT(NULL != map);
+
+        while (!list_empty(&map->vmm_list)) {
+                vma = list_head(&map->vmm_list, vmarea_t, vma_plink);
+                vmmap_unlink(map, vma);
+                if (NULL != vma->vma_obj) {
+                        if (list_link_is_linked(&vma->vma_olink))
+                                list_remove(&vma->vma_olink);
+                        vma->vma_obj->mmo_ops->put(vma->vma_obj);
+                }
+                vmarea_free(vma);
+        }
+        KASSERT(NULL == map->vmm_root);
+        slab_obj_free(vmmap_allocator, map);
 }
 
 /* Add a vmarea to an address space. Assumes (i.e. asserts to some extent)
- * the vmarea is valid.  This involves finding where to put it in the list
- * of VM areas, and adding it. Don't forget to set the vma_vmmap for the
- * area. */
+ * the vmarea is valid. The area goes into the tree, and into the list just
+ * before the area the tree says follows it. */
 void
 vmmap_insert(vmmap_t *map, vmarea_t *newvma)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_insert");
+        vmarea_t *succ = NULL;
+
+        KASSERT(NULL != map && NULL != newvma);
+        KASSERT(newvma->vma_start < newvma->vma_end);
+        KASSERT(ADDR_TO_PN(USER_MEM_LOW) <= newvma->vma_start
+                && ADDR_TO_PN(USER_MEM_HIGH) >= newvma->vma_end);
+        KASSERT(vmmap_is_range_empty(map, newvma->vma_start,
+                                     newvma->vma_end - newvma->vma_start));
+
+        newvma->vma_vmmap = map;
+        map->vmm_root = vmmap_tree_insert(map->vmm_root, newvma, &succ);
+        if (NULL != succ)
+                list_insert_before(&succ->vma_plink, &newvma->vma_plink);
+        else
+                list_insert_tail(&map->vmm_list, &newvma->vma_plink);
+}
+
+/* Takes an area out of its address space without freeing it or touching
+ * its mmobj. To move the bounds of an area, unlink it, change them and
+ * vmmap_insert it again. */
+void
+vmmap_unlink(vmmap_t *map, vmarea_t *vma)
+{
+        KASSERT(NULL != map && map == vma->vma_vmmap);
+
+        map->vmm_root = vmmap_tree_remove(map->vmm_root, vma);
+        list_remove(&vma->vma_plink);
+        if (map->vmm_cache == vma)
+                map->vmm_cache = NULL;
+        vma->vma_vmmap = NULL;
 }
 
 /* Find a contiguous range of free virtual pages of length npages in
  * the given address space. Returns starting vfn for the range,
  * without altering the map. Returns -1 if no such range exists.
  *
- * Your algorithm should be first fit. If dir is VMMAP_DIR_HILO, you
- * should find a gap as high in the address space as possible; if dir
- * is VMMAP_DIR_LOHI, the gap should be as low as possible. */
+ * The search is first fit. If dir is VMMAP_DIR_HILO, we find a gap as
+ * high in the address space as possible; if dir is VMMAP_DIR_LOHI, the
+ * gap is as low as possible. The largest gap recorded in each subtree
+ * lets us skip every subtree the range can't fit into. */
 int
 vmmap_find_range(vmmap_t *map, uint32_t npages, int dir)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_find_range");
+        uint32_t low = ADDR_TO_PN(USER_MEM_LOW);
+        uint32_t high = ADDR_TO_PN(USER_MEM_HIGH);
+        vmarea_t *root = map->vmm_root;
+
+        KASSERT(VMMAP_DIR_LOHI == dir || VMMAP_DIR_HILO == dir);
+
+        if (0 == npages || npages > high - low)
+                return -1;
+        if (NULL == root)
+                return (VMMAP_DIR_LOHI == dir) ? (int) low : (int)(high - npages);
+
+        if (VMMAP_DIR_LOHI == dir) {
+                if (vmmap_fits_lohi(root, low, npages))
+                        return vmmap_gap_lohi(root, low, npages);
+                if (vma_gap(root->vma_treehi, high) >= npages)
+                        return root->vma_treehi;
+        } else {
+                if (vmmap_fits_hilo(root, high, npages))
+                        return vmmap_gap_hilo(root, high, npages);
+                if (vma_gap(low, root->vma_treelo) >= npages)
+                        return root->vma_treelo - npages;
+        }
         return -1;
 }
 
-/* Find the vm_area that vfn lies in. Simply scan the address space
- * looking for a vma whose range covers vfn. If the page is unmapped,
- * return NULL. */
+/* Find the vm_area that vfn lies in. Faults tend to land in the area
+ * the previous one did, so that area is checked before walking the
+ * tree. If the page is unmapped, return NULL. */
 vmarea_t *
 vmmap_lookup(vmmap_t *map, uint32_t vfn)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_lookup");
+        vmarea_t *vma = map->vmm_cache;
+
+        if (NULL != vma && vfn >= vma->vma_start && vfn < vma->vma_end)
+                return vma;
+
+        vma = map->vmm_root;
+        while (NULL != vma) {
+                if (vfn < vma->vma_start) {
+                        vma = vma->vma_left;
+                } else if (vfn >= vma->vma_end) {
+                        vma = vma->vma_right;
+                } else {
+                        map->vmm_cache = vma;
+                        return vma;
+                }
+        }
         return NULL;
 }
 
 /* Allocates a new vmmap containing a new vmarea for each area in the
- * given map. The areas should have no mmobjs set yet. Returns pointer
+ * given map, added with vmmap_insert. The areas should have no mmobjs
+ * set yet. Returns pointer
  * to the new vmmap on success, NULL on failure. This function is
  * called when implementing fork(2). */
 vmmap_t *
@@ -175,7 +457,10 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
  *
  * Case 4: *[*************]**
  * The region completely contains the vmarea. Remove the vmarea from the
- * list.
+ * map.
+ *
+ * The tree is keyed by vma_start, so only change an area's bounds after
+ * taking it out with vmmap_unlink, and vmmap_insert it again afterwards.
  */
 int
 vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
@@ -191,8 +476,18 @@ vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
 int
 vmmap_is_range_empty(vmmap_t *map, uint32_t startvfn, uint32_t npages)
 {
-        NOT_YET_IMPLEMENTED("VM: vmmap_is_range_empty");
-        return 0;
+        uint32_t endvfn = startvfn + npages;
+        vmarea_t *vma = map->vmm_root;
+
+        while (NULL != vma) {
+                if (endvfn <= vma->vma_start)
+                        vma = vma->vma_left;
+                else if (startvfn >= vma->vma_end)
+                        vma = vma->vma_right;
+                else
+                        return 0;
+        }
+        return 1;
 }
 
 /* Read into 'buf' from the virtual address space of 'map' starting at
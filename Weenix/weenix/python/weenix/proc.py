@@ -77,7 +77,7 @@ def lookup(pid):
 	return Proc(weenix.eval_func("proc_lookup", pid).dereference())
 
 def curproc():
-	return Proc(gdb.parse_and_eval("curproc"))
+	return Proc(gdb.parse_and_eval("smp_cpus[$_thread - 1].cpu_proc"))
 
 def str_proc_tree(proc=None, indent=""):
 	if (proc == None):
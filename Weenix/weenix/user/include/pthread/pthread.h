@@ -33,6 +33,8 @@ int             pthread_mutex_init(pthread_mutex_t *mtx,
 int             pthread_mutex_lock(pthread_mutex_t *mtx);
 int             pthread_mutex_trylock(pthread_mutex_t *mtx);
 int             pthread_mutex_unlock(pthread_mutex_t *mtx);
+int             pthread_mutex_destroy(pthread_mutex_t *mtx);
+pthread_t       pthread_self(void);
 void            pthread_yield(void);
 int             pthread_cancel(pthread_t thr);
 
@@ -57,7 +59,6 @@ int             pthread_mutexattr_init(pthread_mutexattr_t *);
 int             pthread_mutexattr_destroy(pthread_mutexattr_t *);
 int             pthread_mutexattr_gettype(pthread_mutexattr_t *, int *);
 int             pthread_mutexattr_settype(pthread_mutexattr_t *, int);
-int             pthread_mutex_destroy(pthread_mutex_t *);
 int             pthread_attr_getstacksize(const pthread_attr_t *, size_t *);
 int             pthread_attr_getstackaddr(const pthread_attr_t *, void **);
 int             pthread_attr_getguardsize(const pthread_attr_t *, size_t *);
@@ -87,7 +88,6 @@ int             pthread_rwlockattr_getpshared(const pthread_rwlockattr_t *,
                 int *);
 int             pthread_rwlockattr_setpshared(pthread_rwlockattr_t *, int);
 int             pthread_rwlockattr_destroy(pthread_rwlockattr_t *);
-pthread_t       pthread_self(void);
 int             pthread_setspecific(pthread_key_t, const void *);
 int             pthread_sigmask(int, const sigset_t *, sigset_t *);
 
@@ -26,11 +26,19 @@ int     execve(const char *filename, char *const argv[], char *const envp[]);
 void    _exit(int status);
 pid_t   wait(int *status);
 pid_t   waitpid(pid_t pid, int options, int *status);
+int     thr_create(void *entry, void *stack);
+int     thr_join(int tid, void **retval);
+int     thr_detach(int tid);
+void    thr_yield(void);
 void    thr_exit(int status);
 int     thr_errno(void);
 void    thr_set_errno(int n);
 void    yield(void);
+int     nanosleep(const struct timespec *req, struct timespec *rem);
+unsigned int sleep(unsigned int seconds);
+int     usleep(unsigned int usecs);
 pid_t   getpid(void);
+int     gettid(void);
 int     halt(void);
 void    sync(void);
 
@@ -44,6 +52,8 @@ int     write(int fd, const void *buf, size_t nbytes);
 off_t   lseek(int fd, off_t offset, int whence);
 int     dup(int fd);
 int     dup2(int ofd, int nfd);
+int     fsync(int fd);
+int     fdatasync(int fd);
 int     mkdir(const char *path, int mode);
 int     rmdir(const char *path);
 int     unlink(const char *path);
@@ -142,8 +142,14 @@ struct pgfree {
 #define pageround(foo) (((foo) + (malloc_pagemask))&(~(malloc_pagemask)))
 #define ptr2index(foo) (((u_long)(foo) >> malloc_pageshift)-malloc_origo)
 
+/* With MTP all the threads of a process share the heap. While the
+ * lock is held by another thread, give it a chance to finish. */
 #ifndef THREAD_LOCK
-#define THREAD_LOCK()
+static volatile int malloc_lock;
+#define THREAD_LOCK() \
+        while (__sync_lock_test_and_set(&malloc_lock, 1)) thr_yield()
+#undef THREAD_UNLOCK
+#define THREAD_UNLOCK() __sync_lock_release(&malloc_lock)
 #endif
 
 #ifndef THREAD_UNLOCK
@@ -1066,6 +1072,7 @@ malloc(size_t size)
         if (malloc_active++) {
                 wrtwarning("recursive call.\n");
                 malloc_active--;
+                THREAD_UNLOCK();
                 return (0);
         }
         if (!malloc_started) {
@@ -1091,6 +1098,7 @@ free(void *ptr)
         if (malloc_active++) {
                 wrtwarning("recursive call.\n");
                 malloc_active--;
+                THREAD_UNLOCK();
                 return;
         } else {
                 ifree(ptr);
@@ -1111,6 +1119,7 @@ realloc(void *ptr, size_t size)
         if (malloc_active++) {
                 wrtwarning("recursive call.\n");
                 malloc_active--;
+                THREAD_UNLOCK();
                 return (0);
         }
         if (ptr && !malloc_started) {
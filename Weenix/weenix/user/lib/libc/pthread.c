@@ -0,0 +1,269 @@
+/*
+ * POSIX threads, built on the kernel's thread system calls. These only
+ * work in a kernel built with MTP.
+ *
+ * Every thread gets a stack from malloc and starts running in
+ * pthread_start with a pointer to its struct pthread as its argument.
+ * A thread can't free the stack it is running on, so detached threads
+ * stay joinable in the kernel; once one has exited, the next
+ * pthread_create or pthread_join joins it and frees its stack.
+ * Mutexes are spinlocks which yield the processor while the lock is
+ * held by another thread.
+ */
+
+#include "sys/types.h"
+#include "errno.h"
+
+#include "stdlib.h"
+#include "unistd.h"
+
+#include "pthread/pthread.h"
+#include "weenix/trap.h"
+
+#define PTHREAD_STACK_SIZE      (64 * 1024)
+
+struct pthread {
+        int              pt_tid;        /* kernel thread id */
+        void            *pt_stack;      /* malloc'd stack, NULL for the main thread */
+        void          *(*pt_func)(void *);
+        void            *pt_arg;
+        int              pt_detached;   /* set by pthread_detach */
+        volatile int     pt_done;       /* set by pthread_exit just before exiting */
+        struct pthread  *pt_next;       /* link on pthread_list */
+};
+
+struct pthread_mutex {
+        volatile int     pm_locked;
+};
+
+/* All threads created with pthread_create which have not been joined
+ * or reaped, and the main thread once pthread_self has been called from it */
+static struct pthread *pthread_list = NULL;
+static struct pthread_mutex pthread_list_lock = { 0 };
+
+static struct pthread pthread_main;
+
+static inline int
+pthread_xchg(volatile int *p, int v)
+{
+        __asm__ volatile("xchgl %0, %1" : "+r"(v), "+m"(*p) : : "memory");
+        return v;
+}
+
+static void
+pthread_lock(struct pthread_mutex *m)
+{
+        while (pthread_xchg(&m->pm_locked, 1))
+                thr_yield();
+}
+
+static void
+pthread_unlock(struct pthread_mutex *m)
+{
+        pthread_xchg(&m->pm_locked, 0);
+}
+
+/*
+ * Joins every detached thread which has called pthread_exit and frees its
+ * stack. thr_join only waits for a reaped thread to finish the exit it
+ * already started.
+ */
+static void
+pthread_reap(void)
+{
+        struct pthread **pp, *t, *dead = NULL;
+
+        pthread_lock(&pthread_list_lock);
+        for (pp = &pthread_list; NULL != (t = *pp); ) {
+                if (t->pt_detached && t->pt_done && &pthread_main != t) {
+                        *pp = t->pt_next;
+                        t->pt_next = dead;
+                        dead = t;
+                } else {
+                        pp = &t->pt_next;
+                }
+        }
+        pthread_unlock(&pthread_list_lock);
+
+        while (NULL != (t = dead)) {
+                dead = t->pt_next;
+                thr_join(t->pt_tid, NULL);
+                free(t->pt_stack);
+                free(t);
+        }
+}
+
+static void
+pthread_start(struct pthread *self)
+{
+        pthread_exit(self->pt_func(self->pt_arg));
+}
+
+int
+pthread_create(pthread_t *thr, const pthread_attr_t *attr,
+               void *(*func)(void *), void *arg)
+{
+        struct pthread *t;
+        uint32_t *sp;
+        int tid;
+
+        pthread_reap();
+
+        if (NULL == (t = malloc(sizeof(*t))))
+                return EAGAIN;
+        if (NULL == (t->pt_stack = malloc(PTHREAD_STACK_SIZE))) {
+                free(t);
+                return EAGAIN;
+        }
+        t->pt_func = func;
+        t->pt_arg = arg;
+        t->pt_detached = 0;
+        t->pt_done = 0;
+
+        /* the argument to pthread_start and a dummy return address */
+        sp = (uint32_t *)(((uint32_t) t->pt_stack + PTHREAD_STACK_SIZE) & ~0xf);
+        *--sp = (uint32_t) t;
+        *--sp = 0;
+
+        /* the new thread looks itself up in pthread_self, so hold the
+         * list lock until it is on the list */
+        pthread_lock(&pthread_list_lock);
+        if (0 > (tid = thr_create((void *) pthread_start, sp))) {
+                pthread_unlock(&pthread_list_lock);
+                free(t->pt_stack);
+                free(t);
+                return errno;
+        }
+        t->pt_tid = tid;
+        t->pt_next = pthread_list;
+        pthread_list = t;
+        pthread_unlock(&pthread_list_lock);
+
+        *thr = t;
+        return 0;
+}
+
+int
+pthread_join(pthread_t thr, void **retval)
+{
+        struct pthread **pp;
+
+        if (thr->pt_detached)
+                return EINVAL;
+        if (0 > thr_join(thr->pt_tid, retval))
+                return errno;
+
+        pthread_lock(&pthread_list_lock);
+        for (pp = &pthread_list; *pp != thr; pp = &(*pp)->pt_next)
+                ;
+        *pp = thr->pt_next;
+        pthread_unlock(&pthread_list_lock);
+
+        free(thr->pt_stack);
+        if (&pthread_main != thr)
+                free(thr);
+        pthread_reap();
+        return 0;
+}
+
+/*
+ * The thread is not detached in the kernel, since it would then be
+ * destroyed while its stack is still in use. It is only marked, so that
+ * pthread_reap joins it after it exits. The main thread has no stack to
+ * free and the kernel can detach it directly.
+ */
+int
+pthread_detach(pthread_t thr)
+{
+        if (thr->pt_detached)
+                return EINVAL;
+        if (&pthread_main == thr) {
+                if (0 > thr_detach(thr->pt_tid))
+                        return errno;
+        }
+        thr->pt_detached = 1;
+        return 0;
+}
+
+void
+pthread_exit(void *retval)
+{
+        pthread_self()->pt_done = 1;
+        trap(SYS_thr_exit, (uint32_t) retval);
+}
+
+pthread_t
+pthread_self(void)
+{
+        struct pthread *t;
+        int tid = gettid();
+
+        pthread_lock(&pthread_list_lock);
+        for (t = pthread_list; NULL != t; t = t->pt_next) {
+                if (tid == t->pt_tid)
+                        break;
+        }
+        if (NULL == t) {
+                /* only the main thread was not made by pthread_create */
+                t = &pthread_main;
+                t->pt_tid = tid;
+                t->pt_stack = NULL;
+                t->pt_detached = 0;
+                t->pt_done = 0;
+                t->pt_next = pthread_list;
+                pthread_list = t;
+        }
+        pthread_unlock(&pthread_list_lock);
+        return t;
+}
+
+int
+pthread_equal(pthread_t t1, pthread_t t2)
+{
+        return t1 == t2;
+}
+
+void
+pthread_yield(void)
+{
+        thr_yield();
+}
+
+int
+pthread_mutex_init(pthread_mutex_t *mtx, const pthread_mutexattr_t *attr)
+{
+        if (NULL == (*mtx = malloc(sizeof(**mtx))))
+                return ENOMEM;
+        (*mtx)->pm_locked = 0;
+        return 0;
+}
+
+int
+pthread_mutex_destroy(pthread_mutex_t *mtx)
+{
+        if ((*mtx)->pm_locked)
+                return EBUSY;
+        free(*mtx);
+        *mtx = NULL;
+        return 0;
+}
+
+int
+pthread_mutex_lock(pthread_mutex_t *mtx)
+{
+        pthread_lock(*mtx);
+        return 0;
+}
+
+int
+pthread_mutex_trylock(pthread_mutex_t *mtx)
+{
+        return pthread_xchg(&(*mtx)->pm_locked, 1) ? EBUSY : 0;
+}
+
+int
+pthread_mutex_unlock(pthread_mutex_t *mtx)
+{
+        pthread_unlock(*mtx);
+        return 0;
+}
@@ -98,6 +98,41 @@ void yield(void)
         (fork() ? wait(NULL) : exit(0));
 }
 
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+        nanosleep_args_t args;
+
+        args.req = req;
+        args.rem = rem;
+
+        return trap(SYS_sleep, (uint32_t) &args);
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+        struct timespec req, rem;
+
+        /* time_t is signed, longer sleeps are cut short by the kernel anyway */
+        req.tv_sec = (seconds > 0x7fffffff) ? 0x7fffffff : seconds;
+        req.tv_nsec = 0;
+        if (0 > nanosleep(&req, &rem)) {
+                /* rem is only written when the sleep was interrupted */
+                if (EINTR == errno)
+                        return rem.tv_sec + (rem.tv_nsec > 0);
+                return seconds;
+        }
+        return 0;
+}
+
+int usleep(unsigned int usecs)
+{
+        struct timespec req;
+
+        req.tv_sec = usecs / 1000000;
+        req.tv_nsec = (usecs % 1000000) * 1000;
+        return nanosleep(&req, NULL);
+}
+
 pid_t wait(int *status)
 {
         waitpid_args_t args;
@@ -125,6 +160,41 @@ void thr_exit(int status)
         trap(SYS_thr_exit, (uint32_t) status);
 }
 
+int thr_create(void *entry, void *stack)
+{
+        thr_create_args_t args;
+
+        args.tca_entry = entry;
+        args.tca_stack = stack;
+
+        return trap(SYS_thr_create, (uint32_t) &args);
+}
+
+int thr_join(int tid, void **retval)
+{
+        thr_join_args_t args;
+
+        args.tja_tid = tid;
+        args.tja_retval = retval;
+
+        return trap(SYS_thr_join, (uint32_t) &args);
+}
+
+int thr_detach(int tid)
+{
+        return trap(SYS_thr_detach, (uint32_t) tid);
+}
+
+void thr_yield(void)
+{
+        trap(SYS_thr_yield, 0);
+}
+
+int gettid(void)
+{
+        return trap(SYS_gettid, 0);
+}
+
 pid_t getpid(void)
 {
         return trap(SYS_getpid, 0);
@@ -221,6 +291,16 @@ int dup(int fd)
         return trap(SYS_dup, (uint32_t) fd);
 }
 
+int fsync(int fd)
+{
+        return trap(SYS_fsync, (uint32_t) fd);
+}
+
+int fdatasync(int fd)
+{
+        return trap(SYS_fdatasync, (uint32_t) fd);
+}
+
 int dup2(int ofd, int nfd)
 {
         dup2_args_t args;
@@ -0,0 +1,65 @@
+/*
+ * Measures how long fork() takes as the number of live processes
+ * grows. Each process forks the next one in a chain and then waits
+ * for it, so all of the processes stay alive until the chain ends.
+ * Fork latency should stay roughly flat as the chain gets longer.
+ *
+ * usage: forklat [nprocs [interval]]
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+static unsigned long rdtsc(void)
+{
+        unsigned long lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return lo;
+}
+
+int main(int argc, char **argv)
+{
+        int nprocs = 1000;
+        int interval = 100;
+        int n, status;
+        unsigned long start, cycles;
+        pid_t pid;
+
+        if (argc > 1)
+                nprocs = atoi(argv[1]);
+        if (argc > 2)
+                interval = atoi(argv[2]);
+        if (nprocs < 1 || interval < 1) {
+                printf("usage: forklat [nprocs [interval]]\n");
+                return 1;
+        }
+
+        open("/dev/tty0", O_RDONLY, 0);
+        open("/dev/tty0", O_WRONLY, 0);
+        printf("forking a chain of %d processes\n", nprocs);
+
+        for (n = 1; n <= nprocs; n++) {
+                start = rdtsc();
+                pid = fork();
+                cycles = rdtsc() - start;
+
+                if (0 == pid) {
+                        /* child, fork the next link */
+                        continue;
+                } else if (-1 == pid) {
+                        printf("fork %d failed, stopping\n", n);
+                        exit(1);
+                }
+
+                if (0 == n % interval)
+                        printf("%6d processes: fork took %lu cycles\n", n, cycles);
+                while (wait(&status) > 0)
+                        ;
+                if (1 == n)
+                        printf("done\n");
+                exit(0);
+        }
+        return 0;
+}
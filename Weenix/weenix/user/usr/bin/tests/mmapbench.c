@@ -0,0 +1,79 @@
+/*
+ * Measures mmap() and page fault latency as the number of mappings in
+ * an address space grows. Each step maps one more single-page anonymous
+ * region and writes to it, which makes the kernel find a gap for the
+ * region and then look it up again on the fault. Both should stay
+ * roughly flat as the address space fills up.
+ *
+ * usage: mmapbench [nregions [interval]]
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define PAGESIZE 4096
+
+static unsigned long rdtsc(void)
+{
+        unsigned long lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return lo;
+}
+
+int main(int argc, char **argv)
+{
+        int nregions = 4000;
+        int interval = 500;
+        int n;
+        unsigned long start, mapcycles = 0, faultcycles = 0;
+        char **regions;
+
+        if (argc > 1)
+                nregions = atoi(argv[1]);
+        if (argc > 2)
+                interval = atoi(argv[2]);
+        if (nregions < 1 || interval < 1) {
+                printf("usage: mmapbench [nregions [interval]]\n");
+                return 1;
+        }
+
+        open("/dev/tty0", O_RDONLY, 0);
+        open("/dev/tty0", O_WRONLY, 0);
+
+        if (NULL == (regions = malloc(nregions * sizeof(*regions)))) {
+                printf("out of memory\n");
+                return 1;
+        }
+        printf("mapping %d regions\n", nregions);
+
+        for (n = 0; n < nregions; n++) {
+                start = rdtsc();
+                regions[n] = mmap(NULL, PAGESIZE, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANON, -1, 0);
+                mapcycles += rdtsc() - start;
+                if (MAP_FAILED == regions[n]) {
+                        printf("mmap %d failed, stopping\n", n);
+                        break;
+                }
+
+                start = rdtsc();
+                regions[n][0] = (char) n;
+                faultcycles += rdtsc() - start;
+
+                if (0 == (n + 1) % interval) {
+                        printf("%6d regions: mmap took %lu cycles, fault took %lu cycles\n",
+                               n + 1, mapcycles / interval, faultcycles / interval);
+                        mapcycles = 0;
+                        faultcycles = 0;
+                }
+        }
+
+        while (n-- > 0)
+                munmap(regions[n], PAGESIZE);
+        free(regions);
+        printf("done\n");
+        return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Exercises the pthread library: several threads bump a shared counter
+ * under a mutex, each returns a value which main collects with
+ * pthread_join, and more threads are detached, enough that they only
+ * fit in memory if their stacks are freed after they exit. Needs a
+ * kernel built with MTP.
+ *
+ * usage: pthreadtest [nthreads [iterations]]
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread/pthread.h>
+
+#define MAX_THREADS 32
+#define DETACHED    256 /* 16MB of thread stacks if none were freed */
+
+static pthread_mutex_t counter_lock;
+static int counter = 0;
+static int iterations = 1000;
+
+static void *worker(void *arg)
+{
+        int i;
+
+        for (i = 0; i < iterations; i++) {
+                pthread_mutex_lock(&counter_lock);
+                counter++;
+                pthread_mutex_unlock(&counter_lock);
+                if (0 == i % 100)
+                        pthread_yield();
+        }
+        return arg;
+}
+
+static void *detached(void *arg)
+{
+        return NULL;
+}
+
+int main(int argc, char **argv)
+{
+        pthread_t thrs[MAX_THREADS];
+        pthread_t thr;
+        int nthreads = 4;
+        int i, err, failed = 0;
+        void *ret;
+
+        if (argc > 1)
+                nthreads = atoi(argv[1]);
+        if (argc > 2)
+                iterations = atoi(argv[2]);
+        if (nthreads < 1 || nthreads > MAX_THREADS || iterations < 1) {
+                printf("usage: pthreadtest [nthreads [iterations]]\n");
+                return 1;
+        }
+
+        open("/dev/tty0", O_RDONLY, 0);
+        open("/dev/tty0", O_WRONLY, 0);
+
+        if (0 != (err = pthread_mutex_init(&counter_lock, NULL))) {
+                printf("pthread_mutex_init failed: %d\n", err);
+                return 1;
+        }
+
+        for (i = 0; i < nthreads; i++) {
+                if (0 != (err = pthread_create(&thrs[i], NULL, worker, (void *) i))) {
+                        printf("pthread_create %d failed: %d\n", i, err);
+                        return 1;
+                }
+        }
+        for (i = 0; i < DETACHED; i++) {
+                if (0 != (err = pthread_create(&thr, NULL, detached, NULL))
+                    || 0 != (err = pthread_detach(thr))) {
+                        printf("detached thread %d failed: %d\n", i, err);
+                        failed = 1;
+                        break;
+                }
+                pthread_yield();
+        }
+
+        for (i = 0; i < nthreads; i++) {
+                if (0 != (err = pthread_join(thrs[i], &ret))) {
+                        printf("pthread_join %d failed: %d\n", i, err);
+                        failed = 1;
+                } else if ((int) ret != i) {
+                        printf("thread %d returned %d\n", i, (int) ret);
+                        failed = 1;
+                }
+        }
+
+        if (counter != nthreads * iterations) {
+                printf("counter is %d, expected %d\n", counter, nthreads * iterations);
+                failed = 1;
+        }
+        pthread_mutex_destroy(&counter_lock);
+
+        printf("%s\n", failed ? "FAILED" : "passed");
+        return failed;
+}
@@ -447,6 +447,14 @@ vfstest_fd(void)
         syscall_fail(dup2(HUGE_FD, 10), EBADF);
         syscall_fail(dup2(-1, 10), EBADF);
 
+        syscall_fail(fsync(BAD_FD), EBADF);
+        syscall_fail(fsync(HUGE_FD), EBADF);
+        syscall_fail(fsync(-1), EBADF);
+
+        syscall_fail(fdatasync(BAD_FD), EBADF);
+        syscall_fail(fdatasync(HUGE_FD), EBADF);
+        syscall_fail(fdatasync(-1), EBADF);
+
         /* dup2 has some extra cases since it takes a second fd */
         syscall_fail(dup2(0, HUGE_FD), EBADF);
         syscall_fail(dup2(0, -1), EBADF);
@@ -468,6 +476,9 @@ vfstest_fd(void)
         test_fpos(fd1, 0); test_fpos(fd2, 0);
         read_fd(fd1, 5, "hello");
         test_fpos(fd1, 5); test_fpos(fd2, 5);
+        syscall_success(fsync(fd2));
+        syscall_success(fdatasync(fd1));
+        test_fpos(fd1, 5); test_fpos(fd2, 5);
         syscall_success(close(fd2));
 
         /* dup2 works properly in normal usage */